@@ -0,0 +1,342 @@
+#include <pthread.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "arena.h"
+#include "alloc.h"
+
+/*
+ * Header in front of every block the pool hands out, saying which pool the
+ * block came from, so that a block freed on another thread finds its way
+ * back there.
+ */
+struct blockhead {
+	struct pool *pool;		/* pool block came from */
+	long class;			/* size-class, -1 if too big */
+};
+
+/*
+ * A block too big for any size-class. These come straight from malloc and
+ * go straight back when freed, and are kept on a list so that resetting
+ * the pool can find the ones still in use.
+ */
+struct bigblock {
+	struct bigblock *prev;		/* previous block in list */
+	struct bigblock *next;		/* next block in list */
+	struct blockhead head;		/* header of block */
+};
+
+/*
+ * One thread's pool. Blocks are carved out of the arena and go back on the
+ * free list of their size-class when freed. Only the pool's own thread
+ * touches it, but for `remote`: blocks freed on other threads are put
+ * there under the lock, and taken back by the pool's thread when it runs
+ * short. A pool whose thread has exited is freed once its last block is.
+ */
+struct pool {
+	struct arena arena;		/* memory blocks are carved from */
+	void *free[NPOOLCLASS];		/* free blocks of each size-class */
+	struct bigblock *big;		/* blocks too big for a size-class */
+	long live;			/* blocks handed out */
+	pthread_mutex_t lock;		/* guards remote and exited */
+	void *remote;			/* blocks freed by other threads */
+	int exited;			/* thread that owns it has exited */
+};
+
+static _Thread_local struct pool *mine;
+static pthread_key_t poolkey;
+static pthread_once_t poolkeymade = PTHREAD_ONCE_INIT;
+
+static void *sysget(void *ctx, size_t size) {
+	return malloc(size);
+}
+
+static void *sysresize(void *ctx, void *ptr, size_t old, size_t size) {
+	return realloc(ptr, size);
+}
+
+static void sysput(void *ctx, void *ptr, size_t size) {
+	free(ptr);
+}
+
+struct allocator sysalloc = { sysget, sysresize, sysput, NULL, NULL };
+
+/*
+ * Get the size-class of a block with its header, or -1 if it is too big
+ * for any of them.
+ */
+static int sizeclass(size_t size) {
+	int class;
+
+	size += sizeof(struct blockhead);
+	for (class = 0; class < NPOOLCLASS; class++) {
+		if (size <= (size_t)POOLMIN << class)
+			return class;
+	}
+	return -1;
+}
+
+static struct blockhead *headof(void *ptr) {
+	return (struct blockhead *)ptr - 1;
+}
+
+/*
+ * Free everything a pool holds, and the pool itself.
+ */
+static void destroypool(struct pool *p) {
+	struct bigblock *big, *next;
+
+	for (big = p->big; big != NULL; big = next) {
+		next = big->next;
+		free(big);
+	}
+	arenafree(&p->arena);
+	pthread_mutex_destroy(&p->lock);
+	free(p);
+}
+
+/*
+ * Put a block back in the pool it came from, which must belong to the
+ * calling thread or have been left by one that exited.
+ */
+static void putback(struct pool *p, void *ptr) {
+	struct blockhead *head;
+	struct bigblock *big;
+
+	head = headof(ptr);
+	p->live--;
+	if (head->class < 0) {
+		big = (struct bigblock *)((char *)head
+		    - offsetof(struct bigblock, head));
+		if (big->prev != NULL)
+			big->prev->next = big->next;
+		else
+			p->big = big->next;
+		if (big->next != NULL)
+			big->next->prev = big->prev;
+		free(big);
+		return;
+	}
+	*(void **)ptr = p->free[head->class];
+	p->free[head->class] = ptr;
+}
+
+/*
+ * Take back the blocks other threads have freed into a pool.
+ */
+static void takeremote(struct pool *p) {
+	void *ptr, *next;
+
+	pthread_mutex_lock(&p->lock);
+	ptr = p->remote;
+	p->remote = NULL;
+	pthread_mutex_unlock(&p->lock);
+	for (; ptr != NULL; ptr = next) {
+		next = *(void **)ptr;
+		putback(p, ptr);
+	}
+}
+
+/*
+ * Give up a pool when its thread exits. Blocks still out on other threads
+ * keep it alive until the last of them is freed.
+ */
+static void exitpool(void *arg) {
+	struct pool *p;
+	void *ptr, *next;
+	bool last;
+
+	p = arg;
+	pthread_mutex_lock(&p->lock);
+	for (ptr = p->remote; ptr != NULL; ptr = next) {
+		next = *(void **)ptr;
+		putback(p, ptr);
+	}
+	p->remote = NULL;
+	p->exited = 1;
+	last = p->live == 0;
+	pthread_mutex_unlock(&p->lock);
+	if (last)
+		destroypool(p);
+}
+
+static void makepoolkey(void) {
+	pthread_key_create(&poolkey, exitpool);
+}
+
+/*
+ * Get the calling thread's pool, making it the first time, and arranging
+ * for it to be given up when the thread exits.
+ */
+static struct pool *ownpool(void) {
+	if (mine == NULL) {
+		pthread_once(&poolkeymade, makepoolkey);
+		mine = calloc(1, sizeof(struct pool));
+		pthread_mutex_init(&mine->lock, NULL);
+		pthread_setspecific(poolkey, mine);
+	}
+	return mine;
+}
+
+static void *poolget(void *ctx, size_t size) {
+	struct bigblock *big;
+	struct blockhead *head;
+	struct pool *p;
+	void *ptr;
+	int class;
+
+	p = ownpool();
+	if ((class = sizeclass(size)) < 0) {
+		big = malloc(sizeof(struct bigblock) + size);
+		big->prev = NULL;
+		big->next = p->big;
+		if (p->big != NULL)
+			p->big->prev = big;
+		p->big = big;
+		head = &big->head;
+	} else {
+		if (p->free[class] == NULL)
+			takeremote(p);
+		if ((ptr = p->free[class]) != NULL) {
+			p->free[class] = *(void **)ptr;
+			head = headof(ptr);
+		} else
+			head = arenaalloc(&p->arena, (size_t)POOLMIN << class);
+	}
+	head->pool = p;
+	head->class = class;
+	p->live++;
+	return head + 1;
+}
+
+/*
+ * Free a block. One from another thread's pool is handed to that thread,
+ * or put straight back if the thread has exited, freeing the pool along
+ * with its last block.
+ */
+static void poolput(void *ctx, void *ptr, size_t size) {
+	struct pool *p;
+	bool last;
+
+	if (ptr == NULL)
+		return;
+	if ((p = headof(ptr)->pool) == mine) {
+		putback(p, ptr);
+		return;
+	}
+	pthread_mutex_lock(&p->lock);
+	last = false;
+	if (p->exited) {
+		putback(p, ptr);
+		last = p->live == 0;
+	} else {
+		*(void **)ptr = p->remote;
+		p->remote = ptr;
+	}
+	pthread_mutex_unlock(&p->lock);
+	if (last)
+		destroypool(p);
+}
+
+static void *poolresize(void *ctx, void *ptr, size_t old, size_t size) {
+	void *new;
+
+	if (ptr != NULL && headof(ptr)->class >= 0
+	    && headof(ptr)->class == sizeclass(size))
+		return ptr;
+	new = poolget(ctx, size);
+	if (ptr != NULL) {
+		memcpy(new, ptr, old < size ? old : size);
+		poolput(ctx, ptr, old);
+	}
+	return new;
+}
+
+/*
+ * Release everything the calling thread has allocated from the pool,
+ * including blocks other threads still hold or have freed.
+ */
+static void poolreset(void *ctx) {
+	struct bigblock *big, *next;
+	struct pool *p;
+
+	p = ownpool();
+	pthread_mutex_lock(&p->lock);
+	p->remote = NULL;
+	pthread_mutex_unlock(&p->lock);
+	for (big = p->big; big != NULL; big = next) {
+		next = big->next;
+		free(big);
+	}
+	p->big = NULL;
+	p->live = 0;
+	arenareset(&p->arena);
+	memset(p->free, 0, sizeof(p->free));
+}
+
+/*
+ * The pool's state is thread-local rather than kept in `ctx`, so one
+ * allocator serves every thread.
+ */
+struct allocator poolalloc = { poolget, poolresize, poolput, poolreset,
+    NULL };
+
+static void *arenaget(void *ctx, size_t size) {
+	return arenaalloc(ctx, size);
+}
+
+static void *arenagrow(void *ctx, void *ptr, size_t old, size_t size) {
+	return arenaresize(ctx, ptr, old, size);
+}
+
+static void arenaput(void *ctx, void *ptr, size_t size) {
+	arenarelease(ctx, ptr, size);
+}
+
+static void arenaclear(void *ctx) {
+	arenareset(ctx);
+}
+
+/*
+ * Make an allocator that bump-allocates from the given arena.
+ */
+void arenaallocator(struct allocator *alloc, struct arena *arena) {
+	alloc->alloc = arenaget;
+	alloc->resize = arenagrow;
+	alloc->free = arenaput;
+	alloc->reset = arenaclear;
+	alloc->ctx = arena;
+}
+
+/*
+ * Allocate memory from an allocator. The memory is not cleared.
+ */
+void *allocate(struct allocator *alloc, size_t size) {
+	return alloc->alloc(alloc->ctx, size);
+}
+
+/*
+ * Resize a block to the given size, moving it if need be. A NULL block is
+ * allocated afresh.
+ */
+void *reallocate(struct allocator *alloc, void *ptr, size_t old,
+    size_t size) {
+	return alloc->resize(alloc->ctx, ptr, old, size);
+}
+
+/*
+ * Give a block back to its allocator.
+ */
+void deallocate(struct allocator *alloc, void *ptr, size_t size) {
+	alloc->free(alloc->ctx, ptr, size);
+}
+
+/*
+ * Release everything allocated from an allocator, if it can do that.
+ */
+void resetalloc(struct allocator *alloc) {
+	if (alloc->reset != NULL)
+		alloc->reset(alloc->ctx);
+}
@@ -0,0 +1,50 @@
+#ifndef _ALLOC_H_
+#define _ALLOC_H_
+
+#include <stddef.h>
+
+/*
+ * Smallest block the per-thread pool hands out, counting the header that
+ * says which pool it came from, and how many size-classes it has. Each
+ * class holds blocks twice the size of the one before it. Bigger requests
+ * go straight to the system.
+ */
+#define POOLMIN		32
+#define NPOOLCLASS	8
+
+/*
+ * Where the lexer and parser get their memory from. The size of a block is
+ * passed back when it is resized or freed, so allocators need not record
+ * it. `reset` releases everything allocated so far at once, and may be
+ * NULL if the allocator cannot do that.
+ */
+struct allocator {
+	void *(*alloc)(void *ctx, size_t size);
+	void *(*resize)(void *ctx, void *ptr, size_t old, size_t size);
+	void (*free)(void *ctx, void *ptr, size_t size);
+	void (*reset)(void *ctx);
+	void *ctx;		/* state of allocator */
+};
+
+/*
+ * The system's allocator, and a pool allocator that keeps separate free
+ * lists for each thread so that threads never contend for memory. A block
+ * may be freed on any thread; one freed away from the thread that
+ * allocated it goes back to that thread's pool. Resetting the pool
+ * releases everything the calling thread allocated from it, wherever it
+ * is held, and a thread's pool is freed when the thread has exited and
+ * its blocks have all been freed.
+ */
+extern struct allocator sysalloc;
+extern struct allocator poolalloc;
+
+struct arena;
+
+void *allocate(struct allocator *alloc, size_t size);
+void *reallocate(struct allocator *alloc, void *ptr, size_t old,
+    size_t size);
+void deallocate(struct allocator *alloc, void *ptr, size_t size);
+void resetalloc(struct allocator *alloc);
+void arenaallocator(struct allocator *alloc, struct arena *arena);
+
+#endif /* !_ALLOC_H_ */
@@ -0,0 +1,158 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "arena.h"
+
+/*
+ * Every allocation is rounded up to this, which is enough for any of the
+ * objects we store.
+ */
+#define ALIGN	(sizeof(long double))
+
+/*
+ * Allocate a new chunk that can hold at least the given number of bytes.
+ */
+static struct chunk *mkchunk(size_t size) {
+	struct chunk *chunk;
+
+	if (size < ARENACHUNK)
+		size = ARENACHUNK;
+	chunk = malloc(sizeof(struct chunk) + size);
+	chunk->next = NULL;
+	chunk->size = size;
+	chunk->used = 0;
+	return chunk;
+}
+
+/*
+ * Allocate memory from an arena. The memory is not cleared.
+ */
+void *arenaalloc(struct arena *arena, size_t size) {
+	struct chunk *chunk;
+	void *ptr;
+
+	size = (size + ALIGN - 1) & ~(ALIGN - 1);
+	if (arena->curr == NULL)
+		arena->head = arena->curr = mkchunk(size);
+	/*
+	 * Move on to the next chunk if this one is full. Chunks past the
+	 * current one are left over from before the last reset, so try to
+	 * reuse them before allocating a new one.
+	 */
+	while (arena->curr->used + size > arena->curr->size) {
+		chunk = arena->curr->next;
+		if (chunk == NULL || chunk->size < size) {
+			chunk = mkchunk(size);
+			chunk->next = arena->curr->next;
+			arena->curr->next = chunk;
+		}
+		arena->curr = chunk;
+		chunk->used = 0;
+	}
+	ptr = &arena->curr->data[arena->curr->used];
+	arena->curr->used += size;
+	return ptr;
+}
+
+/*
+ * Resize memory allocated from an arena. The last allocation is grown in
+ * place if its chunk has room; anything else is copied to a new block.
+ */
+void *arenaresize(struct arena *arena, void *ptr, size_t old, size_t size) {
+	struct chunk *chunk;
+	size_t offset;
+	void *new;
+
+	old = (old + ALIGN - 1) & ~(ALIGN - 1);
+	size = (size + ALIGN - 1) & ~(ALIGN - 1);
+	chunk = arena->curr;
+	if (ptr != NULL && chunk != NULL
+	    && (char *)ptr + old == &chunk->data[chunk->used]) {
+		offset = (char *)ptr - chunk->data;
+		if (offset + size <= chunk->size) {
+			chunk->used = offset + size;
+			return ptr;
+		}
+	}
+	new = arenaalloc(arena, size);
+	if (ptr != NULL)
+		memcpy(new, ptr, old < size ? old : size);
+	return new;
+}
+
+/*
+ * Give back memory allocated from an arena. Only the last allocation can
+ * be reused straight away; anything else is released when the arena is
+ * reset.
+ */
+void arenarelease(struct arena *arena, void *ptr, size_t size) {
+	struct chunk *chunk;
+
+	size = (size + ALIGN - 1) & ~(ALIGN - 1);
+	chunk = arena->curr;
+	if (ptr != NULL && chunk != NULL
+	    && (char *)ptr + size == &chunk->data[chunk->used])
+		chunk->used -= size;
+}
+
+/*
+ * Remember how much of an arena is in use.
+ */
+void markarena(struct arena *arena, struct arenamark *mark) {
+	mark->chunk = arena->curr;
+	mark->used = arena->curr != NULL ? arena->curr->used : 0;
+}
+
+/*
+ * Release everything allocated from an arena since it was marked. Chunks
+ * filled since then are kept to be reused.
+ */
+void rewindarena(struct arena *arena, struct arenamark *mark) {
+	if (mark->chunk == NULL) {
+		arenareset(arena);
+		return;
+	}
+	arena->curr = mark->chunk;
+	arena->curr->used = mark->used;
+}
+
+/*
+ * Release everything allocated from an arena, but keep its chunks.
+ */
+void arenareset(struct arena *arena) {
+	arena->curr = arena->head;
+	if (arena->curr != NULL)
+		arena->curr->used = 0;
+}
+
+/*
+ * Release everything allocated from an arena along with its chunks.
+ */
+void arenafree(struct arena *arena) {
+	struct chunk *chunk, *next;
+
+	for (chunk = arena->head; chunk != NULL; chunk = next) {
+		next = chunk->next;
+		free(chunk);
+	}
+	arena->head = arena->curr = NULL;
+}
+
+/*
+ * Visit every object in an arena that holds nothing but objects of the
+ * given size, in the order they were allocated. Objects are laid out one
+ * after another, so this reads memory sequentially.
+ */
+void arenascan(struct arena *arena, size_t size,
+    void (*visit)(void *obj, void *ctx), void *ctx) {
+	struct chunk *chunk;
+	size_t offset;
+
+	size = (size + ALIGN - 1) & ~(ALIGN - 1);
+	for (chunk = arena->head; chunk != NULL; chunk = chunk->next) {
+		for (offset = 0; offset + size <= chunk->used; offset += size)
+			visit(&chunk->data[offset], ctx);
+		if (chunk == arena->curr)
+			break;
+	}
+}
@@ -0,0 +1,50 @@
+#ifndef _ARENA_H_
+#define _ARENA_H_
+
+#include <stddef.h>
+
+/*
+ * Size of each chunk an arena allocates, unless a single allocation needs
+ * more than this.
+ */
+#define ARENACHUNK	65536
+
+/*
+ * A block of memory that allocations are carved out of.
+ */
+struct chunk {
+	struct chunk *next;	/* next chunk in arena */
+	size_t size;		/* usable bytes in chunk */
+	size_t used;		/* bytes handed out */
+	char data[];		/* memory of chunk */
+};
+
+/*
+ * Bump allocator. Everything allocated from an arena is released at once by
+ * resetting it, which keeps the chunks around to be reused by the next
+ * translation unit.
+ */
+struct arena {
+	struct chunk *head;	/* first chunk */
+	struct chunk *curr;	/* chunk being allocated from */
+};
+
+/*
+ * A point in an arena that it can be rewound to.
+ */
+struct arenamark {
+	struct chunk *chunk;	/* chunk being allocated from */
+	size_t used;		/* bytes handed out from it */
+};
+
+void *arenaalloc(struct arena *arena, size_t size);
+void *arenaresize(struct arena *arena, void *ptr, size_t old, size_t size);
+void arenarelease(struct arena *arena, void *ptr, size_t size);
+void markarena(struct arena *arena, struct arenamark *mark);
+void rewindarena(struct arena *arena, struct arenamark *mark);
+void arenareset(struct arena *arena);
+void arenafree(struct arena *arena);
+void arenascan(struct arena *arena, size_t size,
+    void (*visit)(void *obj, void *ctx), void *ctx);
+
+#endif /* !_ARENA_H_ */
@@ -0,0 +1,91 @@
+#include <setjmp.h>
+
+#include "token.h"
+#include "arena.h"
+#include "alloc.h"
+#include "error.h"
+#include "lex.h"
+#include "cpp.h"
+#include "parse.h"
+#include "compile.h"
+
+/*
+ * Run the front-end over a translation unit, either building its syntax
+ * tree or streaming it. Whoever was catching errors before is catching
+ * them again once this returns, and the preprocessor is done with the
+ * translation unit either way.
+ */
+static int run(struct cpp *cpp, struct parser *parser, char *path,
+    char *source, int length, struct diagbuf *diags, struct stream *stream) {
+	struct diagbuf *prev;
+	jmp_buf env, *catcher;
+
+	prev = collecterrors(diags);
+	catcher = catcherrors(&env);
+	if (setjmp(env)) {
+		catcherrors(catcher);
+		cppdone(cpp);
+		if (diags != NULL)
+			errorf("%s", lasterror());
+		collecterrors(prev);
+		return -1;
+	}
+	parser->stream = stream;
+	if (stream != NULL) {
+		cppstream(cpp, path, source, length);
+		parsereset(parser, NULL);
+	} else {
+		cppreset(cpp, path, source, length);
+		parsereset(parser, preprocess(cpp));
+	}
+	parse(parser);
+	catcherrors(catcher);
+	cppdone(cpp);
+	collecterrors(prev);
+	return diags != NULL && diags->count > 0 ? -1 : 0;
+}
+
+/*
+ * Run the front-end over one translation unit. The preprocessor and parser
+ * are reset rather than recreated, so anything they have cached stays warm
+ * across calls. Returns 0 on success, or -1 on error.
+ *
+ * If `diags` is NULL, the first error stops compilation and its message can
+ * be had from `lasterror`. Otherwise, recoverable errors are collected into
+ * `diags` and compilation carries on past them; an error that cannot be
+ * recovered from is added to `diags` as well.
+ */
+int compile(struct cpp *cpp, struct parser *parser, char *path,
+    char *source, int length, struct diagbuf *diags) {
+	return run(cpp, parser, path, source, length, diags, NULL);
+}
+
+static struct token *readcpp(void *cpp) {
+	return cppnext(cpp);
+}
+
+static void releasecpp(void *cpp) {
+	cpprelease(cpp);
+}
+
+/*
+ * Like `compile`, but stream the translation unit instead of building its
+ * syntax tree. Each external declaration is handed to `emit` as soon as it
+ * is parsed, then its nodes and tokens are released, so memory depends on
+ * the largest declaration rather than the size of the file.
+ */
+int compilestream(struct cpp *cpp, struct parser *parser, char *path,
+    char *source, int length, struct diagbuf *diags,
+    void (*emit)(struct tree *decl, void *sink), void *sink) {
+	struct stream stream;
+	int status;
+
+	stream.read = readcpp;
+	stream.release = releasecpp;
+	stream.src = cpp;
+	stream.emit = emit;
+	stream.sink = sink;
+	status = run(cpp, parser, path, source, length, diags, &stream);
+	parser->stream = NULL;
+	return status;
+}
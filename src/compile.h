@@ -0,0 +1,12 @@
+#ifndef _COMPILE_H_
+#define _COMPILE_H_
+
+struct tree;
+
+int compile(struct cpp *cpp, struct parser *parser, char *path,
+    char *source, int length, struct diagbuf *diags);
+int compilestream(struct cpp *cpp, struct parser *parser, char *path,
+    char *source, int length, struct diagbuf *diags,
+    void (*emit)(struct tree *decl, void *sink), void *sink);
+
+#endif /* !_COMPILE_H_ */
@@ -0,0 +1,1902 @@
+#include <ctype.h>
+#include <limits.h>
+#include <setjmp.h>
+#include <stdarg.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "token.h"
+#include "arena.h"
+#include "alloc.h"
+#include "intern.h"
+#include "error.h"
+#include "input.h"
+#include "lex.h"
+#include "cpp.h"
+#include "parse.h"
+#include "header.h"
+
+/*
+ * Binary operators allowed in `#if`, by precedence level from lowest to
+ * highest. Each level ends with -1.
+ */
+static int cpplvls[][5] = {
+	{ T_LOR, -1 },
+	{ T_LAND, -1 },
+	{ T_BOR, -1 },
+	{ T_BXOR, -1 },
+	{ T_AMP, -1 },
+	{ T_EQ, T_NE, -1 },
+	{ T_LT, T_GT, T_LE, T_GE, -1 },
+	{ T_BLSHIFT, T_BRSHIFT, -1 },
+	{ T_PLUS, T_MINUS, -1 },
+	{ T_STAR, T_SLASH, T_MODULO, -1 },
+};
+
+#define NCPPLVL		(sizeof(cpplvls) / sizeof(cpplvls[0]))
+
+/*
+ * A value in `#if`, where every integer has the type intmax_t or
+ * uintmax_t. It is kept as uintmax_t, so that arithmetic on it wraps
+ * around rather than overflowing.
+ */
+struct ppval {
+	uintmax_t bits;		/* value, converted to uintmax_t */
+	bool isunsigned;	/* has the type uintmax_t */
+};
+
+static struct token *getexpanded(struct cpp *cpp);
+static void prefetchincludes(struct cpp *cpp, struct lexer *lexer);
+static struct token *stringize(struct cpp *cpp, struct token *arg,
+    struct token *at);
+static struct ppval evalcond(struct cpp *cpp, struct token **cur,
+    bool skip);
+static void detectguard(struct cpp *cpp, struct lexer *lexer);
+
+/*
+ * Set once includes nest too deep. A header that fails to parse on its own
+ * is usually included in place instead, but that would only nest as deep,
+ * so then the error is passed on.
+ */
+static _Thread_local bool toodeep;
+
+/*
+ * Report a fatal error at the directive or macro call being handled.
+ */
+static void cppfatal(struct cpp *cpp, char *fmt, ...) {
+	char message[MAXERROR];
+	va_list args;
+
+	va_start(args, fmt);
+	vsnprintf(message, sizeof(message), fmt, args);
+	va_end(args);
+	if (cpp->where == NULL)
+		fatalf("%s", message);
+	fatalf("%s:%d: %s", cpp->where->path ? cpp->where->path : "<input>",
+	    cpp->where->line, message);
+}
+
+/*
+ * Mix a value into a hash.
+ */
+static unsigned long mix(unsigned long hash, unsigned long value) {
+	return (hash ^ value) * 1099511628211UL;
+}
+
+/*
+ * Get the interned name of a name token.
+ */
+static char *tokname(struct token *tok) {
+	return (char *)tok->value;
+}
+
+/*
+ * Return true if a token is spelled as the given string. Directive names
+ * are matched by spelling, since some of them are also keywords.
+ */
+static bool spelled(struct token *tok, char *string) {
+	return tok != NULL && tok->length == (int)strlen(string)
+	    && !memcmp(tok->text, string, tok->length);
+}
+
+/*
+ * Copy a token into one of the preprocessor's arenas.
+ */
+static struct token *copytoken(struct arena *arena, struct token *tok) {
+	struct token *copy;
+
+	copy = arenaalloc(arena, sizeof(struct token));
+	*copy = *tok;
+	copy->next = NULL;
+	return copy;
+}
+
+/*
+ * Hash a name for placing it in a hide-set. Both steps can be undone, so
+ * different names always hash differently, and two names' paths through a
+ * trie always part before the hash runs out of bits.
+ */
+static uint64_t hshash(char *name) {
+	uint64_t hash;
+
+	hash = (uintptr_t)name * 0x9E3779B97F4A7C15ULL;
+	return hash ^ hash >> 32;
+}
+
+/*
+ * Return true if a name is in a hide-set.
+ */
+static bool inhideset(struct hideset *hs, char *name) {
+	uint64_t hash;
+
+	for (hash = hshash(name); hs != NULL; hash >>= 2) {
+		if (hs->name == name)
+			return true;
+		hs = hs->kids[hash & 3];
+	}
+	return false;
+}
+
+/*
+ * Add a name that is not in it to a subtrie of a hide-set, copying the
+ * nodes on the name's path.
+ */
+static struct hideset *hsinsert(struct cpp *cpp, struct hideset *hs,
+    char *name, uint64_t hash) {
+	struct hideset *new;
+
+	new = arenaalloc(&cpp->scratch, sizeof(struct hideset));
+	if (hs == NULL) {
+		memset(new, 0, sizeof(struct hideset));
+		new->name = name;
+		new->count = 1;
+		return new;
+	}
+	*new = *hs;
+	new->count++;
+	new->kids[hash & 3] = hsinsert(cpp, hs->kids[hash & 3], name,
+	    hash >> 2);
+	return new;
+}
+
+/*
+ * Add a name to a hide-set. Hide-sets are shared between tokens, so this
+ * returns a new set rather than changing the old one. Only tokens made by
+ * expanding macros have hide-sets, so sets live in the scratch arena with
+ * those tokens and are released along with them.
+ */
+static struct hideset *hsadd(struct cpp *cpp, struct hideset *hs,
+    char *name) {
+	if (inhideset(hs, name))
+		return hs;
+	return hsinsert(cpp, hs, name, hshash(name));
+}
+
+/*
+ * Add every name of a subtrie to a hide-set.
+ */
+static struct hideset *hsaddall(struct cpp *cpp, struct hideset *from,
+    struct hideset *to) {
+	int i;
+
+	if (from == NULL)
+		return to;
+	to = hsadd(cpp, to, from->name);
+	for (i = 0; i < 4; i++)
+		to = hsaddall(cpp, from->kids[i], to);
+	return to;
+}
+
+/*
+ * Get the union of two hide-sets. The names of the smaller are added to
+ * the larger.
+ */
+static struct hideset *hsunion(struct cpp *cpp, struct hideset *a,
+    struct hideset *b) {
+	if (a == NULL || a == b)
+		return b;
+	if (b == NULL)
+		return a;
+	if (a->count > b->count)
+		return hsaddall(cpp, b, a);
+	return hsaddall(cpp, a, b);
+}
+
+/*
+ * Add the names of a subtrie that are also in `other` to a hide-set.
+ */
+static struct hideset *hskeep(struct cpp *cpp, struct hideset *from,
+    struct hideset *other, struct hideset *to) {
+	int i;
+
+	if (from == NULL)
+		return to;
+	if (inhideset(other, from->name))
+		to = hsadd(cpp, to, from->name);
+	for (i = 0; i < 4; i++)
+		to = hskeep(cpp, from->kids[i], other, to);
+	return to;
+}
+
+/*
+ * Get the intersection of two hide-sets. The names of the smaller are
+ * looked for in the larger.
+ */
+static struct hideset *hsintersect(struct cpp *cpp, struct hideset *a,
+    struct hideset *b) {
+	if (a == b)
+		return a;
+	if (a == NULL || b == NULL)
+		return NULL;
+	if (a->count > b->count)
+		return hskeep(cpp, b, a, NULL);
+	return hskeep(cpp, a, b, NULL);
+}
+
+/*
+ * Find the link to a macro by its interned name, so that it can be replaced
+ * or removed. The link points to NULL if the macro is not defined.
+ */
+static struct macro **macrolink(struct cpp *cpp, char *name) {
+	struct macro **link;
+
+	link = &cpp->macros[((unsigned long)name >> 4)
+	    & (cpp->nmacrobucket - 1)];
+	while (*link != NULL && (*link)->name != name)
+		link = &(*link)->next;
+	return link;
+}
+
+/*
+ * Get what a header finds when it looks up a macro: the hash of its
+ * definition, or 0 if it is not defined.
+ */
+static unsigned long macrovalue(struct macro *macro) {
+	return macro != NULL ? macro->hash | 1 : 0;
+}
+
+/*
+ * Find a macro by its interned name, or NULL if it is not defined. A
+ * header being parsed for the store records the lookup.
+ */
+static struct macro *findmacro(struct cpp *cpp, char *name) {
+	struct macro *macro;
+
+	macro = *macrolink(cpp, name);
+	if (cpp->deps != NULL)
+		adddep(cpp->deps, DEP_MACRO, name, macrovalue(macro));
+	return macro;
+}
+
+/*
+ * Hash the whole of a macro definition, so that two definitions only hash
+ * the same if they expand the same way.
+ */
+static unsigned long hashmacro(struct macro *macro) {
+	struct token *tok;
+	unsigned long hash;
+	int i;
+
+	hash = hashbytes(macro->name, strlen(macro->name));
+	hash = mix(hash, macro->funclike | macro->variadic << 1);
+	for (i = 0; i < macro->nparam; i++)
+		hash = mix(hash, (unsigned long)macro->params[i]);
+	for (tok = macro->body; tok != NULL; tok = tok->next)
+		hash = mix(hash, hashbytes(tok->text, tok->length)
+		    ^ tok->space);
+	return hash;
+}
+
+/*
+ * Double the number of buckets in the macro table and move every macro to
+ * its new bucket.
+ */
+static void growmacros(struct cpp *cpp) {
+	struct macro **old, *macro, *next;
+	int i, size;
+
+	old = cpp->macros;
+	size = cpp->nmacrobucket;
+	cpp->nmacrobucket *= 2;
+	cpp->macros = calloc(cpp->nmacrobucket, sizeof(struct macro *));
+	for (i = 0; i < size; i++) {
+		for (macro = old[i]; macro != NULL; macro = next) {
+			next = macro->next;
+			macro->next = *macrolink(cpp, macro->name);
+			*macrolink(cpp, macro->name) = macro;
+		}
+	}
+	free(old);
+}
+
+/*
+ * Define a macro, or undefine it if `macro` is NULL. The change is recorded
+ * if changes are being recorded, and a header being parsed for the store
+ * owns the macro from then on.
+ */
+static void setmacro(struct cpp *cpp, char *name, struct macro *macro) {
+	struct macrodef *def;
+	struct macro **link;
+
+	if (cpp->nmacro >= cpp->nmacrobucket)
+		growmacros(cpp);
+	link = macrolink(cpp, name);
+	if (*link != NULL) {
+		*link = (*link)->next;
+		cpp->nmacro--;
+	}
+	if (macro != NULL) {
+		macro->next = *link;
+		*link = macro;
+		cpp->nmacro++;
+	}
+	if (cpp->deps != NULL)
+		owndep(cpp->deps, DEP_MACRO, name);
+	if (cpp->deftail != NULL) {
+		def = arenaalloc(&cpp->arena, sizeof(struct macrodef));
+		def->name = name;
+		def->macro = macro;
+		def->next = NULL;
+		*cpp->deftail = def;
+		cpp->deftail = &def->next;
+	}
+}
+
+/*
+ * Find the guard of a file by its interned path, or NULL if it has none.
+ */
+static struct guard *findguard(struct cpp *cpp, char *path) {
+	struct guard *guard;
+
+	guard = cpp->guards[((unsigned long)path >> 4) & (NGUARDBUCKET - 1)];
+	while (guard != NULL && guard->path != path)
+		guard = guard->next;
+	return guard;
+}
+
+/*
+ * Get what a header finds when it looks up the guard of a file: 0 if there
+ * is none, 1 for `#pragma once`, or the guard macro.
+ */
+static unsigned long guardvalue(struct guard *guard) {
+	if (guard == NULL)
+		return 0;
+	return guard->macro != NULL ? (unsigned long)guard->macro : 1;
+}
+
+/*
+ * Find the guard of a file about to be included. A header being parsed for
+ * the store records the lookup.
+ */
+static struct guard *lookupguard(struct cpp *cpp, char *path) {
+	struct guard *guard;
+
+	guard = findguard(cpp, path);
+	if (cpp->deps != NULL)
+		adddep(cpp->deps, DEP_GUARD, path, guardvalue(guard));
+	return guard;
+}
+
+/*
+ * Record that a file is guarded by a macro, or by `#pragma once` if the
+ * macro is NULL.
+ */
+static void addguard(struct cpp *cpp, char *path, char *macro) {
+	struct guard *guard, **head;
+
+	if ((guard = findguard(cpp, path)) != NULL) {
+		if (guard->macro != NULL)
+			guard->macro = macro;
+		return;
+	}
+	if (cpp->deps != NULL)
+		owndep(cpp->deps, DEP_GUARD, path);
+	head = &cpp->guards[((unsigned long)path >> 4) & (NGUARDBUCKET - 1)];
+	guard = arenaalloc(&cpp->arena, sizeof(struct guard));
+	guard->path = path;
+	guard->macro = macro;
+	guard->next = *head;
+	*head = guard;
+}
+
+/*
+ * Get the token the current file is at. A file read a token at a time has
+ * its next token scanned only once it is needed.
+ */
+static struct token *current(struct cpp *cpp) {
+	if (cpp->lexer->curr == NULL)
+		return lexnext(cpp->lexer);
+	return cpp->lexer->curr;
+}
+
+/*
+ * Read the next token without expanding it, from the tokens pushed back
+ * onto the preprocessor if there are any, otherwise from the current file.
+ * The end-of-file token is returned every time once it is reached.
+ */
+static struct token *getraw(struct cpp *cpp) {
+	struct token *tok;
+
+	if ((tok = cpp->pending) != NULL) {
+		cpp->pending = tok->next;
+		return tok;
+	}
+	tok = current(cpp);
+	if (tok->kind != T_EOF)
+		cpp->lexer->curr = tok->next;
+	return tok;
+}
+
+/*
+ * Look at the next token without reading it.
+ */
+static struct token *peekraw(struct cpp *cpp) {
+	if (cpp->pending != NULL)
+		return cpp->pending;
+	return current(cpp);
+}
+
+/*
+ * Push a token back, so that it is the next one read.
+ */
+static void unget(struct cpp *cpp, struct token *tok) {
+	tok->next = cpp->pending;
+	cpp->pending = tok;
+}
+
+/*
+ * Push a list of tokens back, so that they are the next ones read.
+ */
+static void prepend(struct cpp *cpp, struct token *list) {
+	struct token *tail;
+
+	if (list == NULL)
+		return;
+	for (tail = list; tail->next != NULL; tail = tail->next)
+		;
+	tail->next = cpp->pending;
+	cpp->pending = list;
+}
+
+/*
+ * Read the rest of the current line as a list of tokens.
+ */
+static struct token *readline(struct cpp *cpp) {
+	struct token head, *tail, *tok;
+
+	/*
+	 * Only peek at the token that ends the line; pushing it back would
+	 * put it ahead of the file an #include is about to open.
+	 */
+	tail = &head;
+	for (tok = peekraw(cpp); !tok->bol && tok->kind != T_EOF;
+	    tok = peekraw(cpp))
+		tail = tail->next = getraw(cpp);
+	tail->next = NULL;
+	return head.next;
+}
+
+/*
+ * Detect whether a file is wrapped in an include-guard: nothing but
+ * `#ifndef X`, `#define X`, then a matching `#endif` at the very end. Such a
+ * file adds nothing once X is defined, so later includes of it can be
+ * skipped without reading it.
+ */
+static void detectguard(struct cpp *cpp, struct lexer *lexer) {
+	struct token *tok, *macro, *name;
+	int depth;
+
+	tok = lexer->head;
+	if (tok->kind != T_HASH || !spelled(tok->next, "ifndef")
+	    || tok->next->next->kind != T_NAME)
+		return;
+	macro = tok->next->next;
+	tok = macro->next;
+	if (tok->kind != T_HASH || !tok->bol || !spelled(tok->next, "define")
+	    || tok->next->next->kind != T_NAME
+	    || tokname(tok->next->next) != tokname(macro))
+		return;
+	/*
+	 * Only the name after each `#` is looked at, not taken, since after
+	 * a null directive it is the `#` of the next line or the end.
+	 */
+	for (depth = 1; tok->kind != T_EOF; tok = tok->next) {
+		if (tok->kind != T_HASH || !tok->bol)
+			continue;
+		name = tok->next;
+		if (name->kind == T_EOF || name->bol)
+			continue;
+		if (spelled(name, "if") || spelled(name, "ifdef")
+		    || spelled(name, "ifndef"))
+			depth++;
+		else if (spelled(name, "endif") && --depth == 0)
+			break;
+		else if (depth == 1 && (spelled(name, "else")
+		    || spelled(name, "elif")))
+			return;
+	}
+	if (tok->kind == T_EOF)
+		return;
+	for (tok = tok->next; !tok->bol && tok->kind != T_EOF; tok = tok->next)
+		;
+	if (tok->kind == T_EOF)
+		addguard(cpp, lexer->path, tokname(macro));
+}
+
+/*
+ * Lex a file and make it the current one. The preprocessor takes ownership
+ * of the source.
+ */
+static void pushfile(struct cpp *cpp, char *path, char *source, int length) {
+	struct lexer *lexer;
+
+	if (cpp->basedepth + cpp->depth + 1 >= MAXINCLUDE) {
+		toodeep = true;
+		cppfatal(cpp, "%s: Too many nested includes", path);
+	}
+	if ((lexer = cpp->spare) != NULL)
+		cpp->spare = lexer->next;
+	else
+		lexer = calloc(1, sizeof(struct lexer));
+	/*
+	 * Included files take their tokens from wherever the main file's
+	 * come from.
+	 */
+	lexer->alloc = cpp->main.alloc == &cpp->main.own ? NULL
+	    : cpp->main.alloc;
+	lexreset(lexer, source, length);
+	lexer->path = path;
+	lexer->next = cpp->lexer;
+	cpp->lexer = lexer;
+	cpp->condbase[++cpp->depth] = cpp->ncond;
+	lex(lexer);
+	lexer->curr = lexer->head;
+	detectguard(cpp, lexer);
+	prefetchincludes(cpp, lexer);
+}
+
+/*
+ * Finish the current file and go back to the one that included it. Its
+ * lexer is kept until its tokens are no longer in use: the end of the
+ * translation unit, or when streaming, the next `cpprelease`.
+ */
+static void popfile(struct cpp *cpp) {
+	struct lexer *lexer;
+
+	lexer = cpp->lexer;
+	if (cpp->ncond != cpp->condbase[cpp->depth])
+		fatalf("%s: Unterminated conditional directive", lexer->path);
+	cpp->lexer = lexer->next;
+	lexer->next = cpp->done;
+	cpp->done = lexer;
+	cpp->depth--;
+}
+
+/*
+ * Return true if a source starts with `#ifndef` or `#pragma once`, as a
+ * header meant to be included anywhere does. Only the first few tokens are
+ * lexed.
+ */
+static bool guarded(char *source, int length) {
+	struct lexer lexer;
+	struct token *name;
+	bool result;
+
+	memset(&lexer, 0, sizeof(lexer));
+	lexreset(&lexer, source, length);
+	result = false;
+	if (lexnext(&lexer)->kind == T_HASH) {
+		name = lexnext(&lexer);
+		result = spelled(name, "ifndef") || (spelled(name, "pragma")
+		    && spelled(lexnext(&lexer), "once"));
+	}
+	arenafree(&lexer.arena);
+	return result;
+}
+
+/*
+ * Add a header to those imported from the header-store. The preprocessor
+ * takes over a reference to the header, and gives it up at the start of the
+ * next translation unit.
+ */
+static void addimport(struct cpp *cpp, struct header *header) {
+	if (cpp->nimport == cpp->capimport) {
+		cpp->capimport = cpp->capimport ? cpp->capimport * 2 : 8;
+		cpp->imports = realloc(cpp->imports,
+		    cpp->capimport * sizeof(struct header *));
+	}
+	cpp->imports[cpp->nimport++] = header;
+}
+
+/*
+ * Get what a header would find for one of its dependencies if it were
+ * included where the preprocessor is now. Nothing is recorded.
+ */
+unsigned long cppdep(struct cpp *cpp, int kind, char *name) {
+	switch (kind) {
+	case DEP_MACRO:
+		return macrovalue(*macrolink(cpp, name));
+	case DEP_GUARD:
+		return guardvalue(findguard(cpp, name));
+	default:
+		return (unsigned long)importedtypedef(cpp->imports,
+		    cpp->nimport, name);
+	}
+}
+
+/*
+ * Record, for a header being parsed for the store, what a header it
+ * imports depends on, as found where it is imported. Typedef-names found
+ * in headers the importing header brought in itself are its own.
+ */
+static void inheritdeps(struct cpp *cpp, struct header *header) {
+	struct hdrdep *dep;
+	struct type *type;
+	int i;
+
+	for (i = 0; i < header->deps.ndep; i++) {
+		dep = &header->deps.deps[i];
+		if (dep->own)
+			continue;
+		if (dep->kind == DEP_MACRO)
+			findmacro(cpp, dep->name);
+		else if (dep->kind == DEP_GUARD)
+			lookupguard(cpp, dep->name);
+		else if (importedtypedef(cpp->imports + cpp->ncontext,
+		    cpp->nimport - cpp->ncontext, dep->name) == NULL) {
+			type = importedtypedef(cpp->imports, cpp->ncontext,
+			    dep->name);
+			adddep(cpp->deps, DEP_TYPEDEF, dep->name,
+			    (unsigned long)type);
+		}
+	}
+}
+
+/*
+ * Import a header from the header-store instead of reading its tokens, so
+ * that it is preprocessed and parsed once for every translation unit that
+ * includes it in the same state. The header's changes to the macros are
+ * made here, and a T_IMPORT token tells the parser to import its
+ * declarations. Returns false if the header cannot be parsed on its own,
+ * and should be included in place instead.
+ */
+static bool importshared(struct cpp *cpp, char *path, char *source,
+    int length) {
+	struct header *header;
+	struct macrodef *def;
+	struct macro *macro;
+	struct guard *guard;
+	struct token *tok;
+	jmp_buf env, *prev;
+	char message[MAXERROR];
+	int i;
+
+	prev = catcherrors(&env);
+	if (setjmp(env)) {
+		catcherrors(prev);
+		if (toodeep) {
+			strcpy(message, lasterror());
+			fatalf("%s", message);
+		}
+		return false;
+	}
+	header = loadheader(cpp, path, source, length);
+	catcherrors(prev);
+	if (cpp->deps != NULL)
+		inheritdeps(cpp, header);
+	/*
+	 * If its guard is already defined, the header would expand to
+	 * nothing.
+	 */
+	guard = findguard(header->cpp, header->path);
+	if (guard != NULL && guard->macro != NULL
+	    && findmacro(cpp, guard->macro) != NULL) {
+		releaseheader(header);
+		return true;
+	}
+	for (def = header->cpp->defs; def != NULL; def = def->next) {
+		macro = NULL;
+		if (def->macro != NULL) {
+			macro = arenaalloc(&cpp->arena, sizeof(struct macro));
+			*macro = *def->macro;
+		}
+		setmacro(cpp, def->name, macro);
+	}
+	/*
+	 * The guards of the header, and of everything it included, hold
+	 * here too, so those files are not even read again.
+	 */
+	for (i = 0; i < NGUARDBUCKET; i++) {
+		for (guard = header->cpp->guards[i]; guard != NULL;
+		    guard = guard->next)
+			addguard(cpp, guard->path, guard->macro);
+	}
+	addimport(cpp, header);
+
+	tok = arenaalloc(&cpp->scratch, sizeof(struct token));
+	memset(tok, 0, sizeof(struct token));
+	tok->kind = T_IMPORT;
+	tok->value = (long)header;
+	tok->path = header->path;
+	tok->line = 1;
+	tok->bol = true;
+	prepend(cpp, tok);
+	return true;
+}
+
+/*
+ * Try to include the file at the given path. Returns false if it could not
+ * be read. A guarded file whose guard is already defined is skipped without
+ * being opened.
+ */
+static bool tryinclude(struct cpp *cpp, char *path) {
+	struct guard *guard;
+	char *source;
+	int length;
+
+	path = internstr(path, strlen(path));
+	if ((guard = lookupguard(cpp, path)) != NULL && (guard->macro == NULL
+	    || findmacro(cpp, guard->macro) != NULL))
+		return true;
+	if ((source = readfile(path, &length)) == NULL)
+		return false;
+	if (cpp->shareheaders && guarded(source, length)
+	    && importshared(cpp, path, source, length)) {
+		free(source);
+		return true;
+	}
+	pushfile(cpp, path, source, length);
+	return true;
+}
+
+/*
+ * Expand a list of tokens on its own, returning the expanded copy. The list
+ * itself is left alone, since macro arguments are also used unexpanded.
+ */
+static struct token *expandlist(struct cpp *cpp, struct token *list) {
+	struct token head, *tail, *tok, *end, *saved;
+
+	end = arenaalloc(&cpp->scratch, sizeof(struct token));
+	memset(end, 0, sizeof(struct token));
+	end->kind = T_EOF;
+	tail = &head;
+	for (tok = list; tok != NULL; tok = tok->next) {
+		tail = tail->next = copytoken(&cpp->scratch, tok);
+		tail->bol = false;
+	}
+	tail->next = end;
+
+	saved = cpp->pending;
+	cpp->pending = head.next;
+	tail = &head;
+	while ((tok = getexpanded(cpp)) != end)
+		tail = tail->next = tok;
+	tail->next = NULL;
+	cpp->pending = saved;
+	return head.next;
+}
+
+/*
+ * Make an integer literal token.
+ */
+static struct token *mkint(struct cpp *cpp, struct token *at, long value) {
+	struct token *tok;
+
+	tok = copytoken(&cpp->scratch, at);
+	tok->kind = T_INTLIT;
+	tok->value = value;
+	return tok;
+}
+
+/*
+ * Make a signed value in `#if`.
+ */
+static struct ppval ppsigned(intmax_t value) {
+	struct ppval val;
+
+	val.bits = value;
+	val.isunsigned = false;
+	return val;
+}
+
+/*
+ * Return true if a value in `#if` is not zero.
+ */
+static bool pptrue(struct ppval val) {
+	return val.bits != 0;
+}
+
+/*
+ * Compare two values in `#if` after the usual arithmetic conversions,
+ * returning less than, equal to or greater than 0.
+ */
+static int ppcompare(struct ppval left, struct ppval right) {
+	if (left.isunsigned || right.isunsigned)
+		return (left.bits > right.bits) - (left.bits < right.bits);
+	return ((intmax_t)left.bits > (intmax_t)right.bits)
+	    - ((intmax_t)left.bits < (intmax_t)right.bits);
+}
+
+/*
+ * Apply a binary operator in `#if`. Both operands are converted to
+ * uintmax_t if either is unsigned, and arithmetic wraps around rather than
+ * overflowing. If `skip` is set, the result is not used, as on the right of
+ * a `&&` whose left is 0, so operands that would be errors give 0 instead.
+ */
+static struct ppval apply(struct cpp *cpp, int op, struct ppval left,
+    struct ppval right, bool skip) {
+	struct ppval val;
+	intmax_t l, r;
+
+	val.isunsigned = left.isunsigned || right.isunsigned;
+	l = (intmax_t)left.bits;
+	r = (intmax_t)right.bits;
+	switch (op) {
+	case T_BOR:	val.bits = left.bits | right.bits; return val;
+	case T_BXOR:	val.bits = left.bits ^ right.bits; return val;
+	case T_AMP:	val.bits = left.bits & right.bits; return val;
+	case T_PLUS:	val.bits = left.bits + right.bits; return val;
+	case T_MINUS:	val.bits = left.bits - right.bits; return val;
+	case T_STAR:	val.bits = left.bits * right.bits; return val;
+	case T_EQ:	return ppsigned(ppcompare(left, right) == 0);
+	case T_NE:	return ppsigned(ppcompare(left, right) != 0);
+	case T_LT:	return ppsigned(ppcompare(left, right) < 0);
+	case T_GT:	return ppsigned(ppcompare(left, right) > 0);
+	case T_LE:	return ppsigned(ppcompare(left, right) <= 0);
+	case T_GE:	return ppsigned(ppcompare(left, right) >= 0);
+	case T_BLSHIFT:
+	case T_BRSHIFT:
+		/*
+		 * A shift has the type of its left operand.
+		 */
+		val.isunsigned = left.isunsigned;
+		if ((!right.isunsigned && r < 0)
+		    || right.bits >= sizeof(uintmax_t) * CHAR_BIT) {
+			if (!skip)
+				cppfatal(cpp, "Shift by %jd in #if", r);
+			return ppsigned(0);
+		}
+		if (op == T_BLSHIFT)
+			val.bits = left.bits << right.bits;
+		else if (left.isunsigned)
+			val.bits = left.bits >> right.bits;
+		else
+			val.bits = l >> right.bits;
+		return val;
+	}
+	if (right.bits == 0) {
+		if (!skip)
+			cppfatal(cpp, "Division by zero in #if");
+		return ppsigned(0);
+	}
+	if (val.isunsigned)
+		val.bits = op == T_SLASH ? left.bits / right.bits
+		    : left.bits % right.bits;
+	else if (l == INTMAX_MIN && r == -1)
+		val.bits = op == T_SLASH ? left.bits : 0;
+	else
+		val.bits = op == T_SLASH ? l / r : l % r;
+	return val;
+}
+
+/*
+ * Get the value of a literal in `#if`. An integer literal is unsigned if it
+ * has a `u` suffix, or is too big for intmax_t. Only literals the lexer
+ * made are spelled with a digit first; others here stand for 0 or 1.
+ */
+static struct ppval ppliteral(struct token *tok) {
+	struct ppval val;
+
+	val.bits = (uintmax_t)tok->value;
+	val.isunsigned = tok->kind == T_INTLIT && isdigit(tok->text[0])
+	    && (val.bits > INTMAX_MAX || memchr(tok->text, 'u', tok->length)
+	    || memchr(tok->text, 'U', tok->length));
+	return val;
+}
+
+/*
+ * Evaluate a unary expression in `#if`.
+ */
+static struct ppval evalunary(struct cpp *cpp, struct token **cur,
+    bool skip) {
+	struct token *tok;
+	struct ppval val;
+
+	if ((tok = *cur) == NULL)
+		cppfatal(cpp, "Expected expression in #if");
+	*cur = tok->next;
+	switch (tok->kind) {
+	case T_NOT:
+		return ppsigned(!pptrue(evalunary(cpp, cur, skip)));
+	case T_TILDE:
+		val = evalunary(cpp, cur, skip);
+		val.bits = ~val.bits;
+		return val;
+	case T_MINUS:
+		val = evalunary(cpp, cur, skip);
+		val.bits = -val.bits;
+		return val;
+	case T_PLUS:
+		return evalunary(cpp, cur, skip);
+	case T_LPAREN:
+		val = evalcond(cpp, cur, skip);
+		if (*cur == NULL || (*cur)->kind != T_RPAREN)
+			cppfatal(cpp, "Expected ')' in #if");
+		*cur = (*cur)->next;
+		return val;
+	case T_INTLIT:
+	case T_CHARLIT:
+		return ppliteral(tok);
+	}
+	cppfatal(cpp, "Invalid token \"%.*s\" in #if", tok->length,
+	    tok->text);
+	return ppsigned(0);
+}
+
+/*
+ * Evaluate binary operators in `#if`, from the given precedence level up.
+ * The right of `&&` and `||` is evaluated with `skip` set when the left
+ * already decides the result.
+ */
+static struct ppval evalbinary(struct cpp *cpp, struct token **cur,
+    int level, bool skip) {
+	struct ppval left, right;
+	struct token *tok;
+	int *t;
+
+	if (level >= NCPPLVL)
+		return evalunary(cpp, cur, skip);
+	left = evalbinary(cpp, cur, level + 1, skip);
+	while ((tok = *cur) != NULL) {
+		for (t = &cpplvls[level][0]; *t >= 0 && *t != tok->kind; t++)
+			;
+		if (*t < 0)
+			break;
+		*cur = tok->next;
+		if (tok->kind == T_LAND) {
+			right = evalbinary(cpp, cur, level + 1,
+			    skip || !pptrue(left));
+			left = ppsigned(pptrue(left) && pptrue(right));
+		} else if (tok->kind == T_LOR) {
+			right = evalbinary(cpp, cur, level + 1,
+			    skip || pptrue(left));
+			left = ppsigned(pptrue(left) || pptrue(right));
+		} else {
+			right = evalbinary(cpp, cur, level + 1, skip);
+			left = apply(cpp, tok->kind, left, right, skip);
+		}
+	}
+	return left;
+}
+
+/*
+ * Evaluate a conditional expression in `#if`. Only the branch that is
+ * taken can raise errors, and the result is unsigned if either branch is.
+ */
+static struct ppval evalcond(struct cpp *cpp, struct token **cur,
+    bool skip) {
+	struct ppval cond, truval, falsval, val;
+
+	cond = evalbinary(cpp, cur, 0, skip);
+	if (*cur == NULL || (*cur)->kind != T_QUESTIONMARK)
+		return cond;
+	*cur = (*cur)->next;
+	truval = evalcond(cpp, cur, skip || !pptrue(cond));
+	if (*cur == NULL || (*cur)->kind != T_COLON)
+		cppfatal(cpp, "Expected ':' in #if");
+	*cur = (*cur)->next;
+	falsval = evalcond(cpp, cur, skip || pptrue(cond));
+	val = pptrue(cond) ? truval : falsval;
+	val.isunsigned = truval.isunsigned || falsval.isunsigned;
+	return val;
+}
+
+/*
+ * Evaluate the expression of an `#if` or `#elif`. Uses of `defined` are
+ * replaced before expanding macros, and names still left afterwards are 0.
+ */
+static bool eval(struct cpp *cpp, struct token *line) {
+	struct token head, *tail, *tok, *next;
+	struct ppval val;
+	bool paren;
+	long value;
+
+	tail = &head;
+	for (tok = line; tok != NULL; tok = next) {
+		next = tok->next;
+		if (!spelled(tok, "defined")) {
+			tail = tail->next = tok;
+			continue;
+		}
+		if ((paren = next != NULL && next->kind == T_LPAREN))
+			next = next->next;
+		if (next == NULL || next->kind != T_NAME)
+			cppfatal(cpp, "Expected macro name after 'defined'");
+		value = findmacro(cpp, tokname(next)) != NULL;
+		tail = tail->next = mkint(cpp, tok, value);
+		next = next->next;
+		if (paren) {
+			if (next == NULL || next->kind != T_RPAREN)
+				cppfatal(cpp, "Expected ')' after 'defined'");
+			next = next->next;
+		}
+	}
+	tail->next = NULL;
+
+	line = expandlist(cpp, head.next);
+	for (tok = line; tok != NULL; tok = tok->next) {
+		if (tok->kind == T_NAME) {
+			tok->kind = T_INTLIT;
+			tok->value = 0;
+		}
+	}
+	if (line == NULL)
+		cppfatal(cpp, "Expected expression in #if");
+	val = evalcond(cpp, &line, false);
+	if (line != NULL)
+		cppfatal(cpp, "Extra tokens in #if");
+	return pptrue(val);
+}
+
+/*
+ * Skip tokens up to the `#elif`, `#else` or `#endif` that ends the current
+ * branch of a conditional. That directive is pushed back to be handled as
+ * usual.
+ */
+static void skipcond(struct cpp *cpp) {
+	struct token *tok, *name;
+	int depth;
+
+	depth = 0;
+	for (;;) {
+		tok = getraw(cpp);
+		if (tok->kind == T_EOF)
+			cppfatal(cpp, "Unterminated conditional directive");
+		if (tok->kind != T_HASH || !tok->bol)
+			continue;
+		name = getraw(cpp);
+		if (name->bol || name->kind == T_EOF) {
+			unget(cpp, name);
+			continue;
+		}
+		if (spelled(name, "if") || spelled(name, "ifdef")
+		    || spelled(name, "ifndef"))
+			depth++;
+		else if (depth > 0 && spelled(name, "endif"))
+			depth--;
+		else if (depth == 0 && (spelled(name, "elif")
+		    || spelled(name, "else") || spelled(name, "endif"))) {
+			unget(cpp, name);
+			unget(cpp, tok);
+			return;
+		}
+	}
+}
+
+/*
+ * Open a conditional, skipping its first branch if the condition is false.
+ */
+static void pushcond(struct cpp *cpp, bool taken) {
+	if (cpp->ncond >= MAXCONDDEPTH)
+		cppfatal(cpp, "Conditional directives nested too deeply");
+	cpp->conds[cpp->ncond].taken = taken;
+	cpp->conds[cpp->ncond].seenelse = false;
+	cpp->ncond++;
+	if (!taken)
+		skipcond(cpp);
+}
+
+/*
+ * Get the innermost conditional opened in the current file.
+ */
+static struct cond *topcond(struct cpp *cpp, char *directive) {
+	if (cpp->ncond <= cpp->condbase[cpp->depth])
+		cppfatal(cpp, "#%s without #if", directive);
+	return &cpp->conds[cpp->ncond - 1];
+}
+
+/*
+ * Handle a `#define`.
+ */
+static void define(struct cpp *cpp, struct token *line) {
+	char *params[MAXMACROARG];
+	struct macro *macro;
+	struct token head, *tail, *tok;
+
+	if (line == NULL || line->kind != T_NAME)
+		cppfatal(cpp, "Macro name missing");
+	macro = arenaalloc(&cpp->arena, sizeof(struct macro));
+	memset(macro, 0, sizeof(struct macro));
+	macro->name = tokname(line);
+	tok = line->next;
+	/*
+	 * It is only a function-like macro if the parenthesis comes straight
+	 * after the name.
+	 */
+	if (tok != NULL && tok->kind == T_LPAREN && !tok->space) {
+		macro->funclike = true;
+		for (tok = tok->next; tok != NULL && tok->kind != T_RPAREN;) {
+			if (macro->nparam > 0) {
+				if (tok->kind != T_COMMA)
+					cppfatal(cpp,
+					    "Expected ',' in macro parameters");
+				tok = tok->next;
+			}
+			if (macro->nparam >= MAXMACROARG)
+				cppfatal(cpp, "Too many macro parameters");
+			if (tok != NULL && tok->kind == T_ELLIPSES) {
+				macro->variadic = true;
+				params[macro->nparam++] =
+				    internstr("__VA_ARGS__", 11);
+				tok = tok->next;
+				break;
+			}
+			if (tok == NULL || tok->kind != T_NAME)
+				cppfatal(cpp, "Expected macro parameter name");
+			params[macro->nparam++] = tokname(tok);
+			tok = tok->next;
+		}
+		if (tok == NULL || tok->kind != T_RPAREN)
+			cppfatal(cpp, "Unterminated macro parameter list");
+		tok = tok->next;
+		macro->params = arenaalloc(&cpp->arena,
+		    macro->nparam * sizeof(char *));
+		memcpy(macro->params, params, macro->nparam * sizeof(char *));
+	}
+	if (tok != NULL && tok->kind == T_HASHHASH)
+		cppfatal(cpp, "'##' cannot appear at start of macro body");
+	/*
+	 * The body is copied, so that it outlives the tokens of the file it
+	 * is in, which are released as they are read when streaming.
+	 */
+	tail = &head;
+	for (; tok != NULL; tok = tok->next) {
+		if (tok->kind == T_HASHHASH && tok->next == NULL)
+			cppfatal(cpp,
+			    "'##' cannot appear at end of macro body");
+		tail = tail->next = copytoken(&cpp->arena, tok);
+	}
+	tail->next = NULL;
+	macro->body = head.next;
+	macro->hash = hashmacro(macro);
+	setmacro(cpp, macro->name, macro);
+}
+
+/*
+ * Get the file name an include names. Returns false if the line is neither a
+ * "file" nor a <file> name. If `cpp` is NULL, as when looking ahead, a name
+ * that is too long is not an error, and also gives false.
+ */
+static bool includename(struct cpp *cpp, struct token *line, char *name,
+    bool *quoted) {
+	struct token *tok;
+	int length;
+
+	length = 0;
+	if (line != NULL && line->kind == T_STRLIT && line->length >= 2) {
+		*quoted = true;
+		length = line->length - 2;
+		if (length >= MAXPATH && cpp == NULL)
+			return false;
+		if (length >= MAXPATH)
+			cppfatal(cpp, "Include path too long");
+		memcpy(name, line->text + 1, length);
+	} else if (line != NULL && line->kind == T_LT && !line->bol) {
+		*quoted = false;
+		for (tok = line->next; tok != NULL && tok->kind != T_GT;
+		    tok = tok->next) {
+			if (tok->kind == T_EOF || tok->bol)
+				return false;
+			if (length + tok->length + 1 >= MAXPATH && cpp == NULL)
+				return false;
+			if (length + tok->length + 1 >= MAXPATH)
+				cppfatal(cpp, "Include path too long");
+			if (tok != line->next && tok->space)
+				name[length++] = ' ';
+			memcpy(name + length, tok->text, tok->length);
+			length += tok->length;
+		}
+		if (tok == NULL)
+			return false;
+	} else
+		return false;
+	name[length] = '\0';
+	return true;
+}
+
+/*
+ * Build the nth path an included file may be found at. A "file" name is
+ * looked for next to the including file first, then in the include
+ * directories. Returns false once there are no more paths to try.
+ */
+static bool candidate(struct cpp *cpp, char *from, char *name, bool quoted,
+    int n, char *path) {
+	char *slash;
+
+	if (quoted && name[0] == '/') {
+		if (n > 0)
+			return false;
+		strcpy(path, name);
+		return true;
+	}
+	if (quoted && n-- == 0) {
+		if ((slash = strrchr(from, '/')) == NULL)
+			strcpy(path, name);
+		else
+			snprintf(path, MAXPATH, "%.*s/%s",
+			    (int)(slash - from), from, name);
+		return true;
+	}
+	if (n >= cpp->nincdir)
+		return false;
+	snprintf(path, MAXPATH, "%s/%s", cpp->incdirs[n], name);
+	return true;
+}
+
+/*
+ * Handle an `#include`.
+ */
+static void include(struct cpp *cpp, struct token *line) {
+	char name[MAXPATH], path[MAXPATH];
+	bool quoted;
+	int n;
+
+	if (line != NULL && line->kind == T_NAME)
+		line = expandlist(cpp, line);
+	if (!includename(cpp, line, name, &quoted))
+		cppfatal(cpp, "Expected \"file\" or <file> after #include");
+	for (n = 0; candidate(cpp, cpp->lexer->path, name, quoted, n, path);
+	    n++) {
+		if (tryinclude(cpp, path))
+			return;
+	}
+	cppfatal(cpp, "%s: No such file or directory", name);
+}
+
+/*
+ * Check whether a directive's condition is a plain `0`, which is how code
+ * is commented out.
+ */
+static bool iszero(struct token *tok) {
+	return tok->kind == T_INTLIT && tok->value == 0
+	    && (tok->next->bol || tok->next->kind == T_EOF);
+}
+
+/*
+ * Start reading the files a newly lexed file includes, so they are already
+ * in memory by the time their #include is reached. Each file is queued with
+ * the paths it may be at, and the reader thread finds which one it is, so
+ * nothing here waits on the file-system. Paths from one already known to
+ * be guarded on are left out. Conditions are not evaluated, since macros
+ * are not yet defined, but groups under `#if 0` are skipped. This is only
+ * a guess at what will be included, so it never raises an error.
+ */
+static void prefetchincludes(struct cpp *cpp, struct lexer *lexer) {
+	char name[MAXPATH], path[MAXPATH], *paths[MAXCANDIDATE];
+	struct token *tok, *dir;
+	bool quoted;
+	int n, npath, skip;
+
+	skip = 0;
+	for (tok = lexer->head; tok->kind != T_EOF; tok = tok->next) {
+		if (tok->kind != T_HASH || !tok->bol || tok->next->bol)
+			continue;
+		dir = tok->next;
+		if (spelled(dir, "if") || spelled(dir, "ifdef")
+		    || spelled(dir, "ifndef")) {
+			if (skip > 0
+			    || (spelled(dir, "if") && iszero(dir->next)))
+				skip++;
+		} else if (spelled(dir, "elif") && skip == 1)
+			skip = iszero(dir->next);
+		else if (spelled(dir, "else") && skip == 1)
+			skip = 0;
+		else if (spelled(dir, "endif") && skip > 0)
+			skip--;
+		if (skip > 0 || !spelled(dir, "include")
+		    || !includename(NULL, dir->next, name, &quoted))
+			continue;
+		for (n = npath = 0; npath < MAXCANDIDATE && candidate(cpp,
+		    lexer->path, name, quoted, n, path); n++) {
+			paths[npath] = internstr(path, strlen(path));
+			if (findguard(cpp, paths[npath]) != NULL)
+				break;
+			npath++;
+		}
+		prefetch(paths, npath, cpp->unit);
+	}
+}
+
+/*
+ * Handle a preprocessing directive. The `#` has already been read.
+ */
+static void directive(struct cpp *cpp) {
+	struct token *name, *line;
+	struct cond *cond;
+
+	name = peekraw(cpp);
+	if (name->bol || name->kind == T_EOF)
+		return;
+	name = getraw(cpp);
+	cpp->where = name;
+	line = readline(cpp);
+	if (spelled(name, "define"))
+		define(cpp, line);
+	else if (spelled(name, "undef")) {
+		if (line == NULL || line->kind != T_NAME)
+			cppfatal(cpp, "Macro name missing");
+		setmacro(cpp, tokname(line), NULL);
+	} else if (spelled(name, "include"))
+		include(cpp, line);
+	else if (spelled(name, "if"))
+		pushcond(cpp, eval(cpp, line));
+	else if (spelled(name, "ifdef") || spelled(name, "ifndef")) {
+		if (line == NULL || line->kind != T_NAME)
+			cppfatal(cpp, "Macro name missing");
+		pushcond(cpp, (findmacro(cpp, tokname(line)) != NULL)
+		    == spelled(name, "ifdef"));
+	} else if (spelled(name, "elif")) {
+		cond = topcond(cpp, "elif");
+		if (cond->seenelse)
+			cppfatal(cpp, "#elif after #else");
+		if (cond->taken || !eval(cpp, line))
+			skipcond(cpp);
+		else
+			cond->taken = true;
+	} else if (spelled(name, "else")) {
+		cond = topcond(cpp, "else");
+		if (cond->seenelse)
+			cppfatal(cpp, "#else after #else");
+		cond->seenelse = true;
+		if (cond->taken)
+			skipcond(cpp);
+		else
+			cond->taken = true;
+	} else if (spelled(name, "endif")) {
+		topcond(cpp, "endif");
+		cpp->ncond--;
+	} else if (spelled(name, "pragma")) {
+		if (spelled(line, "once"))
+			addguard(cpp, cpp->lexer->path, NULL);
+	} else if (spelled(name, "error"))
+		cppfatal(cpp, "#error %s",
+		    line ? stringize(cpp, line, line)->text : "");
+	else if (!spelled(name, "line") && !spelled(name, "warning")
+	    && name->kind != T_INTLIT)
+		cppfatal(cpp, "Invalid directive #%.*s", name->length,
+		    name->text);
+}
+
+/*
+ * Find the index of the macro parameter a token names, or -1 if it does not
+ * name one.
+ */
+static int findparam(struct macro *macro, struct token *tok) {
+	int i;
+
+	if (tok == NULL || tok->kind != T_NAME)
+		return -1;
+	for (i = 0; i < macro->nparam; i++) {
+		if (macro->params[i] == tokname(tok))
+			return i;
+	}
+	return -1;
+}
+
+/*
+ * Make a string literal out of a macro argument, for the `#` operator.
+ */
+static struct token *stringize(struct cpp *cpp, struct token *arg,
+    struct token *at) {
+	struct token *tok, *str;
+	char *buffer, *p, ch;
+	int length, i;
+
+	length = 3;
+	for (tok = arg; tok != NULL; tok = tok->next)
+		length += tok->length * 2 + 1;
+	p = buffer = arenaalloc(&cpp->scratch, length);
+	*p++ = '"';
+	for (tok = arg; tok != NULL; tok = tok->next) {
+		if (tok != arg && tok->space)
+			*p++ = ' ';
+		for (i = 0; i < tok->length; i++) {
+			ch = tok->text[i];
+			if ((tok->kind == T_STRLIT || tok->kind == T_CHARLIT)
+			    && (ch == '"' || ch == '\\'))
+				*p++ = '\\';
+			*p++ = ch;
+		}
+	}
+	*p++ = '"';
+	*p = '\0';
+	str = copytoken(&cpp->scratch, at);
+	str->kind = T_STRLIT;
+	str->text = buffer;
+	str->length = p - buffer;
+	str->value = (long)internstr(buffer + 1, str->length - 2);
+	return str;
+}
+
+/*
+ * Paste two tokens together, for the `##` operator. This is the only time
+ * the preprocessor lexes text, and only the pasted spelling is lexed.
+ */
+static struct token *paste(struct cpp *cpp, struct token *left,
+    struct token *right) {
+	struct token *tok;
+	char *buffer;
+	int length;
+
+	length = left->length + right->length;
+	buffer = arenaalloc(&cpp->scratch, length + 1);
+	memcpy(buffer, left->text, left->length);
+	memcpy(buffer + left->length, right->text, right->length);
+	buffer[length] = '\0';
+	lexreset(&cpp->paster, buffer, length);
+	lex(&cpp->paster);
+	tok = cpp->paster.head;
+	if (tok->kind == T_EOF || tok->next->kind != T_EOF)
+		cppfatal(cpp,
+		    "Pasting \"%.*s\" and \"%.*s\" does not give a token",
+		    left->length, left->text, right->length, right->text);
+	tok = copytoken(&cpp->scratch, tok);
+	tok->bol = false;
+	tok->space = left->space;
+	tok->hideset = left->hideset;
+	return tok;
+}
+
+/*
+ * Append copies of up to `count` tokens of a list, or all of them if count
+ * is negative.
+ */
+static struct token *append(struct cpp *cpp, struct token *tail,
+    struct token *list, int count) {
+	for (; list != NULL && count != 0; list = list->next, count--)
+		tail = tail->next = copytoken(&cpp->scratch, list);
+	return tail;
+}
+
+/*
+ * Substitute the arguments of a macro into a copy of its body. Arguments
+ * are fully expanded first, unless they are operands of `#` or `##`.
+ */
+static struct token *subst(struct cpp *cpp, struct macro *macro,
+    struct token **args, struct hideset *hs) {
+	struct token *expanded[MAXMACROARG], head, *tail, *tok, *arg, *pasted;
+	bool isexpanded[MAXMACROARG], empty;
+	int i, count;
+
+	memset(isexpanded, 0, sizeof(isexpanded));
+	tail = &head;
+	empty = false;
+	for (tok = macro->body; tok != NULL; tok = tok->next) {
+		if (tok->kind == T_HASH && macro->funclike
+		    && (i = findparam(macro, tok->next)) >= 0) {
+			tail = tail->next = stringize(cpp, args[i], tok);
+			tok = tok->next;
+			empty = false;
+			continue;
+		}
+		if (tok->kind == T_HASHHASH) {
+			tok = tok->next;
+			if ((i = findparam(macro, tok)) >= 0) {
+				arg = args[i];
+				count = -1;
+			} else {
+				arg = tok;
+				count = 1;
+			}
+			if (arg == NULL)
+				continue;
+			/*
+			 * If the left operand was an empty argument, there
+			 * is nothing to paste onto.
+			 */
+			if (empty || tail == &head) {
+				tail = append(cpp, tail, arg, count);
+				empty = false;
+				continue;
+			}
+			pasted = paste(cpp, tail, arg);
+			*tail = *pasted;
+			tail->next = NULL;
+			tail = append(cpp, tail, arg->next, count - 1);
+			continue;
+		}
+		if ((i = findparam(macro, tok)) >= 0) {
+			if (tok->next != NULL && tok->next->kind == T_HASHHASH)
+				arg = args[i];
+			else {
+				if (!isexpanded[i]) {
+					expanded[i] = expandlist(cpp, args[i]);
+					isexpanded[i] = true;
+				}
+				arg = expanded[i];
+			}
+			tail = append(cpp, tail, arg, -1);
+			empty = arg == NULL;
+			continue;
+		}
+		tail = append(cpp, tail, tok, 1);
+		empty = false;
+	}
+	tail->next = NULL;
+	for (tok = head.next; tok != NULL; tok = tok->next) {
+		tok->hideset = hsunion(cpp, tok->hideset, hs);
+		tok->bol = false;
+	}
+	return head.next;
+}
+
+/*
+ * Read the arguments of a function-like macro call. The `(` has already
+ * been read. Returns the closing `)`.
+ */
+static struct token *readargs(struct cpp *cpp, struct macro *macro,
+    struct token **args) {
+	struct token head, *tail, *tok;
+	int depth, nargs;
+
+	tail = &head;
+	depth = nargs = 0;
+	for (;;) {
+		tok = getraw(cpp);
+		if (tok->kind == T_EOF)
+			cppfatal(cpp, "Unterminated call to macro %s",
+			    macro->name);
+		/*
+		 * Commas split arguments, except inside parentheses or once
+		 * the variadic arguments have been reached.
+		 */
+		if (depth == 0 && (tok->kind == T_RPAREN
+		    || (tok->kind == T_COMMA && !(macro->variadic
+		    && nargs == macro->nparam - 1)))) {
+			if (nargs >= MAXMACROARG)
+				cppfatal(cpp, "Too many arguments to macro %s",
+				    macro->name);
+			tail->next = NULL;
+			args[nargs++] = head.next;
+			tail = &head;
+			if (tok->kind == T_RPAREN)
+				break;
+			continue;
+		}
+		if (tok->kind == T_LPAREN)
+			depth++;
+		else if (tok->kind == T_RPAREN)
+			depth--;
+		tail = tail->next = tok;
+	}
+	if (macro->nparam == 0 && nargs == 1 && args[0] == NULL)
+		nargs = 0;
+	if (macro->variadic && nargs == macro->nparam - 1)
+		args[nargs++] = NULL;
+	if (nargs != macro->nparam)
+		cppfatal(cpp, "Macro %s takes %d arguments, but %d were given",
+		    macro->name, macro->nparam, nargs);
+	return tok;
+}
+
+/*
+ * Expand a name if it is a macro, pushing the result back to be read
+ * again. Returns false if the name is not expanded.
+ */
+static bool expand(struct cpp *cpp, struct token *tok) {
+	struct token *args[MAXMACROARG], *lparen, *rparen;
+	struct macro *macro;
+	struct hideset *hs;
+	char *name;
+
+	name = tokname(tok);
+	if (inhideset(tok->hideset, name)
+	    || (macro = findmacro(cpp, name)) == NULL)
+		return false;
+	if (!macro->funclike) {
+		hs = hsadd(cpp, tok->hideset, name);
+		prepend(cpp, subst(cpp, macro, NULL, hs));
+		return true;
+	}
+	lparen = getraw(cpp);
+	if (lparen->kind != T_LPAREN) {
+		unget(cpp, lparen);
+		return false;
+	}
+	cpp->where = tok;
+	rparen = readargs(cpp, macro, args);
+	hs = hsadd(cpp, hsintersect(cpp, tok->hideset, rparen->hideset), name);
+	prepend(cpp, subst(cpp, macro, args, hs));
+	return true;
+}
+
+/*
+ * Get the next fully-preprocessed token.
+ */
+static struct token *getexpanded(struct cpp *cpp) {
+	struct token *tok;
+
+	for (;;) {
+		tok = getraw(cpp);
+		if (tok->kind == T_EOF && tok == cpp->lexer->curr
+		    && cpp->lexer->next != NULL) {
+			popfile(cpp);
+			continue;
+		}
+		if (tok->kind == T_HASH && tok->bol) {
+			directive(cpp);
+			continue;
+		}
+		if (tok->kind == T_NAME && expand(cpp, tok))
+			continue;
+		return tok;
+	}
+}
+
+/*
+ * Add a directory to search for included files.
+ */
+void cppincdir(struct cpp *cpp, char *dir) {
+	if (cpp->nincdir >= MAXINCDIR)
+		fatalf("Too many include directories");
+	cpp->incdirs[cpp->nincdir++] = dir;
+}
+
+/*
+ * Release everything from the last translation unit and make the given
+ * source the main file. Macros, guards and expanded tokens are released,
+ * and the lexers of included files are kept to be reused.
+ */
+static void start(struct cpp *cpp, char *path, char *source, int length) {
+	struct lexer *lexer;
+	int i;
+
+	/*
+	 * Files still open after an error are treated as finished.
+	 */
+	while (cpp->lexer != NULL && cpp->lexer != &cpp->main) {
+		lexer = cpp->lexer;
+		cpp->lexer = lexer->next;
+		lexer->next = cpp->done;
+		cpp->done = lexer;
+	}
+	while ((lexer = cpp->done) != NULL) {
+		cpp->done = lexer->next;
+		lexrelease(lexer);
+		free(lexer->source);
+		lexer->next = cpp->spare;
+		cpp->spare = lexer;
+	}
+	arenareset(&cpp->arena);
+	arenareset(&cpp->scratch);
+	/*
+	 * The table shrinks back, so one big file does not leave every
+	 * later one clearing a big table.
+	 */
+	free(cpp->macros);
+	cpp->nmacrobucket = NMACROBUCKET;
+	cpp->macros = calloc(cpp->nmacrobucket, sizeof(struct macro *));
+	cpp->nmacro = 0;
+	memset(cpp->guards, 0, sizeof(cpp->guards));
+	cpp->where = NULL;
+	for (i = 0; i < cpp->nimport; i++)
+		releaseheader(cpp->imports[i]);
+	cpp->nimport = 0;
+	cpp->ncontext = 0;
+	cpp->deps = NULL;
+	cpp->defs = NULL;
+	cpp->deftail = NULL;
+	cpp->pending = NULL;
+	cpp->ncond = 0;
+	cpp->depth = 0;
+	cpp->basedepth = 0;
+	toodeep = false;
+	cpp->condbase[0] = 0;
+
+	lexreset(&cpp->main, source, length);
+	cpp->main.path = internstr(path, strlen(path));
+	cpp->main.next = NULL;
+	cpp->lexer = &cpp->main;
+}
+
+/*
+ * Lex the whole of the main file, and start reading what it includes.
+ */
+static void lexmain(struct cpp *cpp) {
+	cpp->streaming = false;
+	lex(&cpp->main);
+	cpp->main.curr = cpp->main.head;
+	prefetchincludes(cpp, &cpp->main);
+}
+
+/*
+ * Prepare a preprocessor for a new translation unit and lex its main file.
+ */
+void cppreset(struct cpp *cpp, char *path, char *source, int length) {
+	start(cpp, path, source, length);
+	cpp->unit = cpp;
+	lexmain(cpp);
+}
+
+/*
+ * Prepare a preprocessor to preprocess a header for the header-store, as if
+ * it were included where `from` is now: it starts out with the same macros,
+ * include directories, guards and imports, and its includes count towards
+ * the same limit on nesting. Changes the header makes to the macros are
+ * recorded in `defs`, and its guard, if it has one, is found.
+ */
+void cppheader(struct cpp *cpp, struct cpp *from, char *path, char *source,
+    int length) {
+	struct macro *macro, *copy;
+	struct guard *guard;
+	int i;
+
+	if (from->basedepth + from->depth + 1 >= MAXINCLUDE) {
+		toodeep = true;
+		cppfatal(from, "%s: Too many nested includes", path);
+	}
+	memcpy(cpp->incdirs, from->incdirs, sizeof(cpp->incdirs));
+	cpp->nincdir = from->nincdir;
+	cpp->shareheaders = from->shareheaders;
+	start(cpp, path, source, length);
+	cpp->unit = from->unit;
+	cpp->basedepth = from->basedepth + from->depth + 1;
+	lexmain(cpp);
+	detectguard(cpp, &cpp->main);
+	for (i = 0; i < from->nmacrobucket; i++) {
+		for (macro = from->macros[i]; macro != NULL;
+		    macro = macro->next) {
+			copy = arenaalloc(&cpp->arena, sizeof(struct macro));
+			*copy = *macro;
+			setmacro(cpp, copy->name, copy);
+		}
+	}
+	for (i = 0; i < from->nimport; i++) {
+		retainheader(from->imports[i]);
+		addimport(cpp, from->imports[i]);
+	}
+	cpp->ncontext = cpp->nimport;
+	for (i = 0; i < NGUARDBUCKET; i++) {
+		for (guard = from->guards[i]; guard != NULL;
+		    guard = guard->next)
+			addguard(cpp, guard->path, guard->macro);
+	}
+	cpp->deftail = &cpp->defs;
+}
+
+/*
+ * Prepare a preprocessor to stream a new translation unit. The main file is
+ * lexed a token at a time as it is read, and `cpprelease` can free the
+ * tokens read so far, so memory does not grow with the size of the file.
+ */
+void cppstream(struct cpp *cpp, char *path, char *source, int length) {
+	start(cpp, path, source, length);
+	cpp->unit = cpp;
+	cpp->streaming = true;
+	cpp->main.curr = NULL;
+}
+
+/*
+ * Get the next fully-preprocessed token of the translation unit. Names are
+ * only turned into keywords here, once nothing can expand them.
+ */
+struct token *cppnext(struct cpp *cpp) {
+	struct token *tok;
+
+	tok = getexpanded(cpp);
+	if (tok->kind == T_NAME)
+		tok->kind = keyword(tokname(tok));
+	if (tok->kind == T_EOF && cpp->ncond > 0)
+		fatalf("%s: Unterminated conditional directive",
+		    cpp->main.path);
+	return tok;
+}
+
+/*
+ * Free the tokens read so far when streaming. Tokens read earlier may still
+ * be in use while a macro expansion is being read, so nothing is freed
+ * then; the caller just tries again later. The main file's tokens are
+ * freed even while a file it includes is being read, since it has been
+ * read up to the #include. Included files are lexed whole, so the tokens
+ * of one are freed once it is finished, along with the memory of its
+ * lexer. Its source is kept until the next translation unit, since the
+ * bodies of macros it defined are spelled from it.
+ */
+void cpprelease(struct cpp *cpp) {
+	struct lexer *lexer;
+
+	if (!cpp->streaming || cpp->pending != NULL)
+		return;
+	/*
+	 * Files finish in the order they are added to `done`, so the ones
+	 * finished since the last release are those up to the first whose
+	 * tokens are already gone.
+	 */
+	for (lexer = cpp->done; lexer != NULL && lexer->head != NULL;
+	    lexer = lexer->next)
+		lexfree(lexer);
+	lexreleaseread(&cpp->main);
+	arenareset(&cpp->scratch);
+}
+
+/*
+ * Free a list of lexers of included files up to `stop`, along with their
+ * sources if they still hold them.
+ */
+static void freelexers(struct lexer *lexer, struct lexer *stop,
+    bool sources) {
+	struct lexer *next;
+
+	for (; lexer != NULL && lexer != stop; lexer = next) {
+		next = lexer->next;
+		lexfree(lexer);
+		if (sources)
+			free(lexer->source);
+		free(lexer);
+	}
+}
+
+/*
+ * Finish a translation unit. Files read ahead for it that it never used
+ * are dropped, so that whoever reads them next reads them afresh.
+ */
+void cppdone(struct cpp *cpp) {
+	dropprefetches(cpp->unit);
+}
+
+/*
+ * Forget the tokens of the last translation unit without handing them
+ * back, once the allocator the main file's tokens came from has been
+ * reset. The lexers of included files took theirs from it too.
+ */
+void cppforget(struct cpp *cpp) {
+	struct lexer *lexer;
+
+	for (lexer = cpp->lexer; lexer != NULL; lexer = lexer->next)
+		lexforget(lexer);
+	for (lexer = cpp->done; lexer != NULL; lexer = lexer->next)
+		lexforget(lexer);
+	for (lexer = cpp->spare; lexer != NULL; lexer = lexer->next)
+		lexforget(lexer);
+	cpp->pending = NULL;
+}
+
+/*
+ * Free everything a preprocessor holds, giving up its imports. The main
+ * file's source belongs to whoever gave it, and is not freed.
+ */
+void cppfree(struct cpp *cpp) {
+	int i;
+
+	dropprefetches(cpp);
+	for (i = 0; i < cpp->nimport; i++)
+		releaseheader(cpp->imports[i]);
+	free(cpp->imports);
+	freelexers(cpp->lexer, &cpp->main, true);
+	freelexers(cpp->done, NULL, true);
+	freelexers(cpp->spare, NULL, false);
+	lexfree(&cpp->main);
+	lexfree(&cpp->paster);
+	arenafree(&cpp->arena);
+	arenafree(&cpp->scratch);
+	free(cpp->macros);
+	memset(cpp, 0, sizeof(struct cpp));
+}
+
+/*
+ * Preprocess the whole translation unit, returning its token-stream.
+ */
+struct token *preprocess(struct cpp *cpp) {
+	struct token head, *tail, *tok;
+
+	tail = &head;
+	do {
+		tok = cppnext(cpp);
+		tail = tail->next = tok;
+	} while (tok->kind != T_EOF);
+	tail->next = NULL;
+	return head.next;
+}
@@ -0,0 +1,131 @@
+#ifndef _CPP_H_
+#define _CPP_H_
+
+/*
+ * How many buckets the macro table starts with, and the guard table has.
+ * Must be powers of two. The macro table doubles once it holds as many
+ * macros as it has buckets.
+ */
+#define NMACROBUCKET	256
+#define NGUARDBUCKET	64
+
+/*
+ * Limits on nesting and macro arguments.
+ */
+#define MAXCONDDEPTH	64
+#define MAXINCLUDE	200
+#define MAXINCDIR	32
+#define MAXMACROARG	127
+#define MAXPATH		4096
+
+/*
+ * Set of macro names a token came out of. A token is never expanded by a
+ * macro in its hide-set, which is what stops recursive macros from looping.
+ * Sets are persistent hash tries: each node holds one name, and a name is
+ * placed by successive pairs of bits of a hash of its address. Adding a
+ * name copies only the nodes on its path, and sets share all the rest, so
+ * both adding and testing take time logarithmic in the size of the set.
+ */
+struct hideset {
+	char *name;		/* interned macro name */
+	struct hideset *kids[4];/* subtries by the next two bits of hash */
+	int count;		/* names in this subtrie */
+};
+
+/*
+ * A macro definition. The body is kept as tokens, so expanding a macro only
+ * copies tokens and never goes back to the text.
+ */
+struct macro {
+	char *name;		/* interned name */
+	int funclike;		/* takes arguments */
+	char **params;		/* interned parameter names */
+	int nparam;		/* number of parameters */
+	int variadic;		/* last parameter is __VA_ARGS__ */
+	struct token *body;	/* replacement list */
+	unsigned long hash;	/* hash of whole definition */
+	struct macro *next;	/* next macro in bucket */
+};
+
+/*
+ * A change made to the macros while preprocessing a shared header, to be
+ * made again by each file that imports the header.
+ */
+struct macrodef {
+	char *name;		/* interned name */
+	struct macro *macro;	/* definition, NULL if undefined */
+	struct macrodef *next;	/* next change */
+};
+
+/*
+ * A file that does not need to be read again: either it had `#pragma once`,
+ * or all of it is inside `#ifndef X` ... `#endif` and X is now defined.
+ */
+struct guard {
+	char *path;		/* interned path of file */
+	char *macro;		/* guard macro, NULL for #pragma once */
+	struct guard *next;	/* next guard in bucket */
+};
+
+/*
+ * An open conditional directive.
+ */
+struct cond {
+	int taken;		/* some branch has been taken */
+	int seenelse;		/* #else has been seen */
+};
+
+/*
+ * One allocated per preprocessor. Sits between the lexer and the parser,
+ * reading tokens from a stack of lexers, one for each open file.
+ */
+struct cpp {
+	struct lexer main;	/* lexer of main file */
+	struct lexer *lexer;	/* lexer of current file */
+	struct lexer *done;	/* lexers of finished files */
+	struct lexer *spare;	/* lexers free for reuse */
+	int depth;		/* include depth */
+	int basedepth;		/* depth the main file was included at */
+	int condbase[MAXINCLUDE];/* open conditionals when file was entered */
+	struct token *pending;	/* tokens to read before the lexer's */
+	struct token *where;	/* directive or macro call being handled */
+	struct macro **macros;	/* table of macros defined */
+	int nmacrobucket;	/* number of buckets in macros */
+	int nmacro;		/* number of macros defined */
+	struct guard *guards[NGUARDBUCKET];
+	struct cond conds[MAXCONDDEPTH];
+	int ncond;		/* number of open conditionals */
+	char *incdirs[MAXINCDIR];/* directories searched for includes */
+	int nincdir;		/* number of include directories */
+	struct lexer paster;	/* lexes tokens made by ## */
+	struct arena arena;	/* macros and guards */
+	struct arena scratch;	/* tokens made by expanding macros */
+	int streaming;		/* main file is read a token at a time */
+	int shareheaders;	/* import guarded headers from the store */
+	struct header **imports;/* headers imported from the store */
+	int nimport;		/* number of imports */
+	int capimport;		/* capacity of imports */
+	int ncontext;		/* imports that came from the includer */
+	struct depset *deps;	/* what a header looks up, if recording */
+	struct cpp *unit;	/* preprocessor of translation unit */
+	struct macrodef *defs;	/* changes to macros, if being recorded */
+	struct macrodef **deftail;/* where the next change goes */
+};
+
+struct header;
+struct depset;
+
+void cppreset(struct cpp *cpp, char *path, char *source, int length);
+void cppstream(struct cpp *cpp, char *path, char *source, int length);
+struct token *cppnext(struct cpp *cpp);
+void cpprelease(struct cpp *cpp);
+void cppdone(struct cpp *cpp);
+void cppforget(struct cpp *cpp);
+void cppfree(struct cpp *cpp);
+void cppincdir(struct cpp *cpp, char *dir);
+void cppheader(struct cpp *cpp, struct cpp *from, char *path, char *source,
+    int length);
+unsigned long cppdep(struct cpp *cpp, int kind, char *name);
+struct token *preprocess(struct cpp *cpp);
+
+#endif /* !_CPP_H_ */
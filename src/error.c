@@ -0,0 +1,123 @@
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "error.h"
+
+/*
+ * Where to jump to on a fatal error, or NULL to exit. Kept per-thread so
+ * that parsers on different threads do not catch each other's errors.
+ */
+static _Thread_local jmp_buf *errjmp;
+static _Thread_local char errmsg[MAXERROR];
+
+/*
+ * Where to record errors that can be recovered from, or NULL if they are
+ * fatal.
+ */
+static _Thread_local struct diagbuf *diags;
+
+/*
+ * Report a fatal error. If errors are being caught, the message is kept and
+ * control returns to the catcher. Otherwise it is printed and we exit.
+ */
+void fatalf(char *fmt, ...) {
+	va_list args;
+
+	va_start(args, fmt);
+	vsnprintf(errmsg, sizeof(errmsg), fmt, args);
+	va_end(args);
+	if (errjmp != NULL)
+		longjmp(*errjmp, 1);
+	fprintf(stderr, "%s\n", errmsg);
+	exit(1);
+}
+
+/*
+ * Catch fatal errors by jumping to the given environment rather than
+ * exiting. Pass NULL to stop catching them. Returns the environment that
+ * was catching them before, so catchers can be nested.
+ */
+jmp_buf *catcherrors(jmp_buf *env) {
+	jmp_buf *prev;
+
+	prev = errjmp;
+	errjmp = env;
+	return prev;
+}
+
+/*
+ * Get the message of the last fatal error.
+ */
+char *lasterror(void) {
+	return errmsg;
+}
+
+/*
+ * Report an error that the caller can recover from. If errors are being
+ * collected, it is recorded and this returns; otherwise it is fatal.
+ */
+void verrorf(char *fmt, va_list args) {
+	char message[MAXERROR];
+	struct diag *diag;
+
+	if (diags == NULL) {
+		vsnprintf(message, sizeof(message), fmt, args);
+		fatalf("%s", message);
+	}
+	diag = malloc(sizeof(struct diag));
+	vsnprintf(diag->message, sizeof(diag->message), fmt, args);
+	diag->next = NULL;
+	if (diags->tail != NULL)
+		diags->tail->next = diag;
+	else
+		diags->head = diag;
+	diags->tail = diag;
+	diags->count++;
+}
+
+void errorf(char *fmt, ...) {
+	va_list args;
+
+	va_start(args, fmt);
+	verrorf(fmt, args);
+	va_end(args);
+}
+
+/*
+ * Collect recoverable errors into the given buffer rather than stopping at
+ * the first one. Pass NULL to make them fatal again. Returns the buffer
+ * that was collecting them before.
+ */
+struct diagbuf *collecterrors(struct diagbuf *buf) {
+	struct diagbuf *prev;
+
+	prev = diags;
+	diags = buf;
+	return prev;
+}
+
+/*
+ * Empty a buffer of diagnostics.
+ */
+void clearerrors(struct diagbuf *buf) {
+	struct diag *diag, *next;
+
+	for (diag = buf->head; diag != NULL; diag = next) {
+		next = diag->next;
+		free(diag);
+	}
+	buf->head = buf->tail = NULL;
+	buf->count = 0;
+}
+
+/*
+ * Print every diagnostic in a buffer and empty it.
+ */
+void flusherrors(struct diagbuf *buf, FILE *out) {
+	struct diag *diag;
+
+	for (diag = buf->head; diag != NULL; diag = diag->next)
+		fprintf(out, "%s\n", diag->message);
+	clearerrors(buf);
+}
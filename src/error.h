@@ -0,0 +1,40 @@
+#ifndef _ERROR_H_
+#define _ERROR_H_
+
+#include <setjmp.h>
+#include <stdarg.h>
+#include <stdio.h>
+
+/*
+ * Longest error message that is kept.
+ */
+#define MAXERROR	256
+
+/*
+ * A recorded diagnostic.
+ */
+struct diag {
+	char message[MAXERROR];	/* text of diagnostic */
+	struct diag *next;	/* next diagnostic */
+};
+
+/*
+ * Diagnostics collected while recovering from errors, in the order they
+ * were found.
+ */
+struct diagbuf {
+	struct diag *head;	/* first diagnostic */
+	struct diag *tail;	/* last diagnostic */
+	int count;		/* number of diagnostics */
+};
+
+void fatalf(char *fmt, ...);
+void errorf(char *fmt, ...);
+void verrorf(char *fmt, va_list args);
+struct diagbuf *collecterrors(struct diagbuf *buf);
+void clearerrors(struct diagbuf *buf);
+void flusherrors(struct diagbuf *buf, FILE *out);
+jmp_buf *catcherrors(jmp_buf *env);
+char *lasterror(void);
+
+#endif /* !_ERROR_H_ */
@@ -0,0 +1,402 @@
+#include <setjmp.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "token.h"
+#include "arena.h"
+#include "alloc.h"
+#include "intern.h"
+#include "error.h"
+#include "lex.h"
+#include "cpp.h"
+#include "parse.h"
+#include "header.h"
+
+/*
+ * Store of the headers parsed so far, shared by all parsers, with a list of
+ * them from the most to the least recently used. The lock only guards the
+ * table, the list, the headers' reference counts and what each thread is
+ * waiting for; headers are parsed outside of it, and anyone who wants a
+ * header that is still being parsed waits on `hdrdone`.
+ */
+static struct header *hdrtab[NHDRBUCKET];
+static struct header *newest, *oldest;
+static int nheader;
+static pthread_mutex_t hdrlock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t hdrdone = PTHREAD_COND_INITIALIZER;
+static _Thread_local struct loading loading;
+
+/*
+ * Get the slot of a dependency in a set's table: either the one holding it,
+ * or the free one it would go in.
+ */
+static int *depslot(struct depset *set, int kind, char *name) {
+	struct hdrdep *dep;
+	int i;
+
+	i = ((unsigned long)name >> 4 ^ kind) & (set->nslot - 1);
+	while (set->slots[i] >= 0) {
+		dep = &set->deps[set->slots[i]];
+		if (dep->name == name && dep->kind == kind)
+			break;
+		i = (i + 1) & (set->nslot - 1);
+	}
+	return &set->slots[i];
+}
+
+/*
+ * Add something to a set of dependencies, unless it is there already. The
+ * table is kept at most half full.
+ */
+static void insertdep(struct depset *set, int kind, int own, char *name,
+    unsigned long value) {
+	struct hdrdep *dep;
+	int i, *slot;
+
+	if (set->ndep * 2 >= set->nslot) {
+		free(set->slots);
+		set->nslot = set->nslot ? set->nslot * 2 : 64;
+		set->slots = malloc(set->nslot * sizeof(int));
+		memset(set->slots, -1, set->nslot * sizeof(int));
+		for (i = 0; i < set->ndep; i++) {
+			dep = &set->deps[i];
+			*depslot(set, dep->kind, dep->name) = i;
+		}
+	}
+	if (*(slot = depslot(set, kind, name)) >= 0)
+		return;
+	if (set->ndep == set->capdep) {
+		set->capdep = set->capdep ? set->capdep * 2 : 64;
+		set->deps = realloc(set->deps,
+		    set->capdep * sizeof(struct hdrdep));
+	}
+	*slot = set->ndep;
+	dep = &set->deps[set->ndep++];
+	dep->kind = kind;
+	dep->own = own;
+	dep->name = name;
+	dep->value = value;
+}
+
+/*
+ * Record that parsing a header looked something up and found `value`, if
+ * nothing was recorded for it yet.
+ */
+void adddep(struct depset *set, int kind, char *name, unsigned long value) {
+	insertdep(set, kind, 0, name, value);
+}
+
+/*
+ * Record that a header set something itself, so that looking it up later
+ * does not depend on where the header is included.
+ */
+void owndep(struct depset *set, int kind, char *name) {
+	insertdep(set, kind, 1, name, 0);
+}
+
+/*
+ * Get the bucket a header belongs in.
+ */
+static struct header **bucket(char *path, unsigned long hash) {
+	return &hdrtab[((unsigned long)path ^ hash) & (NHDRBUCKET - 1)];
+}
+
+/*
+ * Return true if a header would be parsed the same way included where
+ * `from` is now: everything it looked up outside itself is found the same.
+ */
+static bool fits(struct header *header, struct cpp *from) {
+	struct hdrdep *dep;
+	int i;
+
+	for (i = 0; i < header->deps.ndep; i++) {
+		dep = &header->deps.deps[i];
+		if (!dep->own && cppdep(from, dep->kind, dep->name)
+		    != dep->value)
+			return false;
+	}
+	return true;
+}
+
+/*
+ * Find a header in the store that fits where `from` is now. If none does
+ * but one of the same file is still being parsed, which might, that one is
+ * returned in `busy`. Must be called with the lock held.
+ */
+static struct header *findheader(struct cpp *from, char *path,
+    unsigned long hash, struct header **busy) {
+	struct header *header;
+
+	*busy = NULL;
+	for (header = *bucket(path, hash); header != NULL;
+	    header = header->next) {
+		if (header->path != path || header->hash != hash)
+			continue;
+		if (!header->frozen)
+			*busy = header;
+		else if (fits(header, from))
+			return header;
+	}
+	return NULL;
+}
+
+/*
+ * Return true if waiting for a header would wait on this thread itself:
+ * the header is being parsed by this thread, or by one waiting for a
+ * header that is, and so on. Must be called with the lock held.
+ */
+static bool waitsonself(struct header *header) {
+	struct loading *loader;
+
+	for (;;) {
+		if ((loader = header->loader) == &loading)
+			return true;
+		if (loader == NULL || (header = loader->waiting) == NULL)
+			return false;
+	}
+}
+
+/*
+ * Make a header the most recently used. Must be called with the lock held.
+ */
+static void touchheader(struct header *header) {
+	if (header == newest)
+		return;
+	if (header->newer != NULL)
+		header->newer->older = header->older;
+	if (header->older != NULL)
+		header->older->newer = header->newer;
+	else if (oldest == header)
+		oldest = header->newer;
+	header->newer = NULL;
+	header->older = newest;
+	if (newest != NULL)
+		newest->newer = header;
+	newest = header;
+	if (oldest == NULL)
+		oldest = header;
+}
+
+/*
+ * Remove a header from the store. Must be called with the lock held.
+ */
+static void dropheader(struct header *header) {
+	struct header **link;
+
+	link = bucket(header->path, header->hash);
+	while (*link != header)
+		link = &(*link)->next;
+	*link = header->next;
+	if (header->newer != NULL)
+		header->newer->older = header->older;
+	else
+		newest = header->older;
+	if (header->older != NULL)
+		header->older->newer = header->newer;
+	else
+		oldest = header->newer;
+	nheader--;
+}
+
+/*
+ * Free a header that is out of the store and held by nothing. Giving up
+ * its own imports may leave other headers held by nothing, which are then
+ * freed once the store next needs the room.
+ */
+static void freeheader(struct header *header) {
+	if (header->cpp != NULL) {
+		cppfree(header->cpp);
+		free(header->cpp);
+	}
+	parsefree(&header->parser);
+	free(header->deps.deps);
+	free(header->deps.slots);
+	free(header->source);
+	free(header);
+}
+
+/*
+ * Take the least recently used headers that nothing holds out of the
+ * store, until it holds no more than MAXHEADER, and return them as a list
+ * to be freed once the lock is released. Must be called with the lock
+ * held.
+ */
+static struct header *evict(void) {
+	struct header *header, *newer, *victims;
+
+	victims = NULL;
+	for (header = oldest; header != NULL && nheader > MAXHEADER;
+	    header = newer) {
+		newer = header->newer;
+		if (!header->frozen || header->refs > 0)
+			continue;
+		dropheader(header);
+		header->next = victims;
+		victims = header;
+	}
+	return victims;
+}
+
+/*
+ * Take a reference to a header, so that it is not freed while it is held.
+ */
+void retainheader(struct header *header) {
+	pthread_mutex_lock(&hdrlock);
+	header->refs++;
+	pthread_mutex_unlock(&hdrlock);
+}
+
+/*
+ * Give up a reference to a header. A header nothing holds stays in the
+ * store until it is evicted to make room, unless it failed to parse, in
+ * which case it is already out of the store and is freed now.
+ */
+void releaseheader(struct header *header) {
+	bool unused;
+
+	pthread_mutex_lock(&hdrlock);
+	unused = --header->refs == 0 && header->failed;
+	pthread_mutex_unlock(&hdrlock);
+	if (unused)
+		freeheader(header);
+}
+
+/*
+ * Preprocess and parse a header that has just been added to the store, as
+ * if it were included where `from` is now, recording what it looks up
+ * outside itself. Syntax errors are fatal here rather than collected, since
+ * a header that does not parse on its own is included in place instead.
+ */
+static void parseheader(struct header *header, struct cpp *from,
+    int length) {
+	int i;
+
+	header->cpp = calloc(1, sizeof(struct cpp));
+	cppheader(header->cpp, from, header->path, header->source, length);
+	header->cpp->deps = &header->deps;
+	parsereset(&header->parser, preprocess(header->cpp));
+	for (i = 0; i < from->nimport; i++)
+		importheader(&header->parser, from->imports[i]);
+	/*
+	 * Only the header's own declarations go in its tree, since it may be
+	 * imported by files that never included the headers it was parsed
+	 * under.
+	 */
+	header->parser.root = NULL;
+	header->nbase = header->parser.nimport;
+	header->parser.deps = &header->deps;
+	header->parser.ncontext = header->nbase;
+	parse(&header->parser);
+	header->cpp->deps = NULL;
+	header->parser.deps = NULL;
+}
+
+/*
+ * Get the parsed form of a header included where `from` is now. Headers
+ * are keyed by their path and a hash of their contents, and each one kept
+ * records the macros, guards and typedef-names it looked up outside itself
+ * while being parsed. One fits wherever those are all found the same, so a
+ * header is only preprocessed and parsed again when something it actually
+ * uses differs, no matter how many translation units or threads include
+ * it, as long as it stays in the store.
+ *
+ * A header being parsed is waited for, unless this thread is the one
+ * parsing it, directly or through a chain of waits, as when a header
+ * includes itself; that is an error, and the header is included in place.
+ *
+ * The returned header is frozen and must not be modified; use
+ * `importheader` to make its declarations visible to a parser. The caller
+ * holds a reference to it, to be given up with `releaseheader`.
+ */
+struct header *loadheader(struct cpp *from, char *path, char *source,
+    int length) {
+	struct header *header, *busy, **head, *victims, *victim;
+	struct diagbuf *diags;
+	jmp_buf env, *prev;
+	unsigned long hash;
+	char message[MAXERROR];
+
+	path = internstr(path, strlen(path));
+	hash = hashbytes(source, length);
+	pthread_mutex_lock(&hdrlock);
+	while ((header = findheader(from, path, hash, &busy)) == NULL
+	    && busy != NULL) {
+		if (waitsonself(busy)) {
+			pthread_mutex_unlock(&hdrlock);
+			fatalf("%s: %s", path, "Header includes itself");
+		}
+		/*
+		 * Whatever is waited for is held, so that it is not freed
+		 * while another thread follows this one's wait.
+		 */
+		busy->refs++;
+		loading.waiting = busy;
+		while (!busy->frozen)
+			pthread_cond_wait(&hdrdone, &hdrlock);
+		loading.waiting = NULL;
+		if (--busy->refs == 0 && busy->failed) {
+			pthread_mutex_unlock(&hdrlock);
+			freeheader(busy);
+			pthread_mutex_lock(&hdrlock);
+		}
+	}
+	if (header != NULL) {
+		header->refs++;
+		touchheader(header);
+		pthread_mutex_unlock(&hdrlock);
+		return header;
+	}
+	header = calloc(1, sizeof(struct header));
+	header->path = path;
+	header->hash = hash;
+	header->source = malloc(length + 1);
+	memcpy(header->source, source, length);
+	header->source[length] = '\0';
+	header->refs = 1;
+	header->loader = &loading;
+	head = bucket(path, hash);
+	header->next = *head;
+	*head = header;
+	nheader++;
+	touchheader(header);
+	victims = evict();
+	pthread_mutex_unlock(&hdrlock);
+	while ((victim = victims) != NULL) {
+		victims = victim->next;
+		freeheader(victim);
+	}
+
+	/*
+	 * Parse without holding the lock, so other headers can be loaded in
+	 * the meantime. If parsing fails, the header is taken out of the
+	 * store, so that anyone waiting on it looks again, and is freed once
+	 * they let go of it; then the error is passed on as it is.
+	 */
+	prev = catcherrors(&env);
+	diags = collecterrors(NULL);
+	if (setjmp(env)) {
+		catcherrors(prev);
+		collecterrors(diags);
+		strcpy(message, lasterror());
+		pthread_mutex_lock(&hdrlock);
+		dropheader(header);
+		header->failed = 1;
+		header->frozen = 1;
+		header->loader = NULL;
+		pthread_cond_broadcast(&hdrdone);
+		pthread_mutex_unlock(&hdrlock);
+		releaseheader(header);
+		fatalf("%s", message);
+	}
+	parseheader(header, from, length);
+	catcherrors(prev);
+	collecterrors(diags);
+
+	pthread_mutex_lock(&hdrlock);
+	header->frozen = 1;
+	header->loader = NULL;
+	pthread_cond_broadcast(&hdrdone);
+	pthread_mutex_unlock(&hdrlock);
+	return header;
+}
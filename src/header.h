@@ -0,0 +1,92 @@
+#ifndef _HEADER_H_
+#define _HEADER_H_
+
+#include <pthread.h>
+
+/*
+ * How many buckets the header-store has. Must be a power of two.
+ */
+#define NHDRBUCKET	256
+
+/*
+ * Most headers the store keeps. Past this, the least recently used headers
+ * that nothing holds are freed.
+ */
+#define MAXHEADER	1024
+
+/*
+ * Kinds of thing parsing a header can look up outside of it.
+ */
+enum {
+	DEP_MACRO,		/* a macro, by its definition */
+	DEP_GUARD,		/* the guard of a file */
+	DEP_TYPEDEF,		/* a typedef-name of an imported header */
+};
+
+/*
+ * Something parsing a header looked up that the header did not set itself,
+ * and what was found. Things the header set itself are kept too, marked as
+ * its own, so that later lookups of them are not taken for dependencies.
+ */
+struct hdrdep {
+	int kind;		/* what was looked up */
+	int own;		/* set by the header itself */
+	char *name;		/* interned macro, path or typedef-name */
+	unsigned long value;	/* what was found, 0 for nothing */
+};
+
+/*
+ * What a header depends on, with a table to find each thing by name.
+ */
+struct depset {
+	struct hdrdep *deps;	/* things looked up, in order */
+	int ndep;		/* number of things */
+	int capdep;		/* capacity of deps */
+	int *slots;		/* indexes into deps, -1 if free */
+	int nslot;		/* number of slots, a power of two */
+};
+
+/*
+ * A parsed header. Once frozen, a header is never modified again, so any
+ * number of parsers can import it at once without locking. A header is
+ * held by each preprocessor that imported it, including those of other
+ * headers, and is only freed once none do. The same header can be in the
+ * store more than once, parsed under different macros or imports; which
+ * one fits an includer is decided by what each looked up outside itself.
+ */
+struct header {
+	char *path;		/* interned path of header */
+	unsigned long hash;	/* hash of contents */
+	char *source;		/* contents of header */
+	struct cpp *cpp;	/* owns the header's tokens and macros */
+	struct parser parser;	/* owns the header's declarations */
+	int nbase;		/* imports it was parsed under */
+	int frozen;		/* done parsing */
+	int failed;		/* parsing hit a fatal error */
+	int refs;		/* number of holders */
+	struct depset deps;	/* what it was parsed under */
+	struct loading *loader;	/* thread parsing it, NULL once frozen */
+	struct header *newer;	/* next more recently used header */
+	struct header *older;	/* next less recently used header */
+	struct header *next;	/* next header in bucket */
+};
+
+/*
+ * What a thread is doing with the store: waiting for a header another
+ * thread is parsing, or not. Waits that would come back around to the
+ * thread itself are refused instead, since they would never end.
+ */
+struct loading {
+	struct header *waiting;	/* header waited for, NULL if none */
+};
+
+struct cpp;
+
+void adddep(struct depset *set, int kind, char *name, unsigned long value);
+void owndep(struct depset *set, int kind, char *name);
+struct header *loadheader(struct cpp *from, char *path, char *source,
+    int length);
+void retainheader(struct header *header);
+void releaseheader(struct header *header);
+
+#endif /* !_HEADER_H_ */
@@ -0,0 +1,266 @@
+#include <errno.h>
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "token.h"
+#include "walk.h"
+#include "index.h"
+
+/*
+ * Strings of an index being written. Names are interned and paths are
+ * shared by every token of a source, so strings are told apart by their
+ * pointers, and each is stored once.
+ */
+struct strtab {
+	char **keys;		/* strings stored, NULL if slot is free */
+	uint32_t *offsets;	/* offset of each string */
+	int size;		/* number of slots */
+	int count;		/* number of strings */
+	struct outbuf data;	/* null-terminated strings */
+};
+
+/*
+ * Record a symbol found while parsing.
+ */
+void indexsym(struct index *index, struct token *name, int kind) {
+	struct symref *ref;
+
+	if (index->count == index->capacity) {
+		index->capacity = index->capacity ? index->capacity * 2 : 256;
+		index->refs = realloc(index->refs,
+		    index->capacity * sizeof(struct symref));
+	}
+	ref = &index->refs[index->count++];
+	ref->name = (char *)name->value;
+	ref->path = name->path ? name->path : "<input>";
+	ref->line = name->line;
+	ref->offset = name->offset;
+	ref->kind = kind;
+}
+
+/*
+ * Release the symbols of an index and empty it.
+ */
+void indexfree(struct index *index) {
+	free(index->refs);
+	memset(index, 0, sizeof(struct index));
+}
+
+/*
+ * Compare two symbols by name, then by where they are. Called by `qsort`.
+ */
+static int cmpsymref(const void *a, const void *b) {
+	const struct symref *x, *y;
+	int diff;
+
+	x = a;
+	y = b;
+	if (x->name != y->name && (diff = strcmp(x->name, y->name)) != 0)
+		return diff;
+	if (x->path != y->path && (diff = strcmp(x->path, y->path)) != 0)
+		return diff;
+	if (x->offset != y->offset)
+		return x->offset < y->offset ? -1 : 1;
+	return x->kind - y->kind;
+}
+
+/*
+ * Double the number of slots of a string-table and re-insert every string.
+ */
+static void growstrtab(struct strtab *tab) {
+	char **keys;
+	uint32_t *offsets;
+	int i, size;
+	size_t slot;
+
+	size = tab->size ? tab->size * 2 : NIDXSTRBUCKET;
+	keys = calloc(size, sizeof(char *));
+	offsets = malloc(size * sizeof(uint32_t));
+	for (i = 0; i < tab->size; i++) {
+		if (tab->keys[i] == NULL)
+			continue;
+		slot = ((uintptr_t)tab->keys[i] >> 3) & (size - 1);
+		while (keys[slot] != NULL)
+			slot = (slot + 1) & (size - 1);
+		keys[slot] = tab->keys[i];
+		offsets[slot] = tab->offsets[i];
+	}
+	free(tab->keys);
+	free(tab->offsets);
+	tab->keys = keys;
+	tab->offsets = offsets;
+	tab->size = size;
+}
+
+/*
+ * Get the offset of a string in a string-table, adding it if it is not
+ * there yet.
+ */
+static uint32_t addstr(struct strtab *tab, char *string) {
+	size_t slot;
+
+	if (tab->count * 2 >= tab->size)
+		growstrtab(tab);
+	slot = ((uintptr_t)string >> 3) & (tab->size - 1);
+	while (tab->keys[slot] != NULL) {
+		if (tab->keys[slot] == string)
+			return tab->offsets[slot];
+		slot = (slot + 1) & (tab->size - 1);
+	}
+	tab->keys[slot] = string;
+	tab->offsets[slot] = tab->data.length;
+	tab->count++;
+	outappend(&tab->data, string, strlen(string) + 1);
+	return tab->offsets[slot];
+}
+
+/*
+ * Sort the symbols of an index and write them to a file, so that the file
+ * can be mapped and searched with `openindex` and `lookupindex`. Returns 0
+ * on success, or -1 with `errno` set on error.
+ */
+int writeindex(struct index *index, char *path) {
+	struct indexhdr hdr;
+	struct indexent *entries;
+	struct symref *ref;
+	struct strtab strs;
+	size_t strings;
+	FILE *fp;
+	int i, status;
+
+	qsort(index->refs, index->count, sizeof(struct symref), cmpsymref);
+	entries = malloc((index->count + 1) * sizeof(struct indexent));
+	memset(&strs, 0, sizeof(strs));
+	for (i = 0; i < index->count; i++) {
+		ref = &index->refs[i];
+		entries[i].name = addstr(&strs, ref->name);
+		entries[i].path = addstr(&strs, ref->path);
+		entries[i].line = ref->line;
+		entries[i].offset = ref->offset;
+		entries[i].kind = ref->kind;
+	}
+	strings = sizeof(struct indexhdr)
+	    + (size_t)index->count * sizeof(struct indexent);
+	hdr.magic = INDEXMAGIC;
+	hdr.version = INDEXVERSION;
+	hdr.nentry = index->count;
+	hdr.entries = sizeof(struct indexhdr);
+	hdr.strsize = strs.data.length;
+	hdr.strings = strings;
+
+	status = -1;
+	if (strings + strs.data.length > UINT32_MAX)
+		errno = EFBIG;
+	else if ((fp = fopen(path, "wb")) != NULL) {
+		fwrite(&hdr, sizeof(hdr), 1, fp);
+		fwrite(entries, sizeof(struct indexent), index->count, fp);
+		fwrite(strs.data.data, 1, strs.data.length, fp);
+		status = ferror(fp) ? -1 : 0;
+		if (fclose(fp) != 0)
+			status = -1;
+	}
+	free(entries);
+	free(strs.keys);
+	free(strs.offsets);
+	outfree(&strs.data);
+	return status;
+}
+
+/*
+ * Map an index file into memory. Nothing is read beyond the header until
+ * the index is searched. Returns 0 on success, or -1 if the file could not
+ * be mapped or is not an index.
+ */
+int openindex(struct indexmap *map, char *path) {
+	struct indexhdr *hdr;
+	struct stat st;
+	void *base;
+	int fd;
+
+	if ((fd = open(path, O_RDONLY)) < 0)
+		return -1;
+	if (fstat(fd, &st) < 0
+	    || (size_t)st.st_size < sizeof(struct indexhdr)) {
+		close(fd);
+		return -1;
+	}
+	base = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if (base == MAP_FAILED)
+		return -1;
+	/*
+	 * Check that everything the header points to is inside the file,
+	 * so that a damaged index cannot make a search read past it.
+	 */
+	hdr = base;
+	if (hdr->magic != INDEXMAGIC || hdr->version != INDEXVERSION
+	    || hdr->entries != sizeof(struct indexhdr)
+	    || hdr->nentry > (st.st_size - hdr->entries)
+	    / sizeof(struct indexent)
+	    || hdr->strings != hdr->entries
+	    + hdr->nentry * sizeof(struct indexent)
+	    || hdr->strsize > st.st_size - hdr->strings
+	    || (hdr->strsize > 0
+	    && ((char *)base)[hdr->strings + hdr->strsize - 1] != '\0')) {
+		munmap(base, st.st_size);
+		return -1;
+	}
+	map->base = base;
+	map->size = st.st_size;
+	map->hdr = hdr;
+	map->entries = (struct indexent *)((char *)base + hdr->entries);
+	map->strings = (char *)base + hdr->strings;
+	return 0;
+}
+
+/*
+ * Get a string of a mapped index, or an empty string if the offset is out
+ * of range.
+ */
+char *indexstr(struct indexmap *map, uint32_t offset) {
+	if (offset >= map->hdr->strsize)
+		return "";
+	return &map->strings[offset];
+}
+
+/*
+ * Find the entries for a name in a mapped index. Entries for a name are
+ * next to each other, so this is a binary search for the first of them.
+ * Returns how many there are, and stores the position of the first in
+ * `first`.
+ */
+int lookupindex(struct indexmap *map, char *name, int *first) {
+	struct indexent *entries;
+	int low, high, mid, count;
+
+	entries = map->entries;
+	low = 0;
+	high = map->hdr->nentry;
+	while (low < high) {
+		mid = low + (high - low) / 2;
+		if (strcmp(indexstr(map, entries[mid].name), name) < 0)
+			low = mid + 1;
+		else
+			high = mid;
+	}
+	*first = low;
+	for (count = 0; low + count < (int)map->hdr->nentry; count++) {
+		if (strcmp(indexstr(map, entries[low + count].name), name))
+			break;
+	}
+	return count;
+}
+
+/*
+ * Unmap an index file.
+ */
+void closeindex(struct indexmap *map) {
+	munmap(map->base, map->size);
+	memset(map, 0, sizeof(struct indexmap));
+}
@@ -0,0 +1,94 @@
+#ifndef _INDEX_H_
+#define _INDEX_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * Identifies an index file, and the version of its layout.
+ */
+#define INDEXMAGIC	0x78646976
+#define INDEXVERSION	1
+
+/*
+ * How many slots the string-table of an index starts with when it is
+ * written. Must be a power of two.
+ */
+#define NIDXSTRBUCKET	1024
+
+/*
+ * Kinds of symbol. Tags, enumeration constants and members are recorded
+ * only where they are defined, in the body of their struct, union or enum.
+ */
+enum {
+	IX_DEF, IX_DECL, IX_TYPEDEF, IX_REF, IX_TAG, IX_ENUMCONST, IX_MEMBER,
+};
+
+/*
+ * Header of an index file. The file is laid out to be mapped and read in
+ * place: the header, the entries sorted by name then by place, then the
+ * null-terminated strings the entries refer to. Numbers are in the byte
+ * order of the machine that wrote the file.
+ */
+struct indexhdr {
+	uint32_t magic;		/* INDEXMAGIC */
+	uint32_t version;	/* INDEXVERSION */
+	uint32_t nentry;	/* number of entries */
+	uint32_t entries;	/* file offset of entries */
+	uint32_t strsize;	/* bytes of strings */
+	uint32_t strings;	/* file offset of strings */
+};
+
+/*
+ * Entry of an index file.
+ */
+struct indexent {
+	uint32_t name;		/* offset of name in strings */
+	uint32_t path;		/* offset of path in strings */
+	uint32_t line;		/* line of name in its source */
+	uint32_t offset;	/* position of name in its source */
+	uint32_t kind;		/* kind of symbol */
+};
+
+/*
+ * A symbol found while parsing.
+ */
+struct symref {
+	char *name;		/* interned name */
+	char *path;		/* path of its source */
+	int line;		/* line of name in its source */
+	int offset;		/* position of name in its source */
+	int kind;		/* kind of symbol */
+};
+
+/*
+ * Symbols found so far, to be sorted and written out once parsing is done.
+ */
+struct index {
+	struct symref *refs;	/* symbols in the order found */
+	int count;		/* number of symbols */
+	int capacity;		/* symbols allocated */
+};
+
+/*
+ * An index file mapped into memory.
+ */
+struct indexmap {
+	void *base;		/* start of mapping */
+	size_t size;		/* length of mapping */
+	struct indexhdr *hdr;	/* header of file */
+	struct indexent *entries;/* entries of file */
+	char *strings;		/* strings of file */
+};
+
+struct token;
+
+void indexsym(struct index *index, struct token *name, int kind);
+void indexfree(struct index *index);
+int writeindex(struct index *index, char *path);
+int openindex(struct indexmap *map, char *path);
+int lookupindex(struct indexmap *map, char *name, int *first);
+char *indexstr(struct indexmap *map, uint32_t offset);
+void closeindex(struct indexmap *map);
+
+#endif /* !_INDEX_H_ */
@@ -0,0 +1,273 @@
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#include "intern.h"
+#include "input.h"
+
+/*
+ * Files queued to be read by the reader thread. Reads are handed off to a
+ * thread rather than being done asynchronously by the kernel, since that
+ * works the same on every file-system and needs nothing beyond pthreads.
+ */
+static struct prefetch pftab[MAXPREFETCH];
+static unsigned long pfseq;
+static pthread_t reader;
+static int readerup;
+static pthread_mutex_t pflock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t pfqueued = PTHREAD_COND_INITIALIZER;
+static pthread_cond_t pfdone = PTHREAD_COND_INITIALIZER;
+
+/*
+ * Read a whole file into a null-terminated buffer, blocking until it is
+ * done. A read may return less than was asked for, so reading carries on
+ * until the end of the file. Returns NULL if it could not be read, with
+ * `length` set to 0.
+ */
+static char *readwhole(char *path, int *length) {
+	struct stat st;
+	char *buffer;
+	long size, n;
+	int fd;
+
+	*length = 0;
+	if ((fd = open(path, O_RDONLY)) < 0)
+		return NULL;
+	if (fstat(fd, &st) < 0 || !S_ISREG(st.st_mode)) {
+		close(fd);
+		return NULL;
+	}
+	posix_fadvise(fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+	buffer = malloc(st.st_size + 1);
+	for (size = 0; size < st.st_size; size += n) {
+		if ((n = read(fd, buffer + size, st.st_size - size)) == 0)
+			break;
+		if (n < 0 && errno == EINTR)
+			n = 0;
+		else if (n < 0) {
+			close(fd);
+			free(buffer);
+			return NULL;
+		}
+	}
+	close(fd);
+	*length = size;
+	buffer[size] = '\0';
+	return buffer;
+}
+
+/*
+ * Find the slot a path is one of the paths of, and which of them it is.
+ * Must be called with the lock held.
+ */
+static struct prefetch *findslot(char *path, int *which) {
+	int i, j;
+
+	for (i = 0; i < MAXPREFETCH; i++) {
+		if (pftab[i].state == PF_FREE)
+			continue;
+		for (j = 0; j < pftab[i].npath; j++) {
+			if (pftab[i].paths[j] == path) {
+				*which = j;
+				return &pftab[i];
+			}
+		}
+	}
+	return NULL;
+}
+
+/*
+ * Empty a slot. Must be called with the lock held.
+ */
+static void freeslot(struct prefetch *pf) {
+	free(pf->buffer);
+	pf->buffer = NULL;
+	pf->state = PF_FREE;
+}
+
+/*
+ * Body of the reader thread. Reads queued files in the order they were
+ * queued in, forever, each from the first of its paths it can be read at.
+ * A file its owner is done with by the time it is read is thrown away.
+ */
+static void *readloop(void *arg) {
+	struct prefetch *pf, *next;
+	char *buffer;
+	int i, found, length;
+
+	pthread_mutex_lock(&pflock);
+	for (;;) {
+		next = NULL;
+		for (i = 0; i < MAXPREFETCH; i++) {
+			pf = &pftab[i];
+			if (pf->state == PF_QUEUED
+			    && (next == NULL || pf->seq < next->seq))
+				next = pf;
+		}
+		if (next == NULL) {
+			pthread_cond_wait(&pfqueued, &pflock);
+			continue;
+		}
+		next->state = PF_READING;
+		pthread_mutex_unlock(&pflock);
+		buffer = NULL;
+		length = 0;
+		for (found = 0; found < next->npath; found++) {
+			if ((buffer = readwhole(next->paths[found],
+			    &length)) != NULL)
+				break;
+		}
+		pthread_mutex_lock(&pflock);
+		next->buffer = buffer;
+		next->length = length;
+		next->found = buffer != NULL ? found : -1;
+		next->state = PF_DONE;
+		if (next->dropped && next->waiting == 0)
+			freeslot(next);
+		pthread_cond_broadcast(&pfdone);
+	}
+	return NULL;
+}
+
+/*
+ * Ask for a file to be read in the background, so that a later `readfile`
+ * of it does not have to wait on I/O. The file is looked for at each of
+ * the paths in turn by the reader thread, so not even finding it costs the
+ * caller a system call. If the queue is full, the oldest file that was
+ * read but never asked for is dropped to make room; if there is none, the
+ * request is ignored.
+ */
+void prefetch(char **paths, int npath, void *owner) {
+	struct prefetch *pf, *slot;
+	int i, which;
+
+	if (npath > MAXCANDIDATE)
+		npath = MAXCANDIDATE;
+	pthread_mutex_lock(&pflock);
+	if (!readerup) {
+		readerup = pthread_create(&reader, NULL, readloop, NULL) == 0;
+		if (readerup)
+			pthread_detach(reader);
+	}
+	if (!readerup || npath == 0 || findslot(paths[0], &which) != NULL) {
+		pthread_mutex_unlock(&pflock);
+		return;
+	}
+	slot = NULL;
+	for (i = 0; i < MAXPREFETCH; i++) {
+		pf = &pftab[i];
+		if (pf->state == PF_FREE) {
+			slot = pf;
+			break;
+		}
+		if (pf->state == PF_DONE && pf->waiting == 0
+		    && (slot == NULL || pf->seq < slot->seq))
+			slot = pf;
+	}
+	if (slot != NULL) {
+		freeslot(slot);
+		for (i = 0; i < npath; i++)
+			slot->paths[i] = internstr(paths[i], strlen(paths[i]));
+		slot->npath = npath;
+		slot->found = -1;
+		slot->state = PF_QUEUED;
+		slot->seq = pfseq++;
+		slot->owner = owner;
+		slot->dropped = 0;
+		pthread_cond_signal(&pfqueued);
+	}
+	pthread_mutex_unlock(&pflock);
+}
+
+/*
+ * Drop the files prefetched for an owner that were never read. Called once
+ * the owner is done, so that a file read ahead for it but not used is not
+ * handed, out of date, to whoever reads it later. Files being read are
+ * thrown away once the read finishes.
+ */
+void dropprefetches(void *owner) {
+	struct prefetch *pf;
+	int i;
+
+	if (owner == NULL)
+		return;
+	pthread_mutex_lock(&pflock);
+	for (i = 0; i < MAXPREFETCH; i++) {
+		pf = &pftab[i];
+		if (pf->state == PF_FREE || pf->owner != owner
+		    || pf->waiting > 0)
+			continue;
+		if (pf->state == PF_READING)
+			pf->dropped = 1;
+		else
+			freeslot(pf);
+	}
+	pthread_mutex_unlock(&pflock);
+}
+
+/*
+ * Read a whole file into a null-terminated buffer. If the file was
+ * prefetched, its contents are handed over, waiting for the read to finish
+ * if it is still going; otherwise the file is read here. A path the reader
+ * thread found nothing at gives NULL without being tried again. Several
+ * threads may wait on the same file: each but the last gets a copy, and
+ * the last takes the buffer and frees the slot. Returns NULL if it could
+ * not be read, with `length` set to 0.
+ */
+char *readfile(char *path, int *length) {
+	struct prefetch *pf;
+	char *buffer;
+	int which, found;
+
+	path = internstr(path, strlen(path));
+	pthread_mutex_lock(&pflock);
+	if ((pf = findslot(path, &which)) == NULL) {
+		pthread_mutex_unlock(&pflock);
+		return readwhole(path, length);
+	}
+	/*
+	 * A file still waiting in the queue is cheaper to read here than to
+	 * wait behind everything queued before it.
+	 */
+	if (pf->state == PF_QUEUED) {
+		freeslot(pf);
+		pthread_mutex_unlock(&pflock);
+		return readwhole(path, length);
+	}
+	pf->waiting++;
+	while (pf->state != PF_DONE)
+		pthread_cond_wait(&pfdone, &pflock);
+	pf->waiting--;
+	/*
+	 * The reader thread stopped at the first path it found the file at,
+	 * so paths after it were never tried.
+	 */
+	if ((found = pf->found) != which) {
+		if (found < 0 && pf->waiting == 0)
+			freeslot(pf);
+		pthread_mutex_unlock(&pflock);
+		if (found >= 0 && which > found)
+			return readwhole(path, length);
+		*length = 0;
+		return NULL;
+	}
+	*length = pf->length;
+	if (pf->waiting > 0) {
+		buffer = NULL;
+		if (pf->buffer != NULL) {
+			buffer = malloc(pf->length + 1);
+			memcpy(buffer, pf->buffer, pf->length + 1);
+		}
+		pthread_mutex_unlock(&pflock);
+		return buffer;
+	}
+	buffer = pf->buffer;
+	pf->buffer = NULL;
+	freeslot(pf);
+	pthread_mutex_unlock(&pflock);
+	return buffer;
+}
@@ -0,0 +1,44 @@
+#ifndef _INPUT_H_
+#define _INPUT_H_
+
+/*
+ * Most files that can be waiting in the prefetch queue at once. Further
+ * requests are dropped, and those files are read when they are needed.
+ */
+#define MAXPREFETCH	64
+
+/*
+ * Most paths a prefetched file is looked for at. A file found past them is
+ * read when it is needed.
+ */
+#define MAXCANDIDATE	16
+
+/*
+ * States of a prefetch slot.
+ */
+enum {
+	PF_FREE, PF_QUEUED, PF_READING, PF_DONE,
+};
+
+/*
+ * A file that has been asked to be read ahead of time, with the paths it
+ * may be at. The reader thread reads it from the first path it is at.
+ */
+struct prefetch {
+	int state;		/* state of slot */
+	char *paths[MAXCANDIDATE];/* interned paths it may be at, in order */
+	int npath;		/* number of paths */
+	int found;		/* index of path read, -1 if at none */
+	char *buffer;		/* contents, NULL if it could not be read */
+	int length;		/* length of contents */
+	unsigned long seq;	/* order it was queued in */
+	int waiting;		/* readers waiting for it to finish */
+	void *owner;		/* what asked for it, NULL if nothing */
+	int dropped;		/* owner is done with it */
+};
+
+void prefetch(char **paths, int npath, void *owner);
+void dropprefetches(void *owner);
+char *readfile(char *path, int *length);
+
+#endif /* !_INPUT_H_ */
@@ -0,0 +1,82 @@
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "intern.h"
+
+/*
+ * Table of every interned string. Grows by doubling once the number of
+ * strings reaches the number of buckets. Shared by every lexer, so it is
+ * guarded by a lock.
+ */
+static struct strent **strtab;
+static int nstrbucket;
+static int nstr;
+static pthread_mutex_t strlock = PTHREAD_MUTEX_INITIALIZER;
+
+/*
+ * Hash a block of bytes.
+ */
+unsigned long hashbytes(char *bytes, int length) {
+	unsigned long hash;
+	int i;
+
+	hash = 14695981039346656037UL;
+	for (i = 0; i < length; i++)
+		hash = (hash ^ (unsigned char)bytes[i]) * 1099511628211UL;
+	return hash;
+}
+
+/*
+ * Double the number of buckets and re-insert every string.
+ */
+static void grow(void) {
+	struct strent **table, *ent, *next;
+	int i, size;
+
+	size = nstrbucket ? nstrbucket * 2 : NSTRBUCKET;
+	table = calloc(size, sizeof(struct strent *));
+	for (i = 0; i < nstrbucket; i++) {
+		for (ent = strtab[i]; ent != NULL; ent = next) {
+			next = ent->next;
+			ent->next = table[ent->hash & (size - 1)];
+			table[ent->hash & (size - 1)] = ent;
+		}
+	}
+	free(strtab);
+	strtab = table;
+	nstrbucket = size;
+}
+
+/*
+ * Return the canonical copy of a string, which need not be null-terminated.
+ * Two interned strings are equal if and only if their pointers are equal.
+ */
+char *internstr(char *string, int length) {
+	struct strent *ent;
+	unsigned long hash;
+	int bucket;
+
+	hash = hashbytes(string, length);
+	pthread_mutex_lock(&strlock);
+	if (nstr >= nstrbucket)
+		grow();
+	bucket = hash & (nstrbucket - 1);
+	for (ent = strtab[bucket]; ent != NULL; ent = ent->next) {
+		if (ent->hash == hash && ent->length == length
+		    && !memcmp(ent->string, string, length)) {
+			pthread_mutex_unlock(&strlock);
+			return ent->string;
+		}
+	}
+	ent = malloc(sizeof(struct strent) + length + 1);
+	ent->hash = hash;
+	ent->length = length;
+	memcpy(ent->string, string, length);
+	ent->string[length] = '\0';
+	ent->next = strtab[bucket];
+	strtab[bucket] = ent;
+	nstr++;
+	pthread_mutex_unlock(&strlock);
+	return ent->string;
+}
@@ -0,0 +1,23 @@
+#ifndef _INTERN_H_
+#define _INTERN_H_
+
+/*
+ * How many buckets the string-table starts with. Must be a power of two.
+ */
+#define NSTRBUCKET	1024
+
+/*
+ * An interned string. Strings are stored inline after the header, and live
+ * for as long as the process does.
+ */
+struct strent {
+	struct strent *next;	/* next string in hash-bucket */
+	unsigned long hash;	/* cached hash of string */
+	int length;		/* length of string */
+	char string[];		/* null-terminated string */
+};
+
+unsigned long hashbytes(char *bytes, int length);
+char *internstr(char *string, int length);
+
+#endif /* !_INTERN_H_ */
@@ -1,45 +1,150 @@
+#include <ctype.h>
+#include <limits.h>
+#include <pthread.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
 #include "token.h"
+#include "arena.h"
+#include "alloc.h"
+#include "intern.h"
+#include "error.h"
+#include "utf8.h"
 #include "lex.h"
 
 /*
- * Map of keyword strings and their corresponding tokens. Gets converted into
- * a hashmap at run-time.
+ * A string and the token it stands for.
  */
-static struct tokenbind {
+struct tokenbind {
 	int token;	/* corresponding token */
-	char *string;	/* keyword string */
+	char *string;	/* keyword or operator string */
 	int strlen;	/* cached to speed-up sorting */
-} tokenmap[] = {
-	/* keywords */
+};
+
+/*
+ * Map of keyword strings and their corresponding tokens. Gets converted into
+ * a hashmap at run-time.
+ */
+static struct tokenbind keywords[] = {
 	{ T_AUTO, "auto" },
 	{ T_ASM, "asm" },
 	{ T_BREAK, "break" },
 	{ T_CASE, "case" },
+	{ T_CHAR, "char" },
 	{ T_CONST, "const" },
 	{ T_CONTINUE, "continue" },
 	{ T_DEFAULT, "default" },
 	{ T_DO, "do" },
+	{ T_DOUBLE, "double" },
 	{ T_ELSE, "else" },
 	{ T_ENUM, "enum" },
 	{ T_EXTERN, "extern" },
+	{ T_FLOAT, "float" },
 	{ T_FOR, "for" },
 	{ T_GOTO, "goto" },
 	{ T_IF, "if" },
+	{ T_INLINE, "inline" },
+	{ T_INT, "int" },
+	{ T_LONG, "long" },
 	{ T_REGISTER, "register" },
+	{ T_RESTRICT, "restrict" },
 	{ T_RETURN, "return" },
+	{ T_SHORT, "short" },
+	{ T_SIGNED, "signed" },
 	{ T_SIZEOF, "sizeof" },
 	{ T_STATIC, "static" },
 	{ T_STRUCT, "struct" },
 	{ T_SWITCH, "switch" },
 	{ T_TYPEDEF, "typedef" },
 	{ T_UNION, "union" },
+	{ T_UNSIGNED, "unsigned" },
+	{ T_VOID, "void" },
 	{ T_VOLATILE, "volatile" },
 	{ T_WHILE, "while" },
+	{ T_ALIGNAS, "_Alignas" },
+	{ T_ALIGNOF, "_Alignof" },
+	{ T_ATOMIC, "_Atomic" },
+	{ T_BOOL, "_Bool" },
+	{ T_COMPLEX, "_Complex" },
+	{ T_GENERIC, "_Generic" },
+	{ T_IMAGINARY, "_Imaginary" },
+	{ T_NORETURN, "_Noreturn" },
+	{ T_STATICASSERT, "_Static_assert" },
+	{ T_THREADLOCAL, "_Thread_local" },
+};
 
-	/* operators */
+#define NKEYWORD	(sizeof(keywords) / sizeof(keywords[0]))
 
+/*
+ * Keywords by their interned strings, so that a name is looked up by its
+ * address alone.
+ */
+static struct tokenbind *keytab[NKEYBUCKET];
+static pthread_once_t keytabbuilt = PTHREAD_ONCE_INIT;
+
+/*
+ * Map of operator strings and their corresponding tokens.
+ */
+static struct tokenbind tokenmap[] = {
+	{ T_LSHIFTEQ, "<<=" },
+	{ T_RSHIFTEQ, ">>=" },
+	{ T_ELLIPSES, "..." },
+	{ T_PLUSEQ, "+=" },
+	{ T_MINUSEQ, "-=" },
+	{ T_STAREQ, "*=" },
+	{ T_DIVEQ, "/=" },
+	{ T_MODEQ, "%=" },
+	{ T_ANDEQ, "&=" },
+	{ T_OREQ, "|=" },
+	{ T_XOREQ, "^=" },
+	{ T_BLSHIFT, "<<" },
+	{ T_BRSHIFT, ">>" },
+	{ T_LAND, "&&" },
+	{ T_LOR, "||" },
+	{ T_EQ, "==" },
+	{ T_NE, "!=" },
+	{ T_LE, "<=" },
+	{ T_GE, ">=" },
+	{ T_ARROW, "->" },
+	{ T_INC, "++" },
+	{ T_DEC, "--" },
+	{ T_HASHHASH, "##" },
+	{ T_PLUS, "+" },
+	{ T_MINUS, "-" },
+	{ T_STAR, "*" },
+	{ T_SLASH, "/" },
+	{ T_MODULO, "%" },
+	{ T_BOR, "|" },
+	{ T_AMP, "&" },
+	{ T_BXOR, "^" },
+	{ T_NOT, "!" },
+	{ T_TILDE, "~" },
+	{ T_LT, "<" },
+	{ T_GT, ">" },
+	{ T_ASSIGN, "=" },
+	{ T_QUESTIONMARK, "?" },
+	{ T_COLON, ":" },
+	{ T_COMMA, "," },
+	{ T_SEMI, ";" },
+	{ T_DOT, "." },
+	{ T_LBRACE, "{" },
+	{ T_RBRACE, "}" },
+	{ T_LBRACKET, "[" },
+	{ T_RBRACKET, "]" },
+	{ T_LPAREN, "(" },
+	{ T_RPAREN, ")" },
+	{ T_HASH, "#" },
 };
 
+#define NTOKEN		(sizeof(tokenmap) / sizeof(tokenmap[0]))
+
+/*
+ * The token-map is sorted once, by whichever lexer gets to it first.
+ */
+static pthread_once_t tokmapsorted = PTHREAD_ONCE_INIT;
+
 /*
  * Accept a string of characters. If the next characters match the given
  * string, then consume those characters and return true. Otherwise return
@@ -65,17 +170,104 @@ static int next(struct lexer *lexer) {
 }
 
 /*
- * Compare two token-bindings. Called by `qsort` function.
+ * Compare two token-bindings, so that longer strings come first. Called by
+ * `qsort` function.
+ */
+static int cmpbinding(const void *a, const void *b) {
+	return ((struct tokenbind *)b)->strlen
+	    - ((struct tokenbind *)a)->strlen;
+}
+
+/*
+ * Sort the token-map from the longest string to the shortest, so that the
+ * first match is the longest one.
  */
-static void cmpbinding(struct tokenbind *a, struct tokenbind *b) {
-	return a->strlen - b->strlen;
+static void sorttokenmap(void) {
+	struct tokenbind *tb;
+
+	for (tb = &tokenmap[0]; tb < &tokenmap[NTOKEN]; tb++)
+		tb->strlen = strlen(tb->string);
+	qsort(tokenmap, NTOKEN, sizeof(struct tokenbind), cmpbinding);
+}
+
+/*
+ * Hash a keyword's interned string into the keyword table.
+ */
+static int keyslot(char *name) {
+	return ((unsigned long)name >> 4) & (NKEYBUCKET - 1);
+}
+
+/*
+ * Intern every keyword and add it to the keyword table.
+ */
+static void buildkeytab(void) {
+	struct tokenbind *kb;
+	int i;
+
+	for (kb = &keywords[0]; kb < &keywords[NKEYWORD]; kb++) {
+		kb->strlen = strlen(kb->string);
+		kb->string = internstr(kb->string, kb->strlen);
+		for (i = keyslot(kb->string); keytab[i] != NULL;
+		    i = (i + 1) & (NKEYBUCKET - 1))
+			;
+		keytab[i] = kb;
+	}
+}
+
+/*
+ * Get the token an interned name stands for: a keyword's token if it is
+ * one, or T_NAME otherwise. Names are lexed as T_NAME, and only turned into
+ * keywords once the preprocessor is done with them, so that a keyword can
+ * still be defined as a macro.
+ */
+int keyword(char *name) {
+	int i;
+
+	pthread_once(&keytabbuilt, buildkeytab);
+	for (i = keyslot(name); keytab[i] != NULL;
+	    i = (i + 1) & (NKEYBUCKET - 1)) {
+		if (keytab[i]->string == name)
+			return keytab[i]->token;
+	}
+	return T_NAME;
+}
+
+/*
+ * Get how a kind of token is written, for error messages.
+ */
+char *tokstr(int kind) {
+	struct tokenbind *tb;
+
+	switch (kind) {
+	case T_NAME:
+		return "identifier";
+	case T_INTLIT:
+		return "integer-literal";
+	case T_CHARLIT:
+		return "character-literal";
+	case T_STRLIT:
+		return "string-literal";
+	case T_IMPORT:
+		return "#include";
+	case T_EOF:
+		return "end of file";
+	}
+	for (tb = &keywords[0]; tb < &keywords[NKEYWORD]; tb++) {
+		if (tb->token == kind)
+			return tb->string;
+	}
+	for (tb = &tokenmap[0]; tb < &tokenmap[NTOKEN]; tb++) {
+		if (tb->token == kind)
+			return tb->string;
+	}
+	return "unknown token";
 }
 
 /*
  * Return the position of a character in the given string. If not found,
  * return -1.
  */
-static void charpos(char *string, int ch) {
+static int charpos(char *string, int ch) {
 	int i;
 
 	for (i = 0; string[i] != '\0'; i++) {
@@ -85,12 +277,113 @@ static void charpos(char *string, int ch) {
 	return -1;
 }
 
+static void lexerror(struct lexer *lexer, char *fmt, ...);
+static bool checkutf8(struct lexer *lexer, int at);
+
 /*
- * Skip any whitespace.
+ * Skip a comment, whose opening characters have already been skipped.
+ */
+static void skipcomment(struct lexer *lexer, bool block) {
+	int ch;
+
+	for (;;) {
+		ch = lexer->source[lexer->position];
+		if (ch == '\0' && lexer->position >= lexer->srclen) {
+			if (block)
+				lexerror(lexer, "Unterminated comment");
+			return;
+		}
+		if (block && ch == '*'
+		    && lexer->source[lexer->position + 1] == '/') {
+			lexer->position += 2;
+			return;
+		}
+		/*
+		 * A line comment ends at the newline, which is left to be
+		 * skipped as whitespace, unless a backslash joins the lines.
+		 */
+		if (ch == '\n') {
+			if (!block && (lexer->position == 0
+			    || lexer->source[lexer->position - 1] != '\\'))
+				return;
+			lexer->line++;
+		}
+		lexer->position++;
+	}
+}
+
+/*
+ * Skip any whitespace and comments. A comment counts as a single space.
  */
 static void skip(struct lexer *lexer) {
-	while (charpos(lexer->source[lexer->position], " \t\n\r\f"))
+	int ch;
+
+	for (;;) {
+		ch = lexer->source[lexer->position];
+		/*
+		 * A backslash before a newline joins the lines, so it counts
+		 * as whitespace that does not start a new line.
+		 */
+		if (ch == '\\' && lexer->source[lexer->position + 1] == '\n') {
+			lexer->position++;
+			lexer->line++;
+		} else if (ch == '/' && (lexer->source[lexer->position + 1] == '*'
+		    || lexer->source[lexer->position + 1] == '/')) {
+			lexer->position += 2;
+			skipcomment(lexer, lexer->source[lexer->position - 1]
+			    == '*');
+			/*
+			 * Anything may be written in a comment, but the
+			 * source must still be valid UTF-8.
+			 */
+			while (lexer->invalid < lexer->position)
+				checkutf8(lexer, lexer->invalid);
+			lexer->space = true;
+			continue;
+		}
+		else if (ch == '\0' || charpos(" \t\n\r\f\v", ch) < 0)
+			break;
+		else if (ch == '\n') {
+			lexer->bol = true;
+			lexer->line++;
+		}
+		lexer->space = true;
 		lexer->position++;
+	}
+}
+
+/*
+ * Report an error at the lexer's position. When errors are being collected
+ * this returns, and the caller carries on as best it can.
+ */
+static void lexerror(struct lexer *lexer, char *fmt, ...) {
+	char message[MAXERROR];
+	va_list args;
+
+	va_start(args, fmt);
+	vsnprintf(message, sizeof(message), fmt, args);
+	va_end(args);
+	errorf("%s:%d: %s", lexer->path ? lexer->path : "<input>",
+	    lexer->line, message);
+}
+
+/*
+ * Check that the character at the given position of the source is valid
+ * UTF-8. The whole source was checked when the lexer was reset, so until
+ * the first invalid character this is only a comparison. That character is
+ * reported, and the rest of the source past it is checked for the next.
+ */
+static bool checkutf8(struct lexer *lexer, int at) {
+	if (at < lexer->invalid)
+		return true;
+	lexerror(lexer, "Invalid UTF-8 in source");
+	for (at++; at < lexer->srclen; at++) {
+		if ((lexer->source[at] & 0xC0) != 0x80)
+			break;
+	}
+	lexer->invalid = at + utf8valid(&lexer->source[at],
+	    lexer->srclen - at);
+	return false;
 }
 
 /*
@@ -99,75 +392,172 @@ static void skip(struct lexer *lexer) {
  */
 static void create(struct lexer *lexer, int token, long value) {
 	struct token *tok;
+	int capmade;
 
-	tok = malloc(sizeof(struct token));
+	tok = allocate(lexer->alloc, sizeof(struct token));
+	if (lexer->alloc != &lexer->own) {
+		if (lexer->nmade == lexer->capmade) {
+			capmade = lexer->capmade ? lexer->capmade * 2 : 256;
+			lexer->made = reallocate(lexer->alloc, lexer->made,
+			    lexer->capmade * sizeof(struct token *),
+			    capmade * sizeof(struct token *));
+			lexer->capmade = capmade;
+		}
+		lexer->made[lexer->nmade++] = tok;
+	}
+	tok->next = NULL;
 	tok->value = value;
-	tok->token = token;
+	tok->kind = token;
+	tok->text = &lexer->source[lexer->start];
+	tok->length = lexer->position - lexer->start;
+	tok->path = lexer->path;
+	tok->line = lexer->line;
+	tok->offset = lexer->start;
+	tok->bol = lexer->bol;
+	tok->space = lexer->space;
+	tok->hideset = NULL;
+	lexer->bol = false;
+	lexer->space = false;
 	if (lexer->curr != NULL)
 		lexer->curr->next = tok;
 	lexer->curr = tok;
 	if (lexer->head == NULL)
 		lexer->head = tok;
-	return token;
 }
 
 /*
- * Scan an integer literal.
+ * Scan an integer literal. Its value is built up unsigned, so a literal too
+ * big for any type is reported rather than overflowing.
  */
 static void scanint(struct lexer *lexer) {
-	int radix, value, digit;
+	unsigned long value;
+	int radix, digit, ch;
+	bool toobig;
 
+	value = 0;
+	toobig = false;
 	radix = 10;
 	if (accept(lexer, "0x") || accept(lexer, "0X"))
 		radix = 16;
 	else if (accept(lexer, "0"))
 		radix = 8;
-	while ((digit = charpos("0123456789abcdef", tolower(ch))) >= 0) {
+	for (;;) {
+		ch = lexer->source[lexer->position];
+		if ((digit = charpos("0123456789abcdef", tolower(ch))) < 0)
+			break;
 		if (digit >= radix)
-			fatalf("Invalid digit %c in integer literal", ch);
-		value = value * radix + digit;
-		ch = next(lexer);
+			lexerror(lexer, "Invalid digit %c in integer literal",
+			    ch);
+		else if (value > (ULONG_MAX - digit) / radix)
+			toobig = true;
+		else
+			value = value * radix + digit;
+		lexer->position++;
 	}
-	putback(lexer);
+	if (toobig)
+		lexerror(lexer, "Integer literal too large");
+	/*
+	 * Suffixes only pick the literal's type, which the parser does not
+	 * track yet; `#if` looks for a `u` in the literal's spelling.
+	 */
+	while (charpos("uUlL", lexer->source[lexer->position]) >= 0)
+		lexer->position++;
 	create(lexer, T_INTLIT, value);
 }
 
 /*
- * Scan an identifier.
+ * Scan an identifier. Characters outside of ASCII are only decoded when
+ * one is met, so ASCII identifiers cost no more than they did before.
  */
 static void scaniden(struct lexer *lexer) {
-	char *buffer;
-	int size, ch;
+	char buffer[MAXIDEN];
+	int size, length, ch;
+	bool toolong;
+	long cp;
 
 	size = 0;
-	ch = next(lexer);
-	buffer = calloc(MAXIDEN, sizeof(char));
-	while (isalpha(ch) || isdigit(ch) || ch == '_') {
-		if (i + 1 >= MAXIDEN)
-			fatalf("Identifier too long");
-		else if (size <= MAXIDEN)
-			buffer[size++] = (char)ch;
-		ch = next(lexer);
+	toolong = false;
+	for (;;) {
+		ch = (unsigned char)lexer->source[lexer->position];
+		if (isalnum(ch) || ch == '_')
+			length = 1;
+		else if (ch < 0x80 || lexer->position >= lexer->invalid)
+			break;
+		else {
+			length = utf8decode(&lexer->source[lexer->position],
+			    lexer->srclen - lexer->position, &cp);
+			if (!isidcontinue(cp))
+				break;
+		}
+		/*
+		 * Overly long identifiers are reported once, then cut short
+		 * at the end of a whole character.
+		 */
+		if (size + length < MAXIDEN) {
+			memcpy(&buffer[size], &lexer->source[lexer->position],
+			    length);
+			size += length;
+		} else if (!toolong) {
+			lexerror(lexer, "Identifier too long");
+			toolong = true;
+		}
+		lexer->position += length;
+	}
+	/*
+	 * Identifiers are interned rather than allocated per-token, so they
+	 * outlive the lexer's arena and are shared between translation units.
+	 */
+	create(lexer, T_NAME, (long)internstr(buffer, size));
+}
+
+/*
+ * Scan a character outside of ASCII that is not in a literal. It can only
+ * be the start of an identifier.
+ */
+static void scanutf8(struct lexer *lexer) {
+	int length;
+	long cp;
+
+	if (!checkutf8(lexer, lexer->position)) {
+		do {
+			lexer->position++;
+		} while ((lexer->source[lexer->position] & 0xC0) == 0x80);
+		return;
+	}
+	length = utf8decode(&lexer->source[lexer->position],
+	    lexer->srclen - lexer->position, &cp);
+	if (isidstart(cp))
+		scaniden(lexer);
+	else {
+		lexerror(lexer, "Invalid character U+%04lX", cp);
+		lexer->position += length;
 	}
-	putback(lexer);
-	buffer[size] = '\0';
-	return create(lexer, T_IDEN, buffer);
 }
 
 /*
  * Scan a character literal.
  */
 static void scanchar(struct lexer *lexer) {
-	long value;
+	unsigned long value;
 	int length, ch;
 
 	value = 0;
-	while ((ch = next(lexer)) != '\'') {
-		if (length++ > sizeof(long))
-			fatalf("Character-literal too long");
+	length = 0;
+	next(lexer);
+	for (;;) {
+		if (lexer->position >= lexer->srclen) {
+			lexerror(lexer, "Unterminated character-literal");
+			break;
+		}
+		if ((ch = next(lexer)) == '\'')
+			break;
+		if (length++ == sizeof(long))
+			lexerror(lexer, "Character-literal too long");
+		if (ch & 0x80)
+			checkutf8(lexer, lexer->position - 1);
 		value = (value << 8) | (ch & 0xFF);
 	}
-	return create(lexer, T_CHARLIT, value);
+	create(lexer, T_CHARLIT, value);
 }
 
 /*
@@ -175,45 +565,48 @@ static void scanchar(struct lexer *lexer) {
  */
 static void scanstr(struct lexer *lexer) {
 	char *buffer;
-	int size, capacity, ch;
+	size_t size, capacity;
+	int ch;
 
-	size = 1;
-	capacity = 1;
-	buffer = calloc(1, sizeof(char));
-	while ((ch = next(lexer)) != '"') {
+	size = 0;
+	capacity = STRBUFSIZE;
+	buffer = allocate(lexer->alloc, capacity);
+	next(lexer);
+	for (;;) {
+		if (lexer->position >= lexer->srclen) {
+			lexerror(lexer, "Unterminated string-literal");
+			break;
+		}
+		if ((ch = next(lexer)) == '"')
+			break;
 		/*
-		 * We do not do not follow the traditional doubleing method
-		 * for dynamic arrays because it can be quite inefficient
-		 * for our use case. We instead increase the buffer by a
-		 * constant amount.
+		 * Growing by a constant amount would copy the buffer once per
+		 * few characters, making long literals quadratic. Doubling
+		 * keeps the copying linear in the literal's length.
 		 */
 		if (size + 1 >= capacity) {
-			capacity += BUFFER_DELTA;
-			buffer = realloc(buffer, capacity);
+			buffer = reallocate(lexer->alloc, buffer, capacity,
+			    capacity * 2);
+			capacity *= 2;
 		}
+		if (ch & 0x80)
+			checkutf8(lexer, lexer->position - 1);
 		buffer[size++] = ch;
 	}
-	buffer[size] = '\0';
-	return create(lexer, T_STRLIT, buffer);
+	/*
+	 * Like names, literals are interned, so that they outlive the
+	 * lexer's tokens.
+	 */
+	create(lexer, T_STRLIT, (long)internstr(buffer, size));
+	deallocate(lexer->alloc, buffer, capacity);
 }
 
 /*
- * Scan the next token.
+ * Scan an operator or punctuator.
  */
-static void scan(struct lexer *lexer) {
+static void scanop(struct lexer *lexer, int ch) {
 	struct tokenbind *tb;
-	int ch;
-
-	ch = lexer->source[lexer->position];
-	if (isalpha(ch))
-		return scaniden(lexer);
-	if (isdigit(ch))
-		return scanint(lexer);
 
-	if (ch == '"')
-		return scanstr(lexer);
-	if (ch == '\'')
-		return scanchar(lexer);
 	/*
 	 * Though this might be very inefficient, I prefer this over a messy
 	 * and extremely long switch statement with nested conditionals for
@@ -222,17 +615,46 @@ static void scan(struct lexer *lexer) {
 	 * The only drawback is that this map needs to be sorted in terms
 	 * of token length (longest to shortest).
 	 */
-	if (!tokmapsorted) {
-		for (tb = &tokenmap[0]; tb < &tokenmap[NTOKEN]; tb++)
-			tb->strlen = strlen(tb->token);
-		qsort(tokenmap, NTOKEN, sizeof(struct tokenbind), cmpbind);
-		tokmapsorted = true;
-	}
+	pthread_once(&tokmapsorted, sorttokenmap);
 	for (tb = &tokenmap[0]; tb < &tokenmap[NTOKEN]; tb++) {
-		if (accept(lexer, tb->string))
-			return create(lexer, tb->token);
+		if (accept(lexer, tb->string)) {
+			create(lexer, tb->token, 0);
+			return;
+		}
 	}
-	fatalf("Invalid character %c", ch);
+	/*
+	 * Skip the character, so that lexing can go on if errors are being
+	 * collected.
+	 */
+	lexerror(lexer, "Invalid character '%c'", ch);
+	lexer->position++;
+}
+
+/*
+ * Scan the next token.
+ */
+static void scan(struct lexer *lexer) {
+	int ch;
+
+	skip(lexer);
+	lexer->start = lexer->position;
+	if (lexer->position >= lexer->srclen) {
+		create(lexer, T_EOF, 0);
+		return;
+	}
+	ch = (unsigned char)lexer->source[lexer->position];
+	if (isalpha(ch) || ch == '_')
+		scaniden(lexer);
+	else if (isdigit(ch))
+		scanint(lexer);
+	else if (ch >= 0x80)
+		scanutf8(lexer);
+	else if (ch == '"')
+		scanstr(lexer);
+	else if (ch == '\'')
+		scanchar(lexer);
+	else
+		scanop(lexer, ch);
 }
 
 /*
@@ -242,5 +664,105 @@ static void scan(struct lexer *lexer) {
 void lex(struct lexer *lexer) {
 	do {
 		scan(lexer);
-	} while (lexer->curr && lexer->curr->token != T_EOF);
+	} while (lexer->curr == NULL || lexer->curr->kind != T_EOF);
+}
+
+/*
+ * Scan only the next token and return it, for reading a source a token at
+ * a time rather than all at once.
+ */
+struct token *lexnext(struct lexer *lexer) {
+	struct token *last;
+
+	last = lexer->curr;
+	do {
+		scan(lexer);
+	} while (lexer->curr == last);
+	return lexer->curr;
+}
+
+/*
+ * Release the tokens lexed so far. Tokens from the lexer's own arena are
+ * released all at once, keeping the memory that held them for new ones.
+ * Tokens from a supplied allocator are handed back to it one by one, since
+ * it may be shared with others; they are found through `made` rather than
+ * the token-stream, which the preprocessor relinks.
+ */
+void lexrelease(struct lexer *lexer) {
+	int i;
+
+	if (lexer->alloc == NULL || lexer->alloc == &lexer->own)
+		arenareset(&lexer->arena);
+	for (i = 0; i < lexer->nmade; i++)
+		deallocate(lexer->alloc, lexer->made[i], sizeof(struct token));
+	lexer->nmade = 0;
+	lexer->head = NULL;
+	lexer->curr = NULL;
+}
+
+/*
+ * Release the tokens read so far from a source lexed a token at a time. The
+ * token the lexer is at, if it has scanned one that has not been read yet,
+ * is released too, and scanned again the next time one is asked for.
+ */
+void lexreleaseread(struct lexer *lexer) {
+	struct token *tok;
+
+	if ((tok = lexer->curr) != NULL) {
+		lexer->position = tok->offset;
+		lexer->line = tok->line;
+		lexer->bol = tok->bol;
+		lexer->space = tok->space;
+	}
+	lexrelease(lexer);
+}
+
+/*
+ * Free everything a lexer holds but its source, which belongs to whoever
+ * gave it.
+ */
+void lexfree(struct lexer *lexer) {
+	lexrelease(lexer);
+	if (lexer->made != NULL)
+		deallocate(lexer->alloc, lexer->made,
+		    lexer->capmade * sizeof(struct token *));
+	arenafree(&lexer->arena);
+	lexer->made = NULL;
+	lexer->capmade = 0;
+}
+
+/*
+ * Forget the tokens taken from a supplied allocator without handing them
+ * back, once whoever supplied it has reset it and they are gone anyway.
+ * The record of them went with them.
+ */
+void lexforget(struct lexer *lexer) {
+	if (lexer->alloc == NULL || lexer->alloc == &lexer->own)
+		return;
+	lexer->made = NULL;
+	lexer->nmade = 0;
+	lexer->capmade = 0;
+	lexer->head = NULL;
+	lexer->curr = NULL;
+}
+
+/*
+ * Prepare a lexer to lex a new source, releasing the tokens of the previous
+ * one. Tokens and literals come from `alloc` if it is set, and otherwise
+ * from the lexer's own arena. The source is checked to be valid UTF-8
+ * here, all at once, so that lexing need not check each character.
+ */
+void lexreset(struct lexer *lexer, char *source, int length) {
+	lexrelease(lexer);
+	lexer->source = source;
+	lexer->srclen = length;
+	lexer->position = 0;
+	lexer->line = 1;
+	lexer->bol = true;
+	lexer->space = false;
+	lexer->invalid = utf8valid(source, length);
+	if (lexer->alloc == NULL || lexer->alloc == &lexer->own) {
+		arenaallocator(&lexer->own, &lexer->arena);
+		lexer->alloc = &lexer->own;
+	}
 }
@@ -2,19 +2,54 @@
 #define _LEX_H_
 
 /*
- * How much the string-buffer increases by each time its capacity is met.
+ * Size the string-buffer starts out at. It doubles each time its capacity
+ * is met.
  */
-#define BUFFER_DELTA	10
+#define STRBUFSIZE	16
+
+/*
+ * Identifiers are reported and cut short once they reach this many bytes.
+ */
+#define MAXIDEN		256
+
+/*
+ * How many buckets the keyword table has. Must be a power of two, and more
+ * than there are keywords.
+ */
+#define NKEYBUCKET	128
 
 /*
  * One allocated per lexer.
  */
 struct lexer {
+	char *path;		/* path of source */
 	char *source;		/* content to lex */
+	int srclen;		/* length of source */
 	int position;		/* position in source */
+	int line;		/* line number of position */
+	int start;		/* position of token being scanned */
+	int bol;		/* at beginning of a line */
+	int space;		/* whitespace since last token */
+	int invalid;		/* position of first invalid UTF-8 left */
 	struct token *head;	/* head token */
 	struct token *curr;	/* current token */
+	struct arena arena;	/* tokens of current source */
+	struct allocator own;	/* allocates from arena */
+	struct allocator *alloc;/* tokens and literals, NULL for arena */
+	struct token **made;	/* tokens taken from a supplied alloc */
+	int nmade;		/* number of tokens taken */
+	int capmade;		/* capacity of made */
 	struct lexer *next;	/* next lexer in list */
 };
 
+void lex(struct lexer *lexer);
+struct token *lexnext(struct lexer *lexer);
+void lexreset(struct lexer *lexer, char *source, int length);
+void lexrelease(struct lexer *lexer);
+void lexreleaseread(struct lexer *lexer);
+void lexfree(struct lexer *lexer);
+void lexforget(struct lexer *lexer);
+int keyword(char *name);
+char *tokstr(int kind);
+
 #endif /* !_LEX_H_ */
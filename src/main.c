@@ -0,0 +1,145 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "token.h"
+#include "arena.h"
+#include "alloc.h"
+#include "error.h"
+#include "input.h"
+#include "lex.h"
+#include "cpp.h"
+#include "parse.h"
+#include "compile.h"
+#include "index.h"
+#include "server.h"
+
+/*
+ * How many files ahead of the one being compiled are read in the
+ * background.
+ */
+#define PREFETCHAHEAD	4
+
+static void usage(char *name) {
+	fprintf(stderr, "usage: %s [-HkS] [-I dir] [-s socket] [-x index] "
+	    "[file ...]\n", name);
+	exit(2);
+}
+
+/*
+ * Nothing is done with declarations beyond parsing them yet, so streamed
+ * ones are dropped.
+ */
+static void discard(struct tree *decl, void *sink) {
+}
+
+int main(int argc, char **argv) {
+	static struct cpp cpp;
+	struct parser parser;
+	struct diagbuf diags, *collect;
+	struct index index;
+	char *socket, *source, *indexpath;
+	int opt, i, length, status, result, stream, share;
+
+	socket = NULL;
+	indexpath = NULL;
+	stream = 0;
+	share = 0;
+	collect = NULL;
+	memset(&diags, 0, sizeof(diags));
+	while ((opt = getopt(argc, argv, "HkSI:s:x:")) != -1) {
+		switch (opt) {
+		case 'H':
+			/*
+			 * Preprocess and parse each header once for all the
+			 * files that include it the same way.
+			 */
+			share = 1;
+			break;
+		case 'k':
+			/*
+			 * Keep going after errors, so that all of a file's
+			 * errors are reported at once.
+			 */
+			collect = &diags;
+			break;
+		case 'S':
+			/*
+			 * Stream each file rather than keeping all of it,
+			 * for files too big to hold in memory at once.
+			 */
+			stream = 1;
+			break;
+		case 'I':
+			if (cpp.nincdir >= MAXINCDIR)
+				usage(argv[0]);
+			cppincdir(&cpp, optarg);
+			break;
+		case 's':
+			socket = optarg;
+			break;
+		case 'x':
+			/*
+			 * Write an index of where each name is declared and
+			 * used. Only the index is wanted, so the files are
+			 * streamed rather than kept.
+			 */
+			indexpath = optarg;
+			stream = 1;
+			break;
+		default:
+			usage(argv[0]);
+		}
+	}
+	if (socket != NULL)
+		return serve(socket, &cpp) < 0;
+	/*
+	 * The symbols of a shared header are not found again for every file
+	 * that includes it, so an index would be missing them.
+	 */
+	cpp.shareheaders = share && indexpath == NULL;
+
+	memset(&parser, 0, sizeof(parser));
+	memset(&index, 0, sizeof(index));
+	if (indexpath != NULL)
+		parser.index = &index;
+	status = 0;
+	/*
+	 * Keep the next few files being read while the current one is
+	 * compiled.
+	 */
+	for (i = optind; i < argc && i < optind + PREFETCHAHEAD; i++)
+		prefetch(&argv[i], 1, NULL);
+	for (i = optind; i < argc; i++) {
+		if (i + PREFETCHAHEAD < argc)
+			prefetch(&argv[i + PREFETCHAHEAD], 1, NULL);
+		if ((source = readfile(argv[i], &length)) == NULL) {
+			perror(argv[i]);
+			status = 1;
+			continue;
+		}
+		if (stream)
+			result = compilestream(&cpp, &parser, argv[i], source,
+			    length, collect, discard, NULL);
+		else
+			result = compile(&cpp, &parser, argv[i], source,
+			    length, collect);
+		if (result < 0) {
+			if (collect != NULL)
+				flusherrors(collect, stderr);
+			else
+				fprintf(stderr, "%s\n", lasterror());
+			status = 1;
+		}
+		free(source);
+	}
+	if (indexpath != NULL) {
+		if (writeindex(&index, indexpath) < 0) {
+			perror(indexpath);
+			status = 1;
+		}
+		indexfree(&index);
+	}
+	return status;
+}
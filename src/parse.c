@@ -1,40 +1,203 @@
+#include <limits.h>
+#include <setjmp.h>
+#include <stdarg.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
 #include "token.h"
+#include "type.h"
+#include "arena.h"
+#include "alloc.h"
+#include "error.h"
+#include "lex.h"
 #include "parse.h"
+#include "header.h"
 #include "tree.h"
-#include "lex.h"
+#include "index.h"
 
 /*
- * Store tokens in sub-arrays based on their precedences, and a NULL at the end
- * of each sub array in the levels of tokens to indicate the end, rather than
- * storing a separate array of the subarray's lengths.
- */	
-int *toklvls[] = {
-	{ T_LOR, NULL },
-	{ T_LAND, NULL },
-	{ T_OR, NULL },
-	{ T_XOR, NULL },
-	{ T_AND, NULL },
-	{ T_EQ, T_NE, NULL },
-	{ T_LT, T_GT, T_LE, T_GE, NULL },
-	{ T_LSHIFT, T_RSHIFT, NULL },
-	{ T_PLUS, T_MINUS, NULL },
-	{ T_STAR, T_SLASH, T_MOD, NULL },
+ * Precedence of each binary operator, from loosest to tightest binding.
+ * Other tokens have none. Looking an operator up by its kind costs the
+ * same however many levels of precedence there are.
+ */
+int tokprec[T_EOF + 1] = {
+	[T_LOR] = 1,
+	[T_LAND] = 2,
+	[T_BOR] = 3,
+	[T_BXOR] = 4,
+	[T_AMP] = 5,
+	[T_EQ] = 6, [T_NE] = 6,
+	[T_LT] = 7, [T_GT] = 7, [T_LE] = 7, [T_GE] = 7,
+	[T_BLSHIFT] = 8, [T_BRSHIFT] = 8,
+	[T_PLUS] = 9, [T_MINUS] = 9,
+	[T_STAR] = 10, [T_SLASH] = 10, [T_MODULO] = 10,
 };
 
 /*
- * Tokens and their corresponding nodes in the abstract-syntax-tree. Stored in
- * an array since token-kinds are already integers.
+ * Tokens for binary and assignment operators, and their corresponding nodes
+ * in the abstract-syntax-tree. Stored in an array since token-kinds are
+ * already integers.
  */
-int tokmap[] = {
-	[T_AND] = AST_AND,
-}
+int tokmap[T_EOF + 1] = {
+	[T_LOR] = AST_LOR,
+	[T_LAND] = AST_LAND,
+	[T_BOR] = AST_OR,
+	[T_BXOR] = AST_XOR,
+	[T_AMP] = AST_AND,
+	[T_EQ] = AST_EQ, [T_NE] = AST_NE,
+	[T_LT] = AST_LT, [T_GT] = AST_GT, [T_LE] = AST_LE, [T_GE] = AST_GE,
+	[T_BLSHIFT] = AST_LSHIFT, [T_BRSHIFT] = AST_RSHIFT,
+	[T_PLUS] = AST_ADD, [T_MINUS] = AST_SUB,
+	[T_STAR] = AST_MUL, [T_SLASH] = AST_DIV, [T_MODULO] = AST_MOD,
+	[T_ASSIGN] = AST_ASSIGN,
+	[T_STAREQ] = AST_MULASSIGN, [T_DIVEQ] = AST_DIVASSIGN,
+	[T_MODEQ] = AST_MODASSIGN, [T_PLUSEQ] = AST_ADDASSIGN,
+	[T_MINUSEQ] = AST_SUBASSIGN, [T_LSHIFTEQ] = AST_LSHIFTASSIGN,
+	[T_RSHIFTEQ] = AST_RSHIFTASSIGN, [T_ANDEQ] = AST_ANDASSIGN,
+	[T_OREQ] = AST_ORASSIGN, [T_XOREQ] = AST_XORASSIGN,
+};
+
+/*
+ * Tokens for prefix operators and their corresponding nodes. Kept apart
+ * from `tokmap`, since `&`, `*`, `+` and `-` mean something else as
+ * binary operators.
+ */
+int unarymap[T_EOF + 1] = {
+	[T_AMP] = AST_ADDR,
+	[T_STAR] = AST_DEREF,
+	[T_PLUS] = AST_POS,
+	[T_MINUS] = AST_NEG,
+	[T_TILDE] = AST_COMPL,
+	[T_NOT] = AST_LNOT,
+	[T_INC] = AST_PREINC,
+	[T_DEC] = AST_PREDEC,
+};
+
+/*
+ * Tokens that introduce a tagged type and the kind of type they name.
+ */
+int tagkinds[] = {
+	[T_STRUCT] = TY_STRUCT,
+	[T_UNION] = TY_UNION,
+	[T_ENUM] = TY_ENUM,
+};
+
+/*
+ * Tokens for unary operators.
+ */
+int unaryopers[] = {
+	T_AMP, T_STAR, T_PLUS, T_MINUS, T_TILDE, T_NOT, T_INC, T_DEC,
+};
 
 /*
  * Tokens for assignments.
  */
-int assigntoks[] = {
-	T_MULASSIGN, T_DIVASSIGN, T_MODASSIGN, T_ADDASIGN, T_SUBASSIGN,
-	T_LSHIFTASSIGN, T_RSHIFTASSIGN, T_ANDASSIGN, T_ORASSIGN, T_XORASSIGN,
+int assignopers[] = {
+	T_ASSIGN, T_STAREQ, T_DIVEQ, T_MODEQ, T_PLUSEQ, T_MINUSEQ,
+	T_LSHIFTEQ, T_RSHIFTEQ, T_ANDEQ, T_OREQ, T_XOREQ,
+};
+
+#define NUNARYOPER	(sizeof(unaryopers) / sizeof(unaryopers[0]))
+#define NASSIGNOPER	(sizeof(assignopers) / sizeof(assignopers[0]))
+
+static struct type *declspec(struct parser *parser, int *sclass);
+static struct declarator declarator(struct parser *parser,
+    struct type *type);
+static bool startstypename(struct parser *parser, struct token *token);
+static struct type *trytypename(struct parser *parser);
+static struct tree *castexpr(struct parser *parser);
+static struct tree *condexpr(struct parser *parser);
+static struct tree *assignexpr(struct parser *parser);
+static struct tree *expr(struct parser *parser);
+static struct tree *declaration(struct parser *parser, bool external);
+static struct tree *stmt(struct parser *parser);
+static struct tree *compoundstmt(struct parser *parser);
+
+/*
+ * Read the next token from the parser's stream and link it after the last
+ * one read.
+ */
+static struct token *pull(struct parser *parser) {
+	struct token *token;
+
+	token = parser->stream->read(parser->stream->src);
+	token->next = NULL;
+	if (parser->last != NULL)
+		parser->last->next = token;
+	parser->last = token;
+	return token;
+}
+
+/*
+ * Gets the next token in the parser's internal token-queue. When streaming,
+ * the token is only read once it is asked for.
+ */
+static struct token *peek(struct parser *parser) {
+	if (parser->token == NULL)
+		parser->token = pull(parser);
+	return parser->token;
+}
+
+/*
+ * Get the token after the given one, reading it if need be.
+ */
+static struct token *following(struct parser *parser, struct token *token) {
+	if (token->next == NULL && token->kind != T_EOF
+	    && parser->stream != NULL)
+		return pull(parser);
+	return token->next;
+}
+
+/*
+ * Gets the nth token in the parser's internal token-queue, and NULL if not
+ * existent. Walks the list, so it is only meant for a token or two of
+ * lookahead.
+ */
+static struct token *peekn(struct parser *parser, int position) {
+	struct token *token;
+
+	token = peek(parser);
+	while (--position && token != NULL)
+		token = following(parser, token);
+	return token;
+}
+
+/*
+ * Move on to the next token. The parser stays on the end-of-file token once
+ * it reaches it. When streaming, the token after the last one read is left
+ * unread until it is needed.
+ */
+static void advance(struct parser *parser) {
+	struct token *token;
+
+	token = peek(parser);
+	if (token->kind != T_EOF)
+		parser->token = token->next;
+}
+
+/*
+ * Report a syntax error at a token. When errors are being collected, it is
+ * recorded and parsing picks up again at the parser's recovery point;
+ * otherwise it is fatal. While speculating, the error is not reported, and
+ * only sends the parser back to where the guess was made.
+ */
+static void syntaxerror(struct parser *parser, struct token *token,
+    char *fmt, ...) {
+	char message[MAXERROR];
+	va_list args;
+
+	if (parser->speculating)
+		longjmp(*parser->recover, 1);
+	va_start(args, fmt);
+	vsnprintf(message, sizeof(message), fmt, args);
+	va_end(args);
+	errorf("%s:%d: %s", token->path ? token->path : "<input>",
+	    token->line, message);
+	if (parser->recover == NULL)
+		fatalf("%s", message);
+	longjmp(*parser->recover, 1);
 }
 
 /*
@@ -43,8 +206,8 @@ int assigntoks[] = {
 static struct token *accept(struct parser *parser, int kind) {
 	struct token *token;
 
-	token = parser->token;
-	if (token && token->kind == kind) {
+	token = peek(parser);
+	if (token->kind == kind) {
 		advance(parser);
 		return token;
 	}
@@ -57,46 +220,114 @@ static struct token *accept(struct parser *parser, int kind) {
 static struct token *expect(struct parser *parser, int kind) {
 	struct token *token;
 
-	token = parser->token;
-	if (token == NULL || token->kind != kind)
-		/*
-		 * TODO: Can we really rely on the fact that the last token
-		 * will be an EOF token when access the current token's kind
-		 * (it can still be NULL)
-		 */
-		fatalf(
+	token = peek(parser);
+	if (token->kind != kind)
+		syntaxerror(
+			parser,
+			token,
 			"Expected %s, got %s",
 			tokstr(kind),
 			tokstr(token->kind)
 		);
+	advance(parser);
 	return token;
 }
 
 /*
- * Gets the next token in the parser's internal token-queue.
+ * Enter a nested expression or declarator, failing if that goes deeper
+ * than MAXNESTING.
  */
-static struct token *peek(struct parser *parser) {
-	return parser->token;
+static void nest(struct parser *parser) {
+	if (++parser->depth > MAXNESTING)
+		syntaxerror(parser, peek(parser), "Nesting too deep");
 }
 
 /*
- * Gets the nth token in the parser's internal token-queue, and NULL if not
- * existent.
+ * Leave a nested expression or declarator.
  */
-static struct token *peekn(struct parser *parser, int position) {
-	struct token *token;
+static void unnest(struct parser *parser) {
+	parser->depth--;
+}
 
-	token = parser->token;
-	while (--position && token != NULL)
-		token = token->next;
-	return token;
+/*
+ * Hand every node taken from a supplied allocator back to it, including
+ * those kept to be made again.
+ */
+static void releasenodes(struct parser *parser) {
+	while (parser->nheld > 0)
+		deallocate(parser->supplied, parser->made[--parser->nheld],
+		    sizeof(struct tree));
+	parser->nmade = 0;
 }
 
 /*
- * Parse a generic selection.
- *
- * general-selection:
- *   generic ( assignment-expression , generic-association-list )
+ * Release the nodes made since a mark, once nothing is left pointing to
+ * them. Anything parsed only to be checked, and not kept in the tree, must
+ * be dropped, so that `sweep` visits only the nodes of the tree. `nmade` is
+ * how many nodes had been taken from a supplied allocator at the mark;
+ * those taken since are kept to be made again rather than handed back, so
+ * this takes the same time however many there were.
+ */
+static void dropnodes(struct parser *parser, struct arenamark *mark,
+    int nmade) {
+	if (parser->alloc == &parser->own)
+		rewindarena(&parser->nodes, mark);
+	else
+		parser->nmade = nmade;
+}
+
+/*
+ * Get the precedence of a token as a binary operator, or 0 if it is not
+ * one.
+ */
+static int precedence(struct token *token) {
+	if (token->kind < 0 || token->kind > T_EOF)
+		return 0;
+	return tokprec[token->kind];
+}
+
+/*
+ * Make a node for a single token, such as a name or a literal.
+ */
+static struct tree *leaf(struct parser *parser, int kind,
+    struct token *token) {
+	struct tree *node;
+
+	node = mkastnode(parser->alloc, kind, NULL, NULL, NULL);
+	node->token = token;
+	return node;
+}
+
+/*
+ * Consume the current token if it is one of the given kinds, and return it.
+ * Otherwise return NULL.
+ */
+static struct token *acceptany(struct parser *parser, int *kinds,
+    int count) {
+	int i;
+
+	for (i = 0; i < count; i++) {
+		if (peek(parser)->kind == kinds[i])
+			return accept(parser, kinds[i]);
+	}
+	return NULL;
+}
+
+/*
+ * Parse a type-name that is not in parentheses. The declarator must be
+ * abstract.
+ */
+static struct type *typename(struct parser *parser) {
+	struct declarator decl;
+
+	decl = declarator(parser, declspec(parser, NULL));
+	if (decl.name != NULL)
+		syntaxerror(parser, decl.name, "Named type-name");
+	return decl.type;
+}
+
+/*
+ * Parse the associations of a generic selection.
  *
  * generic-association-list:
  *   generic-association
@@ -106,14 +337,148 @@ static struct token *peekn(struct parser *parser, int position) {
  *   type-name : assignment-expression
  *   default : assignment-expression
  */
+static struct tree *genassoclist(struct parser *parser) {
+	struct tree *list, *assoc;
+	struct type *type;
+
+	list = NULL;
+	do {
+		type = NULL;
+		if (!accept(parser, T_DEFAULT))
+			type = typename(parser);
+		expect(parser, T_COLON);
+		assoc = mkastunary(parser->alloc, AST_GENERICASSOC,
+		    assignexpr(parser));
+		assoc->type = type;
+		list = mkastbinary(parser->alloc, AST_GLUE, list, assoc);
+	} while (accept(parser, T_COMMA));
+	return list;
+}
+
+/*
+ * Parse a generic selection.
+ *
+ * general-selection:
+ *   generic ( assignment-expression , generic-association-list )
+ */
 static struct tree *gensel(struct parser *parser) {
-	struct tree *selector, assoclist;
+	struct tree *selector, *assoclist;
 
 	expect(parser, T_GENERIC);
+	expect(parser, T_LPAREN);
+	selector = assignexpr(parser);
+	expect(parser, T_COMMA);
+	assoclist = genassoclist(parser);
+	expect(parser, T_RPAREN);
+	return mkastbinary(parser->alloc, AST_GENERICSEL, selector, assoclist);
+}
+
+/*
+ * Parse an initializer.
+ *
+ * initializer:
+ *   assignment-expression
+ *   { initializer-list }
+ *   { initializer-list , }
+ *
+ * initializer-list:
+ *   designation initializer
+ *   initializer
+ *   initializer-list , designation initializer
+ *   initializer-list , initializer
+ *
+ * designation:
+ *   designator-list =
+ *
+ * designator:
+ *   [ constant-expression ]
+ *   . identifier
+ */
+static struct tree *initializer(struct parser *parser) {
+	struct tree *list, *designators, *item, *node;
+	struct token *name;
+
+	if (!accept(parser, T_LBRACE))
+		return assignexpr(parser);
+	nest(parser);
+	list = NULL;
+	while (!accept(parser, T_RBRACE)) {
+		designators = NULL;
+		for (;;) {
+			if (accept(parser, T_LBRACKET)) {
+				node = mkastunary(parser->alloc,
+				    AST_INDEXDESIG, condexpr(parser));
+				expect(parser, T_RBRACKET);
+			} else if (accept(parser, T_DOT)) {
+				name = expect(parser, T_NAME);
+				node = leaf(parser, AST_FIELDDESIG, name);
+			} else
+				break;
+			designators = mkastbinary(parser->alloc, AST_GLUE,
+			    designators, node);
+		}
+		if (designators != NULL)
+			expect(parser, T_ASSIGN);
+		item = initializer(parser);
+		if (designators != NULL)
+			item = mkastbinary(parser->alloc, AST_DESIGNATION,
+			    designators, item);
+		list = mkastbinary(parser->alloc, AST_GLUE, list, item);
+		if (!accept(parser, T_COMMA)) {
+			expect(parser, T_RBRACE);
+			break;
+		}
+	}
+	unnest(parser);
+	return mkastunary(parser->alloc, AST_INITLIST, list);
+}
+
+/*
+ * Parse a primary expression.
+ *
+ * primary-expression:
+ *   identifier
+ *   constant
+ *   string-literal
+ *   ( expression )
+ *   generic-selection
+ */
+static struct tree *primaryexpr(struct parser *parser) {
+	struct tree *node;
+	struct token *token;
+
+	token = peek(parser);
+	switch (token->kind) {
+	case T_NAME:
+		advance(parser);
+		if (parser->index != NULL)
+			indexsym(parser->index, token, IX_REF);
+		return leaf(parser, AST_NAME, token);
+	case T_INTLIT:
+	case T_CHARLIT:
+		advance(parser);
+		return leaf(parser, AST_NUM, token);
+	case T_STRLIT:
+		advance(parser);
+		return leaf(parser, AST_STRLIT, token);
+	case T_GENERIC:
+		return gensel(parser);
+	case T_LPAREN:
+		advance(parser);
+		nest(parser);
+		node = expr(parser);
+		expect(parser, T_RPAREN);
+		unnest(parser);
+		return node;
+	}
+	syntaxerror(parser, token, "Expected expression, got %s",
+	    tokstr(token->kind));
+	return NULL;
 }
 
 /*
- * Parse a postfix expression.
+ * Parse a postfix expression. A parenthesized type-name followed by a brace
+ * starts a compound literal rather than a cast.
  *
  * postfix-expression:
  *   primary-expression
@@ -130,27 +495,54 @@ static struct tree *gensel(struct parser *parser) {
  * argument-expression-list:
  *   argument-expression
  *   argument-expression-list , argument-expression
- *
- * primary-expression:
- *   identifier
- *   constant
- *   string-literal
- *   ( expression )
- *   generic-selection
  */
-static tree *postfixexpr(struct parser *parser) {
-	struct tree *genexpr, *assoclist;
-	struct tree *atom;
+static struct tree *postfixexpr(struct parser *parser) {
+	struct tree *node, *args;
+	struct checkpoint cp;
+	struct token *token;
+	struct type *type;
 
-	if ((atom = accept(parser, T_NAME)) != NULL) {
-		
+	node = NULL;
+	if (peek(parser)->kind == T_LPAREN
+	    && startstypename(parser, following(parser, peek(parser)))) {
+		checkpoint(parser, &cp);
+		type = trytypename(parser);
+		if (type != NULL && peek(parser)->kind == T_LBRACE) {
+			node = mkastunary(parser->alloc, AST_COMPOUNDLIT,
+			    initializer(parser));
+			node->type = type;
+		} else
+			rollback(parser, &cp);
 	}
-	if (accept(parser, T_GENERIC)) {
-		expect(parser, T_LPAREN);
-		genexpr = assignexpr(parser);
-		expect(parser, T_COMMA);
-		assoclist = genassoclist(parser);
-		return mkastbinary(AST_GENERICSEL, genexpr, assoclist);
+	if (node == NULL)
+		node = primaryexpr(parser);
+	for (;;) {
+		token = peek(parser);
+		if (accept(parser, T_LBRACKET)) {
+			node = mkastbinary(parser->alloc, AST_INDEX, node,
+			    expr(parser));
+			expect(parser, T_RBRACKET);
+		} else if (accept(parser, T_LPAREN)) {
+			args = NULL;
+			while (!accept(parser, T_RPAREN)) {
+				if (args != NULL)
+					expect(parser, T_COMMA);
+				args = mkastbinary(parser->alloc, AST_GLUE,
+				    args, assignexpr(parser));
+			}
+			node = mkastbinary(parser->alloc, AST_CALL, node,
+			    args);
+		} else if (accept(parser, T_DOT)
+		    || accept(parser, T_ARROW)) {
+			node = mkastunary(parser->alloc, token->kind == T_DOT
+			    ? AST_MEMBER : AST_PTRMEMBER, node);
+			node->token = expect(parser, T_NAME);
+		} else if (accept(parser, T_INC))
+			node = mkastunary(parser->alloc, AST_POSTINC, node);
+		else if (accept(parser, T_DEC))
+			node = mkastunary(parser->alloc, AST_POSTDEC, node);
+		else
+			return node;
 	}
 }
 
@@ -163,8 +555,8 @@ static tree *postfixexpr(struct parser *parser) {
  *   -- unary-expression
  *   unary-operator cast-expression
  *   sizeof unary-expression
- *   sizeof ( unary-expression )
- *   alignof ( unary-expression )
+ *   sizeof ( type-name )
+ *   alignof ( type-name )
  *
  * unary-operator:
  *   &
@@ -173,60 +565,111 @@ static tree *postfixexpr(struct parser *parser) {
  *   -
  *   ~
  *   !
- *   ++
- *   --
  */
 static struct tree *unaryexpr(struct parser *parser) {
+	struct checkpoint cp;
 	struct token *token;
-	struct tree *child;
-	bool hasparen;
-	int *t;
-
-	if (accept(parser, T_SIZEOF)) {
-		hasparen = accept(parser, T_LPAREN) != NULL;
-		child = unaryexpr(parser);
-		if (hasparen)
-			expect(parser, T_RPAREN);
-		return mkastunary(AST_SIZEOF, child);
-	}
-	if (accept(parser, T_ALIGNOF)) {
+	struct tree *node;
+	struct type *type;
+
+	nest(parser);
+	if ((token = accept(parser, T_SIZEOF)) != NULL
+	    || (token = accept(parser, T_ALIGNOF)) != NULL) {
+		type = NULL;
+		if (peek(parser)->kind == T_LPAREN
+		    && startstypename(parser, following(parser,
+		    peek(parser)))) {
+			checkpoint(parser, &cp);
+			type = trytypename(parser);
+			if (type == NULL || peek(parser)->kind == T_LBRACE) {
+				rollback(parser, &cp);
+				type = NULL;
+			}
+		}
+		if (type == NULL && token->kind == T_ALIGNOF)
+			syntaxerror(parser, peek(parser),
+			    "Expected type-name");
+		node = mkastunary(parser->alloc, token->kind == T_SIZEOF
+		    ? AST_SIZEOF : AST_ALIGNOF,
+		    type == NULL ? unaryexpr(parser) : NULL);
+		node->type = type;
+	} else if ((token = acceptany(parser, unaryopers, NUNARYOPER))
+	    != NULL) {
+		node = mkastunary(parser->alloc, unarymap[token->kind],
+		    token->kind == T_INC || token->kind == T_DEC
+		    ? unaryexpr(parser) : castexpr(parser));
+		node->token = token;
+	} else
+		node = postfixexpr(parser);
+	unnest(parser);
+	return node;
+}
+
+/*
+ * Try to parse a parenthesized type-name, returning its type, or NULL if
+ * what follows is not one. On failure the parser is left wherever the
+ * attempt gave up, for the caller to roll back.
+ *
+ * type-name:
+ *   specifier-qualifier-list abstract-declarator
+ *   specifier-qualifier-list
+ */
+static struct type *trytypename(struct parser *parser) {
+	struct type *type;
+	jmp_buf env, *prev;
+
+	prev = parser->recover;
+	parser->recover = &env;
+	parser->speculating++;
+	if (setjmp(env))
+		type = NULL;
+	else {
 		expect(parser, T_LPAREN);
-		child = unaryexpr(parser);
+		type = typename(parser);
 		expect(parser, T_RPAREN);
-		return mkastunary(AST_ALIGNOF, child);
-	}
-	for (t = &unaryopers[0]; t < &unaryopers[sizeof(unaryopers)]; t++) {
-		if ((token = accept(*t)) != NULL)
-			break;
 	}
-	if (token == NULL || token->kind == T_EOF)
-		return postfixexpr(parser);
-	return mkastunary(tokmap[token->kind], unaryexpr(parser));
+	parser->speculating--;
+	parser->recover = prev;
+	return type;
 }
 
 /*
- * Parse a type-cast expression.
+ * Parse a type-cast expression. A parenthesis followed by something that
+ * can start a type-name is parsed as a type-name on speculation; if that
+ * fails, or turns out to begin a compound literal, the parser rolls back
+ * and parses a unary-expression instead.
  *
  * cast-expression:
  *   unary-expression
  *   ( type-name ) cast-expression
  *   ;
  */
-static struct token *castexpr(struct parser *parser) {
-	struct tree *right, *tn;
+static struct tree *castexpr(struct parser *parser) {
+	struct checkpoint cp;
+	struct tree *node;
+	struct type *type;
 
-	if (peek(parser) == T_LPAREN && startstn(parser, peekn(parser, 2))) {
-		tn = typename(parser);
+	if (peek(parser)->kind != T_LPAREN
+	    || !startstypename(parser, following(parser, peek(parser))))
+		return unaryexpr(parser);
+	checkpoint(parser, &cp);
+	type = trytypename(parser);
+	if (type == NULL || peek(parser)->kind == T_LBRACE) {
+		rollback(parser, &cp);
+		return unaryexpr(parser);
 	}
-	right = unaryexpr(parser);
-	if (tn != NULL)
-		right = mkastbinary(AST_CAST, right, tn);
-	return right;
+	nest(parser);
+	node = mkastunary(parser->alloc, AST_CAST, castexpr(parser));
+	node->type = type;
+	unnest(parser);
+	return node;
 }
 
 /*
- * Internal routine to parse binary operators in expressions. Calls itself 
- * with a depth counter to measure precedence level.
+ * Internal routine to parse binary operators in expressions, binding only
+ * operators of at least the given precedence. Operators of equal precedence
+ * are gathered by the loop and tighter ones by recursion, so each operand is
+ * parsed with one call however many precedence levels there are.
  *
  * logical-or-expression:
  *   logical-and-expression
@@ -284,25 +727,18 @@ static struct token *castexpr(struct parser *parser) {
  *   multiplicative-expression % cast-expression
  *   ;
  */
-static struct tree *innerexpr(struct parser *parser, int level) {
+static struct tree *innerexpr(struct parser *parser, int minprec) {
 	struct token *token;
 	struct tree *left;
-	int *t;
+	int prec;
 
-	if (level >= sizeof(levels))
-		return castexpr(parser);
-	left = innerexpr(level + 1);
-	if (peek(parser, T_EOF))
-		return left;
-	for (;;) {
-		token = NULL;
-		for (t = &toklvls[level][0]; t != NULL; t++) {
-			if ((token = accept(*t)) != NULL)
-				break;
-		}
-		if (token == NULL || token->kind == T_EOF)
-			break;
-		left = mkastbinary(tokmap[token->kind], left, innerexpr(level + 1));
+	left = castexpr(parser);
+	while ((prec = precedence(peek(parser))) >= minprec) {
+		token = peek(parser);
+		advance(parser);
+		left = mkastbinary(parser->alloc, tokmap[token->kind], left,
+		    innerexpr(parser, prec + 1));
+		left->token = token;
 	}
 	return left;
 }
@@ -315,42 +751,53 @@ static struct tree *innerexpr(struct parser *parser, int level) {
  *   logical-or-expression ? expression : conditional-expression
  *   ;
  */
-static struct token *condexpr(struct parser *parser) {
+static struct tree *condexpr(struct parser *parser) {
 	struct tree *left, *truexpr;
 
-	left = innerexpr(0);
-	if (accept(T_QUESTIONMARK)) {
+	left = innerexpr(parser, 1);
+	if (accept(parser, T_QUESTIONMARK)) {
+		nest(parser);
 		truexpr = expr(parser);
-		expect(T_COLON);
-		left = mkastnode(AST_COND, left, truexpr, condexpr(parser));
+		expect(parser, T_COLON);
+		left = mkastnode(parser->alloc, AST_COND, left, truexpr,
+		    condexpr(parser));
+		unnest(parser);
 	}
 	return left;
 }
 
 /*
- * Parse an assignment expression.
+ * Parse a constant expression. Whether it is constant is not checked here.
+ *
+ * constant-expression:
+ *   conditional-expression
+ */
+static struct tree *constexpr(struct parser *parser) {
+	return condexpr(parser);
+}
+
+/*
+ * Parse an assignment expression. The left side is parsed as a
+ * conditional-expression, which a unary-expression is a kind of; whether
+ * it can be assigned to is left for later.
  *
  * assignment-expression:
  *   conditional-expression
  *   unary-expression assignment-operator assignment-expression
  */
-static struct token *assignexpr(struct parser *parser) {
+static struct tree *assignexpr(struct parser *parser) {
 	struct token *token;
 	struct tree *left;
-	int *t;
 
-	/*
-	 * TODO: This is the same code that is used in the `innerexpr`
-	 * subroutine, which is a code smell.
-	 */
-	left = unaryexpr(parser);
-	for (t = &assignopers[0]; t < &assignopers[sizeof(assignopers)]; t++) {
-		if ((token = accept(*t)) != NULL)
-			break;
-	}
-	if (token == NULL || token->kind == T_EOF)
+	left = condexpr(parser);
+	if ((token = acceptany(parser, assignopers, NASSIGNOPER)) == NULL)
 		return left;
-	return mkastbinary(tokmap[token->kind], left, assignexpr(parser));
+	nest(parser);
+	left = mkastbinary(parser->alloc, tokmap[token->kind], left,
+	    assignexpr(parser));
+	left->token = token;
+	unnest(parser);
+	return left;
 }
 
 /*
@@ -361,118 +808,922 @@ static struct token *assignexpr(struct parser *parser) {
  *   expression, assignment-expression
  *   ;
  */
-static struct token *expr(struct parser *parser) {
+static struct tree *expr(struct parser *parser) {
 	struct tree *left;
 
-	left = assignmentexpr(parser);
+	left = assignexpr(parser);
 	while (accept(parser, T_COMMA)) {
 		left = mkastbinary(
+			parser->alloc,
 			AST_COMPOUNDEXPR,
 			left,
-			assignmentexpr(parser)
+			assignexpr(parser)
 		);
 	}
 	return left;
 }
 
 /*
- * Parse a direct-declarator.
- *
- * direct-declarator:
- *   identifier
- *   ( declarator )
- *   direct-declarator [ ]
- *   direct-declarator [ number ]
- *   direct-declarator [ static type-qualifier-list assignment-expression ]
- *   direct-declarator [ static assignment-expression ]
- *   direct-declarator [ type-qualifier-list number ]
- *   direct-declarator [ type-qualifier-list static assignment-expression ]
- *   direct-declarator [ type-qualifier-list ]
- *   direct-declarator [ assignment-expression ]
- *   direct-declarator ( parameter-type-list )
- *   direct-declarator ( )
- *   direct-declarator ( identifier-list )
+ * Add a name to a symbol-table, or update its type if it is already there,
+ * and return its entry. Names are interned, so they are hashed and compared
+ * by address.
  */
-static struct tree *directdeclarator(struct parser *parser) {
-	if (peek(parser, T_NAME)) {
-		
-	}
-	if (accept(parser, T_LPAREN)) {
-		struct declarator *inner = declarator(parser);
-		expect(parser, T_RPAREN);
+static struct symbol *addsym(struct symtab *tab, char *name,
+    struct type *type) {
+	struct symbol *old;
+	int i, size;
+
+	if (tab->count * 2 >= tab->size) {
+		old = tab->syms;
+		size = tab->size;
+		tab->size = size ? size * 2 : NSYMBUCKET;
+		tab->syms = calloc(tab->size, sizeof(struct symbol));
+		tab->count = 0;
+		for (i = 0; i < size; i++) {
+			if (old[i].name != NULL)
+				addsym(tab, old[i].name, old[i].type)->scope =
+				    old[i].scope;
+		}
+		free(old);
 	}
+	i = ((unsigned long)name >> 4) & (tab->size - 1);
+	while (tab->syms[i].name != NULL && tab->syms[i].name != name)
+		i = (i + 1) & (tab->size - 1);
+	if (tab->syms[i].name == NULL)
+		tab->count++;
+	tab->syms[i].name = name;
+	tab->syms[i].type = type;
+	tab->syms[i].scope = 0;
+	return &tab->syms[i];
 }
 
 /*
- * Parse a declarator.
- *
- * declarator:
- *   pointer direct-declarator
- *   direct-declarator
- *
+ * Find the entry of a name in a symbol-table, or NULL if it is not there.
  */
-static struct declarator *declarator(struct parser *parser) {
-	if (accept(parser, T_STAR)) {
-		struct declarator *inner;
-		if ((inner = declarator(parser)) != NULL)
-			return mkptrdeclarator(inner);
+static struct symbol *lookupsym(struct symtab *tab, char *name) {
+	int i;
+
+	if (tab->size == 0)
+		return NULL;
+	i = ((unsigned long)name >> 4) & (tab->size - 1);
+	while (tab->syms[i].name != NULL) {
+		if (tab->syms[i].name == name)
+			return &tab->syms[i];
+		i = (i + 1) & (tab->size - 1);
 	}
-	return directdeclarator(parser);
+	return NULL;
 }
 
 /*
- * Parse a declaration.
- *
- * declaration:
- *   declaration-specifiers ;
- *   declaration-specifiers init-declarator-list ;
- *   static_assert-declaration
- *   ;
- *
- * declaration-list:
- *   declaration
- *   declaration-list declaration
+ * Find the type of a name in a symbol-table, or NULL if it is not there.
  */
-static struct tree *declaration(struct parser *parser) {
-	struct tree *toassert, *errmsg;
+static struct type *findsym(struct symtab *tab, char *name) {
+	struct symbol *sym;
 
-	if (accept(parser, T_STATICASSERT)) {
-		expect(parser, T_LPAREN);
-		toassert = constexpr(parser);
-		expect(parser, T_COMMA);
-		errmsg = expect(parser, T_STRING);
-		expect(parser, T_RPAREN);
-		expect(parser, T_SEMI);
-		return mkastbinary(AST_STATICASSERT, toassert, errmsg);
+	return (sym = lookupsym(tab, name)) != NULL ? sym->type : NULL;
+}
+
+/*
+ * Find the type a typedef-name stands for, or NULL if the name is not a
+ * typedef-name. Names declared by the translation unit itself are checked
+ * before those of imported headers. A header being parsed for the store
+ * records lookups that reach past what it declared or imported itself.
+ */
+static struct type *lookuptypedef(struct parser *parser, char *name) {
+	struct type *type;
+	int i;
+
+	if ((type = findsym(&parser->typedefs, name)) != NULL)
+		return type;
+	for (i = parser->nimport - 1; i >= 0; i--) {
+		if ((type = findsym(parser->imports[i], name)) != NULL)
+			break;
 	}
+	if (parser->deps != NULL && i < parser->ncontext)
+		adddep(parser->deps, DEP_TYPEDEF, name, (unsigned long)type);
+	return type;
 }
 
 /*
- * Parse an if statement with a possible else case.
- *
- * if-statement:
- *   if ( expression ) statement
- *   if ( expression ) statement else statement
+ * Return true if the token can start a declarator nested in parentheses,
+ * rather than a parameter list.
  */
-static struct tree *ifstmt(struct parser *parser) {
-	struct tree *cond;
-	struct tree *thenbody, *elsebody;
+static bool startsdecl(struct token *token) {
+	return token != NULL && (token->kind == T_STAR
+	    || token->kind == T_LPAREN || token->kind == T_NAME);
+}
 
-	expect(parser, T_IF);
-	expect(parser, T_LPAREN);
-	cond = expr(parser);
-	expect(parser, T_RPAREN);
-	thenbody = stmt(parser);
-	if (accept(parser, T_ELSE))
-		elsebody = stmt(parser);
-	return mkastnode(AST_IFSTMT, cond, thenbody, elsebody);
+/*
+ * Return true if a token can start a type-name.
+ */
+static bool startstypename(struct parser *parser, struct token *token) {
+	switch (token->kind) {
+	case T_STRUCT: case T_UNION: case T_ENUM:
+	case T_VOID: case T_BOOL: case T_CHAR: case T_SHORT: case T_INT:
+	case T_LONG: case T_FLOAT: case T_DOUBLE: case T_SIGNED:
+	case T_UNSIGNED: case T_CONST: case T_VOLATILE: case T_RESTRICT:
+	case T_ATOMIC:
+		return true;
+	case T_NAME:
+		return lookuptypedef(parser, (char *)token->value) != NULL;
+	}
+	return false;
 }
 
 /*
- * Parse a while statement.
+ * Parse a list of type qualifiers and return them as a bit-set.
  *
- * while-statement:
- *   while ( expression ) statement
+ * type-qualifier-list:
+ *   type-qualifier
+ *   type-qualifier-list type-qualifier
+ *
+ * type-qualifier:
+ *   const
+ *   restrict
+ *   volatile
+ *   _Atomic
+ */
+static int typequals(struct parser *parser) {
+	int quals;
+
+	quals = 0;
+	for (;;) {
+		if (accept(parser, T_CONST))
+			quals |= TQ_CONST;
+		else if (accept(parser, T_RESTRICT))
+			quals |= TQ_RESTRICT;
+		else if (accept(parser, T_VOLATILE))
+			quals |= TQ_VOLATILE;
+		else if (accept(parser, T_ATOMIC))
+			quals |= TQ_ATOMIC;
+		else
+			return quals;
+	}
+}
+
+/*
+ * Parse the members of a struct or union, or the enumerators of an enum,
+ * after the opening brace. Types only know their tags, so members are
+ * checked, indexed and then dropped, along with the nodes made for
+ * bit-field widths and enumerator values.
+ *
+ * struct-declaration:
+ *   specifier-qualifier-list struct-declarator-list ;
+ *   specifier-qualifier-list ;
+ *   static_assert-declaration
+ *
+ * struct-declarator:
+ *   declarator
+ *   declarator : constant-expression
+ *   : constant-expression
+ *
+ * enumerator:
+ *   identifier
+ *   identifier = constant-expression
+ */
+static void tagbody(struct parser *parser, int kind) {
+	struct declarator decl;
+	struct arenamark mark;
+	struct token *name;
+	struct type *base;
+	int nmade;
+
+	markarena(&parser->nodes, &mark);
+	nmade = parser->nmade;
+	nest(parser);
+	while (!accept(parser, T_RBRACE)) {
+		if (kind == TY_ENUM) {
+			name = expect(parser, T_NAME);
+			if (parser->index != NULL)
+				indexsym(parser->index, name, IX_ENUMCONST);
+			if (accept(parser, T_ASSIGN))
+				constexpr(parser);
+			if (!accept(parser, T_COMMA)) {
+				expect(parser, T_RBRACE);
+				break;
+			}
+			continue;
+		}
+		if (peek(parser)->kind == T_STATICASSERT) {
+			declaration(parser, false);
+			continue;
+		}
+		base = declspec(parser, NULL);
+		if (accept(parser, T_SEMI))
+			continue;
+		do {
+			if (peek(parser)->kind != T_COLON) {
+				decl = declarator(parser, base);
+				if (parser->index != NULL && decl.name != NULL)
+					indexsym(parser->index, decl.name,
+					    IX_MEMBER);
+			}
+			if (accept(parser, T_COLON))
+				constexpr(parser);
+		} while (accept(parser, T_COMMA));
+		expect(parser, T_SEMI);
+	}
+	unnest(parser);
+	dropnodes(parser, &mark, nmade);
+}
+
+/*
+ * Put back the block-scope tags replaced since the `keep`th, as when the
+ * blocks they were declared in are left.
+ */
+static void unshadow(struct parser *parser, int keep) {
+	struct symbol *old;
+
+	while (parser->nshadowed > keep) {
+		old = &parser->shadowed[--parser->nshadowed];
+		addsym(&parser->tags, old->name, old->type)->scope =
+		    old->scope;
+	}
+}
+
+/*
+ * Get the type a tag names. A tag being declared in a block, by a body or
+ * by `struct tag;`, is a new type unless the block already declared it,
+ * and hides any type of the same tag outside the block until the block is
+ * left. Otherwise the innermost declaration visible is used, and a tag
+ * that no block declared is the one of file scope.
+ */
+static struct type *tagtype(struct parser *parser, int kind, char *tag,
+    bool declaring) {
+	struct symbol *sym, *old;
+	struct type *type;
+
+	sym = lookupsym(&parser->tags, tag);
+	if (sym != NULL && sym->type != NULL && sym->type->kind == kind
+	    && (!declaring || sym->scope == parser->scope))
+		return sym->type;
+	if (!declaring || parser->scope == 0)
+		return mktagtype(kind, tag);
+	if (parser->nshadowed == parser->capshadowed) {
+		parser->capshadowed = parser->capshadowed
+		    ? parser->capshadowed * 2 : 16;
+		parser->shadowed = realloc(parser->shadowed,
+		    parser->capshadowed * sizeof(struct symbol));
+	}
+	old = &parser->shadowed[parser->nshadowed++];
+	old->name = tag;
+	old->type = sym != NULL ? sym->type : NULL;
+	old->scope = sym != NULL ? sym->scope : 0;
+	type = mkscopedtag(kind, tag);
+	addsym(&parser->tags, tag, type)->scope = parser->scope;
+	return type;
+}
+
+/*
+ * Parse a struct, union or enum specifier and return its type. Types are
+ * told apart by their tags, and by the block a tag was declared in; a type
+ * with no tag is distinct from every other. The type is known before its
+ * body is parsed, so that members can refer to it. A tag is defined, and
+ * indexed, where its body is.
+ *
+ * struct-or-union-specifier:
+ *   struct-or-union identifier { struct-declaration-list }
+ *   struct-or-union { struct-declaration-list }
+ *   struct-or-union identifier
+ *
+ * enum-specifier:
+ *   enum identifier { enumerator-list }
+ *   enum { enumerator-list }
+ *   enum identifier
+ */
+static struct type *tagspec(struct parser *parser) {
+	struct token *tag;
+	struct type *type;
+	int kind;
+
+	kind = tagkinds[peek(parser)->kind];
+	advance(parser);
+	tag = accept(parser, T_NAME);
+	if (tag == NULL && peek(parser)->kind != T_LBRACE)
+		syntaxerror(parser, peek(parser), "Expected tag or {, got %s",
+		    tokstr(peek(parser)->kind));
+	if (tag == NULL)
+		type = mkscopedtag(kind, NULL);
+	else
+		type = tagtype(parser, kind, (char *)tag->value,
+		    peek(parser)->kind == T_LBRACE
+		    || peek(parser)->kind == T_SEMI);
+	if (accept(parser, T_LBRACE)) {
+		if (tag != NULL && parser->index != NULL)
+			indexsym(parser->index, tag, IX_TAG);
+		tagbody(parser, kind);
+	}
+	return type;
+}
+
+/*
+ * Type specifiers seen by `declspec`, counted in fields of an int, so that
+ * every valid combination of them is a single value. `long` has room to be
+ * counted twice.
+ */
+#define SP_VOID		(1 << 0)
+#define SP_BOOL		(1 << 2)
+#define SP_CHAR		(1 << 4)
+#define SP_SHORT	(1 << 6)
+#define SP_INT		(1 << 8)
+#define SP_LONG		(1 << 10)
+#define SP_FLOAT	(1 << 12)
+#define SP_DOUBLE	(1 << 14)
+#define SP_SIGNED	(1 << 16)
+#define SP_UNSIGNED	(1 << 18)
+#define SP_OTHER	(1 << 20)
+
+/*
+ * Get the kind of type that a combination of type specifiers names, or -1 if
+ * they do not go together. No specifiers at all means `int`.
+ */
+static int speckind(int spec) {
+	switch (spec) {
+	case SP_VOID:
+		return TY_VOID;
+	case SP_BOOL:
+		return TY_BOOL;
+	case SP_CHAR:
+		return TY_CHAR;
+	case SP_SIGNED + SP_CHAR:
+		return TY_SCHAR;
+	case SP_UNSIGNED + SP_CHAR:
+		return TY_UCHAR;
+	case SP_SHORT:
+	case SP_SHORT + SP_INT:
+	case SP_SIGNED + SP_SHORT:
+	case SP_SIGNED + SP_SHORT + SP_INT:
+		return TY_SHORT;
+	case SP_UNSIGNED + SP_SHORT:
+	case SP_UNSIGNED + SP_SHORT + SP_INT:
+		return TY_USHORT;
+	case 0:
+	case SP_INT:
+	case SP_SIGNED:
+	case SP_SIGNED + SP_INT:
+		return TY_INT;
+	case SP_UNSIGNED:
+	case SP_UNSIGNED + SP_INT:
+		return TY_UINT;
+	case SP_LONG:
+	case SP_LONG + SP_INT:
+	case SP_SIGNED + SP_LONG:
+	case SP_SIGNED + SP_LONG + SP_INT:
+		return TY_LONG;
+	case SP_UNSIGNED + SP_LONG:
+	case SP_UNSIGNED + SP_LONG + SP_INT:
+		return TY_ULONG;
+	case SP_LONG + SP_LONG:
+	case SP_LONG + SP_LONG + SP_INT:
+	case SP_SIGNED + SP_LONG + SP_LONG:
+	case SP_SIGNED + SP_LONG + SP_LONG + SP_INT:
+		return TY_LLONG;
+	case SP_UNSIGNED + SP_LONG + SP_LONG:
+	case SP_UNSIGNED + SP_LONG + SP_LONG + SP_INT:
+		return TY_ULLONG;
+	case SP_FLOAT:
+		return TY_FLOAT;
+	case SP_DOUBLE:
+		return TY_DOUBLE;
+	case SP_LONG + SP_DOUBLE:
+		return TY_LDOUBLE;
+	}
+	return -1;
+}
+
+/*
+ * Parse declaration-specifiers and return the type they name. If `sclass` is
+ * not NULL, the storage-class specifier is stored in it, or 0 if there was
+ * none. A name is only taken as a typedef-name if no other type specifier
+ * has been seen, so that `typedef int T; long T;` declares T.
+ *
+ * declaration-specifiers:
+ *   storage-class-specifier declaration-specifiers
+ *   type-specifier declaration-specifiers
+ *   type-qualifier declaration-specifiers
+ *   function-specifier declaration-specifiers
+ *   ;
+ */
+static struct type *declspec(struct parser *parser, int *sclass) {
+	struct token *token;
+	struct type *type;
+	int spec, quals, kind;
+
+	spec = 0;
+	quals = 0;
+	type = NULL;
+	if (sclass != NULL)
+		*sclass = 0;
+	for (;;) {
+		quals |= typequals(parser);
+		token = peek(parser);
+		switch (token->kind) {
+		case T_TYPEDEF: case T_STATIC: case T_EXTERN: case T_REGISTER:
+		case T_AUTO:
+			if (sclass != NULL && *sclass != 0)
+				syntaxerror(parser, token,
+				    "Multiple storage classes");
+			if (sclass != NULL)
+				*sclass = token->kind;
+			advance(parser);
+			continue;
+		case T_INLINE: case T_NORETURN: case T_THREADLOCAL:
+			advance(parser);
+			continue;
+		case T_VOID:
+			spec += SP_VOID;
+			break;
+		case T_BOOL:
+			spec += SP_BOOL;
+			break;
+		case T_CHAR:
+			spec += SP_CHAR;
+			break;
+		case T_SHORT:
+			spec += SP_SHORT;
+			break;
+		case T_INT:
+			spec += SP_INT;
+			break;
+		case T_LONG:
+			spec += SP_LONG;
+			break;
+		case T_FLOAT:
+			spec += SP_FLOAT;
+			break;
+		case T_DOUBLE:
+			spec += SP_DOUBLE;
+			break;
+		case T_SIGNED:
+			spec += SP_SIGNED;
+			break;
+		case T_UNSIGNED:
+			spec += SP_UNSIGNED;
+			break;
+		case T_STRUCT: case T_UNION: case T_ENUM:
+			if (spec != 0)
+				syntaxerror(parser, token,
+				    "Invalid type specifiers");
+			type = tagspec(parser);
+			spec = SP_OTHER;
+			continue;
+		case T_NAME:
+			if (spec == 0 && (type = lookuptypedef(parser,
+			    (char *)token->value)) != NULL) {
+				advance(parser);
+				spec = SP_OTHER;
+				continue;
+			}
+			/* FALLTHROUGH */
+		default:
+			if (spec == SP_OTHER)
+				return mkqualtype(type, quals);
+			if ((kind = speckind(spec)) < 0)
+				syntaxerror(parser, token,
+				    "Invalid type specifiers");
+			return mkqualtype(mkbasetype(kind), quals);
+		}
+		if (spec >= SP_OTHER)
+			syntaxerror(parser, token, "Invalid type specifiers");
+		advance(parser);
+	}
+}
+
+/*
+ * Adjust the type of a parameter: an array becomes a pointer to its
+ * elements, and a function a pointer to the function.
+ */
+static struct type *adjustparam(struct type *type) {
+	if (type->kind == TY_ARRAY)
+		return mkptrtype(mkqualtype(type->base, type->quals));
+	if (type->kind == TY_FUNC)
+		return mkptrtype(type);
+	return type;
+}
+
+/*
+ * Add a derivation to the parser's list of them, to be followed by `next`.
+ * Derivations are kept by index, since adding one may move the rest.
+ */
+static int derive(struct parser *parser, int kind, int next) {
+	struct derivation *deriv;
+
+	if (parser->nderiv == parser->capderiv) {
+		parser->capderiv = parser->capderiv ? parser->capderiv * 2 : 32;
+		parser->derivs = realloc(parser->derivs,
+		    parser->capderiv * sizeof(struct derivation));
+	}
+	deriv = &parser->derivs[parser->nderiv];
+	memset(deriv, 0, sizeof(struct derivation));
+	deriv->kind = kind;
+	deriv->length = -1;
+	deriv->next = next;
+	return parser->nderiv++;
+}
+
+/*
+ * Add a parameter type to the parser's list of them.
+ */
+static void addparam(struct parser *parser, struct type *type) {
+	if (parser->nparamtype == parser->capparamtype) {
+		parser->capparamtype = parser->capparamtype
+		    ? parser->capparamtype * 2 : 32;
+		parser->paramtypes = realloc(parser->paramtypes,
+		    parser->capparamtype * sizeof(struct type *));
+	}
+	parser->paramtypes[parser->nparamtype++] = type;
+}
+
+/*
+ * Append one list of derivations to another. Lists are given by their
+ * first and last derivations, -1 if empty.
+ */
+static void chain(struct parser *parser, int *first, int *last, int from,
+    int to) {
+	if (from < 0)
+		return;
+	if (*first < 0)
+		*first = from;
+	else
+		parser->derivs[*last].next = from;
+	*last = to;
+}
+
+/*
+ * Work out the value of an integer constant expression, returning true and
+ * storing it in `value` if it has one. Arithmetic is done in `long`, and
+ * wraps around rather than overflowing; casts keep the value they are
+ * given. Names, which may be enumeration constants, and `sizeof` are not
+ * known here, so an expression using them has no value, and neither does
+ * one nested more than MAXNESTING deep.
+ */
+static bool fold(struct tree *node, int depth, long *value) {
+	long left, right;
+
+	if (depth > MAXNESTING)
+		return false;
+	switch (node->kind) {
+	case AST_NUM:
+		*value = node->token->value;
+		return true;
+	case AST_CAST:
+	case AST_POS:
+		return fold(node->left, depth + 1, value);
+	case AST_NEG:
+	case AST_COMPL:
+	case AST_LNOT:
+		if (!fold(node->left, depth + 1, &left))
+			return false;
+		if (node->kind == AST_NEG)
+			*value = (long)-(unsigned long)left;
+		else
+			*value = node->kind == AST_COMPL ? ~left : !left;
+		return true;
+	case AST_COND:
+		if (!fold(node->left, depth + 1, &left))
+			return false;
+		return fold(left ? node->mid : node->right, depth + 1, value);
+	case AST_LAND:
+	case AST_LOR:
+		if (!fold(node->left, depth + 1, &left))
+			return false;
+		if ((node->kind == AST_LAND) != (left != 0)) {
+			*value = left != 0;
+			return true;
+		}
+		if (!fold(node->right, depth + 1, &right))
+			return false;
+		*value = right != 0;
+		return true;
+	}
+	if (node->kind < AST_OR || node->kind > AST_MOD
+	    || !fold(node->left, depth + 1, &left)
+	    || !fold(node->right, depth + 1, &right))
+		return false;
+	switch (node->kind) {
+	case AST_OR:	*value = left | right; break;
+	case AST_XOR:	*value = left ^ right; break;
+	case AST_AND:	*value = left & right; break;
+	case AST_EQ:	*value = left == right; break;
+	case AST_NE:	*value = left != right; break;
+	case AST_LT:	*value = left < right; break;
+	case AST_GT:	*value = left > right; break;
+	case AST_LE:	*value = left <= right; break;
+	case AST_GE:	*value = left >= right; break;
+	case AST_ADD:
+		*value = (long)((unsigned long)left + (unsigned long)right);
+		break;
+	case AST_SUB:
+		*value = (long)((unsigned long)left - (unsigned long)right);
+		break;
+	case AST_MUL:
+		*value = (long)((unsigned long)left * (unsigned long)right);
+		break;
+	case AST_LSHIFT:
+	case AST_RSHIFT:
+		if (right < 0 || right >= (long)(sizeof(long) * CHAR_BIT))
+			return false;
+		if (node->kind == AST_LSHIFT)
+			*value = (long)((unsigned long)left << right);
+		else
+			*value = left >> right;
+		break;
+	case AST_DIV:
+	case AST_MOD:
+		if (right == 0 || (left == LONG_MIN && right == -1))
+			return false;
+		*value = node->kind == AST_DIV ? left / right : left % right;
+		break;
+	}
+	return true;
+}
+
+/*
+ * Parse the array and function suffixes of a direct-declarator into a list
+ * of derivations, returning the first and storing the last in `last`.
+ * Suffixes bind from the inside out, so the rightmost suffix comes first.
+ * An array length is folded to its value if it is constant, and is unknown
+ * otherwise; its nodes are dropped either way, since types keep only the
+ * value. A function with empty parentheses, or with a list of identifiers
+ * for its parameters, has no prototype.
+ *
+ * parameter-type-list:
+ *   parameter-list
+ *   parameter-list , ...
+ *
+ * parameter-declaration:
+ *   declaration-specifiers declarator
+ *   declaration-specifiers abstract-declarator
+ *   declaration-specifiers
+ */
+static int suffixes(struct parser *parser, int *last) {
+	struct arenamark mark;
+	long length;
+	int first, i, start, variadic, noproto, nmade;
+
+	first = -1;
+	*last = -1;
+	for (;;) {
+		if (accept(parser, T_LBRACKET)) {
+			typequals(parser);
+			accept(parser, T_STATIC);
+			length = -1;
+			if (peek(parser)->kind != T_RBRACKET) {
+				markarena(&parser->nodes, &mark);
+				nmade = parser->nmade;
+				if (!fold(assignexpr(parser), 0, &length)
+				    || length < 0)
+					length = -1;
+				dropnodes(parser, &mark, nmade);
+			}
+			expect(parser, T_RBRACKET);
+			i = derive(parser, TY_ARRAY, first);
+			parser->derivs[i].length = length;
+		} else if (accept(parser, T_LPAREN)) {
+			/*
+			 * A parameter's own declarator is done with its
+			 * derivations and parameters before it returns, so
+			 * those of one function stay next to each other.
+			 */
+			start = parser->nparamtype;
+			variadic = 0;
+			noproto = peek(parser)->kind == T_RPAREN
+			    || (peek(parser)->kind == T_NAME
+			    && !startstypename(parser, peek(parser)));
+			if (peek(parser)->kind == T_VOID
+			    && peekn(parser, 2)->kind == T_RPAREN)
+				accept(parser, T_VOID);
+			while (noproto && peek(parser)->kind != T_RPAREN) {
+				expect(parser, T_NAME);
+				if (!accept(parser, T_COMMA))
+					break;
+			}
+			while (peek(parser)->kind != T_RPAREN) {
+				if (parser->nparamtype > start)
+					expect(parser, T_COMMA);
+				if (accept(parser, T_ELLIPSES)) {
+					variadic = 1;
+					break;
+				}
+				if (parser->nparamtype - start >= MAXPARAM)
+					syntaxerror(parser, peek(parser),
+					    "Too many parameters");
+				addparam(parser, adjustparam(declarator(parser,
+				    declspec(parser, NULL)).type));
+			}
+			expect(parser, T_RPAREN);
+			i = derive(parser, TY_FUNC, first);
+			parser->derivs[i].params = start;
+			parser->derivs[i].nparam = parser->nparamtype - start;
+			parser->derivs[i].variadic = variadic;
+			parser->derivs[i].noproto = noproto;
+		} else
+			return first;
+		if (first < 0)
+			*last = i;
+		first = i;
+	}
+}
+
+/*
+ * Parse a declarator into a list of the derivations that take its base
+ * type to the type of its identifier, in the order they apply, returning
+ * the first and storing the last in `last`. Pointers apply first, then
+ * suffixes, then whatever is inside parentheses: in `( declarator )
+ * suffixes`, the suffixes apply to the type before the inner declarator
+ * does. The inner declarator is parsed once, and the suffixes after it
+ * are chained in ahead of it.
+ *
+ * declarator:
+ *   pointer direct-declarator
+ *   direct-declarator
+ *
+ * pointer:
+ *   * type-qualifier-list
+ *   * type-qualifier-list pointer
+ *   ;
+ *
+ * direct-declarator:
+ *   identifier
+ *   ( declarator )
+ *   direct-declarator [ ]
+ *   direct-declarator [ static type-qualifier-list assignment-expression ]
+ *   direct-declarator [ static assignment-expression ]
+ *   direct-declarator [ type-qualifier-list assignment-expression ]
+ *   direct-declarator [ type-qualifier-list static assignment-expression ]
+ *   direct-declarator [ type-qualifier-list ]
+ *   direct-declarator [ assignment-expression ]
+ *   direct-declarator ( parameter-type-list )
+ *   direct-declarator ( )
+ *   direct-declarator ( identifier-list )
+ */
+static int derivations(struct parser *parser, struct token **name,
+    int *last) {
+	int first, i, inner, innerlast, suffix, suffixlast;
+
+	first = -1;
+	*last = -1;
+	while (accept(parser, T_STAR)) {
+		i = derive(parser, TY_PTR, -1);
+		parser->derivs[i].quals = typequals(parser);
+		chain(parser, &first, last, i, i);
+	}
+	inner = -1;
+	innerlast = -1;
+	if (peek(parser)->kind == T_LPAREN && startsdecl(peekn(parser, 2))) {
+		nest(parser);
+		accept(parser, T_LPAREN);
+		inner = derivations(parser, name, &innerlast);
+		expect(parser, T_RPAREN);
+		unnest(parser);
+	} else
+		*name = accept(parser, T_NAME);
+	suffix = suffixes(parser, &suffixlast);
+	chain(parser, &first, last, suffix, suffixlast);
+	chain(parser, &first, last, inner, innerlast);
+	return first;
+}
+
+/*
+ * Parse a declarator, applying it to the given type. The derivations it
+ * was parsed into are dropped once they have been applied.
+ */
+static struct declarator declarator(struct parser *parser,
+    struct type *type) {
+	struct declarator decl;
+	struct derivation *deriv;
+	int i, last, nderiv, nparamtype;
+
+	nderiv = parser->nderiv;
+	nparamtype = parser->nparamtype;
+	decl.name = NULL;
+	for (i = derivations(parser, &decl.name, &last); i >= 0;
+	    i = deriv->next) {
+		deriv = &parser->derivs[i];
+		switch (deriv->kind) {
+		case TY_PTR:
+			type = mkqualtype(mkptrtype(type), deriv->quals);
+			break;
+		case TY_ARRAY:
+			type = mkarraytype(type, deriv->length);
+			break;
+		case TY_FUNC:
+			if (deriv->noproto)
+				type = mknoprototype(type);
+			else
+				type = mkfunctype(type,
+				    &parser->paramtypes[deriv->params],
+				    deriv->nparam, deriv->variadic);
+			break;
+		}
+	}
+	parser->nderiv = nderiv;
+	parser->nparamtype = nparamtype;
+	decl.type = type;
+	return decl;
+}
+
+/*
+ * Return true if a token starts a declaration inside a compound statement,
+ * rather than a statement. A name followed by a colon is a label even if
+ * it is a typedef-name.
+ */
+static bool startsblockdecl(struct parser *parser, struct token *token) {
+	switch (token->kind) {
+	case T_TYPEDEF: case T_EXTERN: case T_STATIC: case T_AUTO:
+	case T_REGISTER: case T_STATICASSERT: case T_INLINE: case T_NORETURN:
+	case T_THREADLOCAL:
+		return true;
+	case T_NAME:
+		if (following(parser, token)->kind == T_COLON)
+			return false;
+	}
+	return startstypename(parser, token);
+}
+
+/*
+ * Parse a compound statement.
+ *
+ * compound-statement:
+ *   { }
+ *   { block-item-list }
+ *
+ * block-item-list:
+ *   block-item
+ *   block-item-list block-item
+ *
+ * block-item:
+ *   declaration
+ *   statement
+ */
+static struct tree *compoundstmt(struct parser *parser) {
+	struct tree *list, *item;
+	struct token *lbrace;
+	int nshadowed;
+
+	lbrace = expect(parser, T_LBRACE);
+	nshadowed = parser->nshadowed;
+	parser->scope++;
+	list = NULL;
+	while (!accept(parser, T_RBRACE)) {
+		if (peek(parser)->kind == T_EOF)
+			syntaxerror(parser, lbrace,
+			    "Unterminated compound statement");
+		if (startsblockdecl(parser, peek(parser)))
+			item = declaration(parser, false);
+		else
+			item = stmt(parser);
+		list = mkastbinary(parser->alloc, AST_GLUE, list, item);
+	}
+	parser->scope--;
+	unshadow(parser, nshadowed);
+	return mkastunary(parser->alloc, AST_BLOCK, list);
+}
+
+/*
+ * Parse an expression statement. An empty statement has no node.
+ *
+ * expression-statement:
+ *   expression ;
+ *   ;
+ */
+static struct tree *exprstmt(struct parser *parser) {
+	struct tree *node;
+
+	if (accept(parser, T_SEMI))
+		return NULL;
+	node = expr(parser);
+	expect(parser, T_SEMI);
+	return node;
+}
+
+/*
+ * Parse an if statement with a possible else case.
+ *
+ * if-statement:
+ *   if ( expression ) statement
+ *   if ( expression ) statement else statement
+ */
+static struct tree *ifstmt(struct parser *parser) {
+	struct tree *cond;
+	struct tree *thenbody, *elsebody;
+
+	expect(parser, T_IF);
+	expect(parser, T_LPAREN);
+	cond = expr(parser);
+	expect(parser, T_RPAREN);
+	thenbody = stmt(parser);
+	elsebody = NULL;
+	if (accept(parser, T_ELSE))
+		elsebody = stmt(parser);
+	return mkastnode(parser->alloc, AST_IFSTMT, cond, thenbody, elsebody);
+}
+
+/*
+ * Parse a while statement.
+ *
+ * while-statement:
+ *   while ( expression ) statement
  */
 static struct tree *whilestmt(struct parser *parser) {
 	struct tree *cond, *body;
@@ -482,11 +1733,11 @@ static struct tree *whilestmt(struct parser *parser) {
 	cond = expr(parser);
 	expect(parser, T_RPAREN);
 	body = stmt(parser);
-	return mkastbinary(AST_WHILESTMT, cond, body);
+	return mkastbinary(parser->alloc, AST_WHILESTMT, cond, body);
 }
 
 /*
- * Parse a do-while statement.
+ * Parse a do statement.
  *
  * do-statement:
  *   do statement while ( expression ) ;
@@ -497,30 +1748,39 @@ static struct tree *dostmt(struct parser *parser) {
 	expect(parser, T_DO);
 	body = stmt(parser);
 	expect(parser, T_WHILE);
-	expect(parser, T_LBRACE);
+	expect(parser, T_LPAREN);
 	cond = expr(parser);
-	expect(parser, T_RBRACE);
+	expect(parser, T_RPAREN);
 	expect(parser, T_SEMI);
-	return mkastbinary(AST_DO, body, cond);
+	return mkastbinary(parser->alloc, AST_DOSTMT, cond, body);
 }
 
 /*
- * Parse a do statement.
+ * Parse a for statement. The step and the body hang off a node of their
+ * own, since a node has at most three children.
  *
- * do-statement:
- *   do statement while ( expression ) ;
+ * for-statement:
+ *   for ( expression-statement expression-statement ) statement
+ *   for ( expression-statement expression-statement expression ) statement
+ *   for ( declaration expression-statement ) statement
+ *   for ( declaration expression-statement expression ) statement
  */
-static struct tree *dostmt(struct parser *parser) {
-	struct tree *body, *cond;
+static struct tree *forstmt(struct parser *parser) {
+	struct tree *init, *cond, *step;
 
-	expect(parser, T_DO);
-	body = stmt(parser);
-	expect(parser, T_WHILE);
+	expect(parser, T_FOR);
 	expect(parser, T_LPAREN);
-	cond = expr(parser);
+	if (startsblockdecl(parser, peek(parser)))
+		init = declaration(parser, false);
+	else
+		init = exprstmt(parser);
+	cond = exprstmt(parser);
+	step = NULL;
+	if (peek(parser)->kind != T_RPAREN)
+		step = expr(parser);
 	expect(parser, T_RPAREN);
-	expect(parser, T_SEMI);
-	return mkastbinary(AST_DOSTMT, cond, body);
+	return mkastnode(parser->alloc, AST_FORSTMT, init, cond,
+	    mkastbinary(parser->alloc, AST_FORSTEP, step, stmt(parser)));
 }
 
 /*
@@ -529,23 +1789,57 @@ static struct tree *dostmt(struct parser *parser) {
  * switch-statement:
  *   switch ( expression ) statement
  */
-static struct tree *switchstmt(sturct parser *parser) {
-	struct tree *value, body;
+static struct tree *switchstmt(struct parser *parser) {
+	struct tree *value, *body;
 
 	expect(parser, T_SWITCH);
 	expect(parser, T_LPAREN);
 	value = expr(parser);
 	expect(parser, T_RPAREN);
 	body = stmt(parser);
-	return mkastbinary(AST_SWITCHSTMT, value, body);
+	return mkastbinary(parser->alloc, AST_SWITCHSTMT, value, body);
+}
+
+/*
+ * Parse a jump statement.
+ *
+ * jump-statement:
+ *   goto identifier ;
+ *   continue ;
+ *   break ;
+ *   return ;
+ *   return expression ;
+ */
+static struct tree *jumpstmt(struct parser *parser) {
+	struct tree *node;
+	struct token *token;
+
+	token = peek(parser);
+	advance(parser);
+	switch (token->kind) {
+	case T_GOTO:
+		node = leaf(parser, AST_GOTO, expect(parser, T_NAME));
+		break;
+	case T_RETURN:
+		node = mkastunary(parser->alloc, AST_RETURN,
+		    peek(parser)->kind == T_SEMI ? NULL : expr(parser));
+		node->token = token;
+		break;
+	default:
+		node = leaf(parser, token->kind == T_BREAK ? AST_BREAK
+		    : AST_CONTINUE, token);
+		break;
+	}
+	expect(parser, T_SEMI);
+	return node;
 }
 
 /*
  * Parse a satement without labels. Called by the main statement parser after
  * consuming any labels.
  */
-static struct tree *stmtnolables(struct parser *parser) {
-	switch (parser->token->kind) {
+static struct tree *stmtnolabels(struct parser *parser) {
+	switch (peek(parser)->kind) {
 	case T_LBRACE:
 		return compoundstmt(parser);
 
@@ -565,20 +1859,18 @@ static struct tree *stmtnolables(struct parser *parser) {
 	case T_IF:
 		return ifstmt(parser);
 	case T_SWITCH:
-		return stwitchstmt(parser);
+		return switchstmt(parser);
 
 	/*
 	 * Jump statement.
 	 */
 	case T_GOTO:
-		return gotostmt(parser);
 	case T_CONTINUE:
-		return contstmt(parser);
 	case T_BREAK:
-		return breakstmt(parser);
 	case T_RETURN:
-		return returnstmt(parser);
+		return jumpstmt(parser);
 	}
+	return exprstmt(parser);
 }
 
 /*
@@ -591,21 +1883,24 @@ static struct tree *stmtnolables(struct parser *parser) {
  *   ;
  */
 static struct tree *labeledstmt(struct parser *parser) {
-	struct tree *label, *caseval, body;
+	struct tree *caseval, *node;
+	struct token *label;
 
 	if (accept(parser, T_CASE)) {
 		caseval = constexpr(parser);
 		expect(parser, T_COLON);
-		return mkastbinary(AST_CASE, caseval, stmt(parser));
+		return mkastbinary(parser->alloc, AST_CASE, caseval,
+		    stmt(parser));
 	}
 	if (accept(parser, T_DEFAULT)) {
 		expect(parser, T_COLON);
-		return mkastunary(AST_DEFAULTCASE, stmt(parser));
-	}
-	if ((label = accept(parser, T_NAME)) != NULL) {
-		expect(parser, T_COLON);
-		return mkastbinary(AST_LABEL, label, stmt(parser));
+		return mkastunary(parser->alloc, AST_DEFAULTCASE, stmt(parser));
 	}
+	label = expect(parser, T_NAME);
+	expect(parser, T_COLON);
+	node = mkastunary(parser->alloc, AST_LABEL, stmt(parser));
+	node->token = label;
+	return node;
 }
 
 /*
@@ -624,22 +1919,412 @@ static struct tree *labeledstmt(struct parser *parser) {
  *   while ( expression ) statement
  *   do statement while ( expression ) ;
  *   for ( expression-statement expression-statement ) statement
- *   for ( expression-statement expression-statement expression-statement ) statement
+ *   for ( expression-statement expression-statement expression ) statement
  *   for ( declaration expression-statement ) statement
- *   for ( declaration expression-statement expression-statement ) statement
+ *   for ( declaration expression-statement expression ) statement
  *
  * selection-statement:
  *   if ( expression ) statement
  *   if ( expression ) statement else statement
  *   switch ( expression ) statement
- * 
- * jump-statement:
- *   goto identifier ;
- *   continue ;
- *   break ;
- *   return ;
- *   return expression ;
  */
 static struct tree *stmt(struct parser *parser) {
-	labels(parser);
+	struct tree *node;
+	struct token *token;
+
+	nest(parser);
+	token = peek(parser);
+	if (token->kind == T_CASE || token->kind == T_DEFAULT
+	    || (token->kind == T_NAME
+	    && following(parser, token)->kind == T_COLON))
+		node = labeledstmt(parser);
+	else
+		node = stmtnolabels(parser);
+	unnest(parser);
+	return node;
+}
+
+/*
+ * Get what kind of symbol a declarator declares, for the index. A function
+ * is defined only by a declarator followed by its body.
+ */
+static int symkind(int sclass, struct type *type, struct tree *init) {
+	if (sclass == T_TYPEDEF)
+		return IX_TYPEDEF;
+	if (type->kind == TY_FUNC || (sclass == T_EXTERN && init == NULL))
+		return IX_DECL;
+	return IX_DEF;
+}
+
+/*
+ * Parse the body of a function definition.
+ *
+ * function-definition:
+ *   declaration-specifiers declarator compound-statement
+ */
+static struct tree *funcdef(struct parser *parser, struct declarator *decl) {
+	struct tree *node;
+
+	if (decl->name == NULL)
+		syntaxerror(parser, peek(parser), "Function has no name");
+	if (parser->index != NULL)
+		indexsym(parser->index, decl->name, IX_DEF);
+	node = mkastunary(parser->alloc, AST_FUNCDEF, compoundstmt(parser));
+	node->token = decl->name;
+	node->type = decl->type;
+	return mkastbinary(parser->alloc, AST_GLUE, NULL, node);
+}
+
+/*
+ * Parse a declaration, or a function definition if it is external. Only
+ * external declarations are recorded in the index.
+ *
+ * declaration:
+ *   declaration-specifiers ;
+ *   declaration-specifiers init-declarator-list ;
+ *   static_assert-declaration
+ *   ;
+ *
+ * declaration-list:
+ *   declaration
+ *   declaration-list declaration
+ */
+static struct tree *declaration(struct parser *parser, bool external) {
+	struct tree *toassert, *errmsg, *list, *init;
+	struct declarator decl;
+	struct type *base;
+	int sclass;
+
+	if (accept(parser, T_STATICASSERT)) {
+		expect(parser, T_LPAREN);
+		toassert = constexpr(parser);
+		expect(parser, T_COMMA);
+		errmsg = leaf(parser, AST_STRLIT, expect(parser, T_STRLIT));
+		expect(parser, T_RPAREN);
+		expect(parser, T_SEMI);
+		return mkastbinary(parser->alloc, AST_STATICASSERT, toassert,
+		    errmsg);
+	}
+	base = declspec(parser, &sclass);
+	list = NULL;
+	if (accept(parser, T_SEMI))
+		return list;
+	do {
+		decl = declarator(parser, base);
+		if (external && list == NULL && decl.type->kind == TY_FUNC
+		    && sclass != T_TYPEDEF && peek(parser)->kind == T_LBRACE)
+			return funcdef(parser, &decl);
+		init = NULL;
+		if (sclass == T_TYPEDEF && decl.name != NULL)
+			addsym(&parser->typedefs, (char *)decl.name->value,
+			    decl.type);
+		else if (accept(parser, T_ASSIGN))
+			init = initializer(parser);
+		if (external && parser->index != NULL && decl.name != NULL)
+			indexsym(parser->index, decl.name,
+			    symkind(sclass, decl.type, init));
+		list = mkastbinary(parser->alloc, AST_GLUE, list,
+		    mkastdecl(parser->alloc, decl.name, decl.type, init));
+	} while (accept(parser, T_COMMA));
+	expect(parser, T_SEMI);
+	return list;
+}
+
+/*
+ * Return true if a token can only start an external declaration.
+ */
+static bool startsextdecl(struct parser *parser, struct token *token) {
+	switch (token->kind) {
+	case T_TYPEDEF: case T_EXTERN: case T_STATIC: case T_STATICASSERT:
+	case T_INLINE: case T_NORETURN: case T_THREADLOCAL:
+		return true;
+	}
+	return startstypename(parser, token);
+}
+
+/*
+ * Skip tokens after a syntax error until parsing can pick up again: just
+ * past a `;` or the `}` that closes the braces being skipped, or at the
+ * start of a line that begins a new declaration. Always skips at least one
+ * token, so that parsing makes progress.
+ */
+static void synchronize(struct parser *parser) {
+	struct token *token;
+	bool moved;
+	int depth;
+
+	depth = 0;
+	moved = false;
+	while ((token = peek(parser))->kind != T_EOF) {
+		if (moved && depth == 0 && token->bol
+		    && startsextdecl(parser, token))
+			return;
+		advance(parser);
+		moved = true;
+		if (token->kind == T_LBRACE)
+			depth++;
+		else if (token->kind == T_RBRACE && --depth <= 0)
+			return;
+		else if (token->kind == T_SEMI && depth == 0)
+			return;
+	}
+}
+
+/*
+ * Take a node from the allocator the parser was given, and record it, so
+ * that it can be handed back when it is no longer needed. Nodes are only
+ * ever allocated through this, never resized or freed one at a time, and
+ * are all the same size, so one released by rolling back is simply made
+ * again.
+ */
+static void *tracknode(void *ctx, size_t size) {
+	struct parser *parser;
+	int capmade;
+
+	parser = ctx;
+	if (parser->nmade < parser->nheld)
+		return parser->made[parser->nmade++];
+	if (parser->nheld == parser->capmade) {
+		capmade = parser->capmade ? parser->capmade * 2 : 256;
+		parser->made = reallocate(parser->supplied, parser->made,
+		    parser->capmade * sizeof(struct tree *),
+		    capmade * sizeof(struct tree *));
+		parser->capmade = capmade;
+	}
+	parser->made[parser->nheld++] = allocate(parser->supplied, size);
+	return parser->made[parser->nmade++];
+}
+
+/*
+ * Hand an external declaration to the parser's stream, then release what
+ * is no longer needed. Once `emit` returns nothing refers to the
+ * declaration's nodes, and if no token past it has been read, nothing
+ * refers to the tokens read so far either.
+ */
+static void emit(struct parser *parser, struct tree *decl) {
+	struct stream *stream;
+
+	stream = parser->stream;
+	if (decl != NULL)
+		stream->emit(decl, stream->sink);
+	if (parser->alloc == &parser->own)
+		arenareset(&parser->nodes);
+	else
+		releasenodes(parser);
+	if (parser->token == NULL) {
+		parser->last = NULL;
+		stream->release(stream->src);
+	}
+}
+
+/*
+ * Parse a translation unit, adding each external declaration to the root of
+ * the syntax tree, or handing it to the parser's stream if it has one. If
+ * errors are being collected, a syntax error skips to the next place
+ * parsing can pick up again rather than stopping.
+ *
+ * translation-unit:
+ *   external-declaration
+ *   translation-unit external-declaration
+ */
+void parse(struct parser *parser) {
+	struct arenamark mark;
+	struct token *token;
+	struct tree *decl;
+	jmp_buf env;
+	int nmade, nsym;
+
+	parser->recover = &env;
+	while (peek(parser)->kind != T_EOF) {
+		/*
+		 * Nodes of a declaration abandoned after a syntax error are
+		 * released, so that only nodes of the tree are in the arena.
+		 * Its symbols are dropped from the index along with them.
+		 */
+		markarena(&parser->nodes, &mark);
+		nmade = parser->nmade;
+		nsym = parser->index != NULL ? parser->index->count : 0;
+		if (setjmp(env)) {
+			dropnodes(parser, &mark, nmade);
+			if (parser->index != NULL)
+				parser->index->count = nsym;
+			parser->depth = 0;
+			parser->speculating = 0;
+			parser->nderiv = 0;
+			parser->nparamtype = 0;
+			parser->scope = 0;
+			unshadow(parser, 0);
+			synchronize(parser);
+			continue;
+		}
+		if ((token = peek(parser))->kind == T_IMPORT) {
+			advance(parser);
+			importheader(parser, (struct header *)token->value);
+			continue;
+		}
+		decl = declaration(parser, true);
+		if (parser->stream != NULL)
+			emit(parser, decl);
+		else
+			parser->root = mkastbinary(parser->alloc, AST_GLUE,
+			    parser->root, decl);
+	}
+	parser->recover = NULL;
+}
+
+/*
+ * Make the declarations of a parsed header visible to the parser, as if they
+ * had been parsed in place. The header's tree and typedef-names are shared,
+ * not copied, so this costs the same no matter how big the header is. The
+ * imports the header was parsed under stand for ones the parser has
+ * already, so only those the header added are taken. A streaming parser
+ * has no tree to add the header's to.
+ */
+void importheader(struct parser *parser, struct header *header) {
+	struct parser *from;
+	int i;
+
+	from = &header->parser;
+	while (parser->nimport + from->nimport + 1 > parser->capimport) {
+		parser->capimport = parser->capimport ? parser->capimport * 2 : 8;
+		parser->imports = realloc(parser->imports,
+		    parser->capimport * sizeof(struct symtab *));
+	}
+	for (i = header->nbase; i < from->nimport; i++)
+		parser->imports[parser->nimport++] = from->imports[i];
+	parser->imports[parser->nimport++] = &from->typedefs;
+	if (parser->stream == NULL && header->parser.root != NULL)
+		parser->root = mkastbinary(parser->alloc, AST_GLUE,
+		    parser->root, header->parser.root);
+}
+
+/*
+ * Find the type a typedef-name stands for among the declarations of some
+ * headers, as a parser that imported them in order would, or NULL if none
+ * declares it.
+ */
+struct type *importedtypedef(struct header **headers, int count,
+    char *name) {
+	struct parser *from;
+	struct type *type;
+	int i, j;
+
+	for (i = count - 1; i >= 0; i--) {
+		from = &headers[i]->parser;
+		if ((type = findsym(&from->typedefs, name)) != NULL)
+			return type;
+		for (j = from->nimport - 1; j >= headers[i]->nbase; j--) {
+			if ((type = findsym(from->imports[j], name)) != NULL)
+				return type;
+		}
+	}
+	return NULL;
+}
+
+/*
+ * Take a checkpoint of where the parser is.
+ */
+void checkpoint(struct parser *parser, struct checkpoint *cp) {
+	cp->token = peek(parser);
+	cp->depth = parser->depth;
+	cp->nsym = parser->index != NULL ? parser->index->count : 0;
+	cp->nderiv = parser->nderiv;
+	cp->nparamtype = parser->nparamtype;
+	cp->nmade = parser->nmade;
+	cp->scope = parser->scope;
+	cp->nshadowed = parser->nshadowed;
+	markarena(&parser->nodes, &cp->mark);
+}
+
+/*
+ * Roll the parser back to a checkpoint. Nodes made since then are released:
+ * the parser's own arena is rewound, and nodes from a supplied allocator
+ * are kept to be made again when the tokens are reparsed. Symbols indexed
+ * and tags declared since then are dropped, since they will be found again
+ * too.
+ */
+void rollback(struct parser *parser, struct checkpoint *cp) {
+	parser->token = cp->token;
+	parser->depth = cp->depth;
+	if (parser->index != NULL)
+		parser->index->count = cp->nsym;
+	parser->nderiv = cp->nderiv;
+	parser->nparamtype = cp->nparamtype;
+	parser->scope = cp->scope;
+	unshadow(parser, cp->nshadowed);
+	dropnodes(parser, &cp->mark, cp->nmade);
+}
+
+/*
+ * Free everything a parser holds, leaving it as if it had just been
+ * cleared.
+ */
+void parsefree(struct parser *parser) {
+	releasenodes(parser);
+	arenafree(&parser->nodes);
+	free(parser->typedefs.syms);
+	free(parser->tags.syms);
+	free(parser->shadowed);
+	free(parser->imports);
+	free(parser->derivs);
+	free(parser->paramtypes);
+	if (parser->made != NULL)
+		deallocate(parser->supplied, parser->made,
+		    parser->capmade * sizeof(struct tree *));
+	memset(parser, 0, sizeof(struct parser));
+}
+
+/*
+ * Forget the syntax tree without handing its nodes back, once whoever
+ * supplied the allocator they came from has reset it and they are gone
+ * anyway. The record of them went with them.
+ */
+void parseforget(struct parser *parser) {
+	if (parser->alloc != &parser->track)
+		return;
+	parser->made = NULL;
+	parser->nmade = 0;
+	parser->nheld = 0;
+	parser->capmade = 0;
+	parser->root = NULL;
+}
+
+/*
+ * Prepare a parser to parse a new token-stream, dropping the previous syntax
+ * tree, typedef-names and imports. If the parser has a stream, `tokens`
+ * should be NULL, and tokens are read from the stream instead. The syntax
+ * tree comes from `alloc` if it is set, and otherwise from the parser's own
+ * arena. Nodes taken from a supplied allocator are recorded as they are
+ * made, and handed back to it whenever the parser is done with them.
+ */
+void parsereset(struct parser *parser, struct token *tokens) {
+	parser->token = tokens;
+	parser->last = NULL;
+	parser->root = NULL;
+	parser->nimport = 0;
+	parser->ncontext = 0;
+	parser->deps = NULL;
+	parser->recover = NULL;
+	parser->depth = 0;
+	parser->speculating = 0;
+	parser->nderiv = 0;
+	parser->nparamtype = 0;
+	releasenodes(parser);
+	if (parser->alloc == NULL || parser->alloc == &parser->own) {
+		arenaallocator(&parser->own, &parser->nodes);
+		parser->alloc = &parser->own;
+		arenareset(&parser->nodes);
+	} else if (parser->alloc != &parser->track) {
+		parser->supplied = parser->alloc;
+		memset(&parser->track, 0, sizeof(parser->track));
+		parser->track.alloc = tracknode;
+		parser->track.ctx = parser;
+		parser->alloc = &parser->track;
+	}
+	free(parser->typedefs.syms);
+	memset(&parser->typedefs, 0, sizeof(parser->typedefs));
+	free(parser->tags.syms);
+	memset(&parser->tags, 0, sizeof(parser->tags));
+	parser->nshadowed = 0;
+	parser->scope = 0;
 }
@@ -1,13 +1,155 @@
 #ifndef _PARSE_H_
 #define _PARSE_H_
 
+/*
+ * Maximum number of parameters in a function declarator.
+ */
+#define MAXPARAM	127
+
+/*
+ * Deepest that expressions and declarators may nest. Nesting is parsed
+ * recursively, so this keeps any input from running the parser out of
+ * stack.
+ */
+#define MAXNESTING	256
+
+/*
+ * Result of parsing a declarator. The type is interned, so it may be shared
+ * with any number of other declarators. Declarators are passed by value,
+ * so that the parser's node arena holds nothing but nodes.
+ */
+struct declarator {
+	struct token *name;	/* identifier, NULL if abstract */
+	struct type *type;	/* type of identifier */
+};
+
+/*
+ * How many slots a symbol-table starts with. Must be a power of two.
+ */
+#define NSYMBUCKET	64
+
+/*
+ * Entry in a symbol-table.
+ */
+struct symbol {
+	char *name;		/* interned name, NULL if slot is free */
+	struct type *type;	/* type of name */
+	int scope;		/* nesting of block name was declared in */
+};
+
+/*
+ * Open-addressed table mapping interned names to types.
+ */
+struct symtab {
+	struct symbol *syms;	/* slots of table */
+	int size;		/* number of slots */
+	int count;		/* number of names */
+};
+
+/*
+ * A step in deriving the type of a declarator from its base type. A
+ * declarator is parsed into a list of these before any type is built,
+ * since what follows a parenthesized declarator applies before it does.
+ */
+struct derivation {
+	int kind;		/* TY_PTR, TY_ARRAY or TY_FUNC */
+	int quals;		/* qualifiers of pointer */
+	long length;		/* length of array, -1 if unknown */
+	int params;		/* first of function's types in paramtypes */
+	int nparam;		/* number of parameters */
+	int variadic;		/* function takes variable arguments */
+	int noproto;		/* function declared without a prototype */
+	int next;		/* next derivation to apply, -1 if last */
+};
+
+struct tree;
+
+/*
+ * Where a streaming parser reads its tokens from and hands its external
+ * declarations to. Tokens are read only as they are needed. Each
+ * declaration is emitted as soon as it has been parsed, and its nodes are
+ * released once `emit` returns. After that, if no token past the
+ * declaration has been read, `release` is called so that the source can
+ * free the tokens read so far.
+ */
+struct stream {
+	struct token *(*read)(void *src);
+	void (*release)(void *src);
+	void *src;		/* source of tokens */
+	void (*emit)(struct tree *decl, void *sink);
+	void *sink;		/* receiver of declarations */
+};
+
 /*
  * One allocated per parser.
  */
 struct parser {
-	struct token *token;	/* current token */
+	struct token *token;	/* current token, NULL if not yet read */
 	struct tree *root;	/* root of syntax tree */
+	struct stream *stream;	/* where to stream from, NULL for token */
+	struct token *last;	/* last token read from stream */
+	struct symtab typedefs;	/* typedef-names declared */
+	struct symtab tags;	/* tags declared in blocks */
+	struct symbol *shadowed;/* tags that block-scope tags replaced */
+	int nshadowed;		/* number of tags replaced */
+	int capshadowed;	/* capacity of shadowed */
+	int scope;		/* nesting of block, 0 at file scope */
+	struct symtab **imports;/* typedef-names of imported headers */
+	int nimport;		/* number of imports */
+	int capimport;		/* capacity of imports */
+	int ncontext;		/* imports that came from the includer */
+	struct depset *deps;	/* what a header looks up, if recording */
+	jmp_buf *recover;	/* where to resume after a syntax error */
+	int depth;		/* nesting depth of current construct */
+	int speculating;	/* errors only mean a guess was wrong */
+	struct index *index;	/* where to record symbols, NULL for none */
+	struct derivation *derivs;/* derivations of declarators being parsed */
+	int nderiv;		/* number of derivations */
+	int capderiv;		/* capacity of derivs */
+	struct type **paramtypes;/* parameter types of derivations */
+	int nparamtype;		/* number of parameter types */
+	int capparamtype;	/* capacity of paramtypes */
+	struct arena nodes;	/* syntax tree of current source */
+	struct allocator own;	/* allocates from nodes */
+	struct allocator *alloc;/* syntax tree, NULL for nodes */
+	struct allocator track;	/* records nodes taken from supplied */
+	struct allocator *supplied;/* allocator set in alloc, if any */
+	struct tree **made;	/* nodes taken from supplied */
+	int nmade;		/* number of nodes in use */
+	int nheld;		/* number in use or kept to reuse */
+	int capmade;		/* capacity of made */
 	struct parser *next;	/* next parser in list */
 };
 
+/*
+ * A point in parsing that the parser can be rolled back to, so that it can
+ * try parsing something one way and back out if that was wrong. Taking one
+ * and rolling back to it both take constant time.
+ */
+struct checkpoint {
+	struct token *token;	/* current token */
+	struct arenamark mark;	/* how much of nodes was in use */
+	int depth;		/* nesting depth */
+	int nsym;		/* number of symbols in index */
+	int nderiv;		/* number of derivations */
+	int nparamtype;		/* number of parameter types */
+	int nmade;		/* number of nodes taken from supplied */
+	int scope;		/* nesting of block */
+	int nshadowed;		/* number of tags replaced */
+};
+
+struct header;
+struct index;
+struct depset;
+
+void parse(struct parser *parser);
+void checkpoint(struct parser *parser, struct checkpoint *cp);
+void rollback(struct parser *parser, struct checkpoint *cp);
+void parsereset(struct parser *parser, struct token *tokens);
+void parsefree(struct parser *parser);
+void parseforget(struct parser *parser);
+void importheader(struct parser *parser, struct header *header);
+struct type *importedtypedef(struct header **headers, int count,
+    char *name);
+
 #endif /* !_PARSE_H_ */
@@ -0,0 +1,229 @@
+#include <errno.h>
+#include <poll.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+#include "token.h"
+#include "arena.h"
+#include "alloc.h"
+#include "error.h"
+#include "lex.h"
+#include "cpp.h"
+#include "parse.h"
+#include "compile.h"
+#include "server.h"
+
+/*
+ * Write a reply to the client, ignoring a client that has gone away. The
+ * write must not raise SIGPIPE, which would kill the whole server.
+ */
+static void reply(int fd, char *message) {
+	int length, n;
+
+	length = strlen(message);
+	while (length > 0) {
+		if ((n = send(fd, message, length, MSG_NOSIGNAL)) < 0) {
+			if (errno == EINTR)
+				continue;
+			return;
+		}
+		message += n;
+		length -= n;
+	}
+}
+
+/*
+ * Get how many milliseconds are left until a deadline, or 0 if it has
+ * passed.
+ */
+static int remaining(struct timespec *deadline) {
+	struct timespec now;
+	long ms;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	ms = (deadline->tv_sec - now.tv_sec) * 1000
+	    + (deadline->tv_nsec - now.tv_nsec) / 1000000;
+	return ms > 0 ? ms : 0;
+}
+
+/*
+ * Read a whole request into the buffer, growing it if needed. The client
+ * marks the end of the source by shutting down its side of the connection.
+ * The whole request must arrive within REQUESTTIMEOUT seconds, however it
+ * is split up, and be shorter than MAXREQUEST bytes, so that no client can
+ * hold a worker or the server's memory for long. Returns the length read,
+ * or -1 if the request was dropped.
+ */
+static int readrequest(int fd, char **buffer, int *capacity) {
+	struct timespec deadline;
+	struct pollfd pfd;
+	char *grown;
+	int length, n, wait;
+
+	clock_gettime(CLOCK_MONOTONIC, &deadline);
+	deadline.tv_sec += REQUESTTIMEOUT;
+	pfd.fd = fd;
+	pfd.events = POLLIN;
+	length = 0;
+	for (;;) {
+		if (length + 1 >= *capacity) {
+			if (*capacity >= MAXREQUEST) {
+				reply(fd, "error: request too large\n");
+				return -1;
+			}
+			if ((grown = realloc(*buffer, *capacity * 2)) == NULL)
+				return -1;
+			*buffer = grown;
+			*capacity *= 2;
+		}
+		if ((wait = remaining(&deadline)) == 0)
+			return -1;
+		if ((n = poll(&pfd, 1, wait)) < 0 && errno == EINTR)
+			continue;
+		if (n <= 0)
+			return -1;
+		n = read(fd, *buffer + length, *capacity - length - 1);
+		if (n == 0)
+			break;
+		if (n < 0) {
+			if (errno == EINTR)
+				continue;
+			return -1;
+		}
+		length += n;
+	}
+	(*buffer)[length] = '\0';
+	return length;
+}
+
+/*
+ * Reply with every error a request had, one per line, and empty the buffer.
+ */
+static void replyerrors(int fd, struct diagbuf *diags) {
+	char message[MAXERROR + 16];
+	struct diag *diag;
+
+	for (diag = diags->head; diag != NULL; diag = diag->next) {
+		snprintf(message, sizeof(message), "error: %s\n",
+		    diag->message);
+		reply(fd, message);
+	}
+	clearerrors(diags);
+}
+
+/*
+ * What each worker of the server gets: the listening socket, and the
+ * preprocessor whose include directories every worker's copies.
+ */
+struct worker {
+	int fd;			/* listening socket */
+	struct cpp *cpp;	/* template preprocessor */
+	char *path;		/* path of socket */
+};
+
+/*
+ * Serve requests until accepting a connection fails. Each worker has its
+ * own preprocessor, parser and request-buffer, so nothing but the headers,
+ * interned strings and types is shared between them. Tokens and syntax
+ * trees come from this thread's pool, and go back to it as soon as the
+ * lexer and parser are done with them, or all at once when the request
+ * has been answered.
+ */
+static void *work(void *arg) {
+	struct worker *worker;
+	struct parser parser;
+	struct diagbuf diags;
+	struct cpp *cpp;
+	char *buffer;
+	int client, capacity, length, i;
+
+	worker = arg;
+	cpp = calloc(1, sizeof(struct cpp));
+	for (i = 0; i < worker->cpp->nincdir; i++)
+		cppincdir(cpp, worker->cpp->incdirs[i]);
+	cpp->shareheaders = 1;
+	cpp->main.alloc = &poolalloc;
+	memset(&parser, 0, sizeof(parser));
+	memset(&diags, 0, sizeof(diags));
+	parser.alloc = &poolalloc;
+	capacity = REQUESTSIZE;
+	buffer = malloc(capacity);
+	for (;;) {
+		if ((client = accept(worker->fd, NULL, NULL)) < 0) {
+			if (errno == EINTR || errno == ECONNABORTED)
+				continue;
+			perror(worker->path);
+			break;
+		}
+		if ((length = readrequest(client, &buffer, &capacity)) >= 0) {
+			if (compile(cpp, &parser, "<request>", buffer,
+			    length, &diags) < 0)
+				replyerrors(client, &diags);
+			else
+				reply(client, "ok\n");
+			/*
+			 * Everything taken from the pool for the request is
+			 * released at once, rather than block by block when
+			 * the next one starts.
+			 */
+			cppforget(cpp);
+			parseforget(&parser);
+			resetalloc(&poolalloc);
+		}
+		close(client);
+	}
+	free(buffer);
+	return NULL;
+}
+
+/*
+ * Run as a compile-server listening on a unix socket at the given path. Each
+ * connection sends the source of one translation unit and gets back "ok" or
+ * every error found in it, one per line.
+ *
+ * NWORKER threads, the calling one among them, each take connections one
+ * at a time, so a slow client holds up only its own worker. Each worker
+ * reuses its preprocessor, parser and request-buffer for every request,
+ * and headers are shared through the header-store, so the keyword table,
+ * interned strings, arenas and parsed headers stay warm across requests.
+ * Included files are looked up relative to the server's working directory,
+ * and in the include directories of `cpp`. Returns -1 if the socket could
+ * not be set up, or once accepting connections fails.
+ */
+int serve(char *path, struct cpp *cpp) {
+	struct sockaddr_un addr;
+	struct worker worker;
+	pthread_t thread;
+	int fd, i;
+
+	if (strlen(path) >= sizeof(addr.sun_path)) {
+		fprintf(stderr, "%s: socket path too long\n", path);
+		return -1;
+	}
+	memset(&addr, 0, sizeof(addr));
+	addr.sun_family = AF_UNIX;
+	strcpy(addr.sun_path, path);
+	unlink(path);
+	if ((fd = socket(AF_UNIX, SOCK_STREAM, 0)) < 0
+	    || bind(fd, (struct sockaddr *)&addr, sizeof(addr)) < 0
+	    || listen(fd, BACKLOG) < 0) {
+		perror(path);
+		return -1;
+	}
+
+	worker.fd = fd;
+	worker.cpp = cpp;
+	worker.path = path;
+	for (i = 1; i < NWORKER; i++) {
+		if (pthread_create(&thread, NULL, work, &worker) == 0)
+			pthread_detach(thread);
+	}
+	work(&worker);
+	return -1;
+}
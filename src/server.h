@@ -0,0 +1,28 @@
+#ifndef _SERVER_H_
+#define _SERVER_H_
+
+/*
+ * Number of pending connections the server socket queues.
+ */
+#define BACKLOG		64
+
+/*
+ * Size the request-buffer starts out at, and the size no request may
+ * reach. The buffer doubles as it fills, so the limit must be the starting
+ * size times a power of two.
+ */
+#define REQUESTSIZE	65536
+#define MAXREQUEST	(REQUESTSIZE << 10)
+
+/*
+ * How many threads take requests at once, and how many seconds a client
+ * has to send the whole of its request before it is dropped.
+ */
+#define NWORKER		8
+#define REQUESTTIMEOUT	10
+
+struct cpp;
+
+int serve(char *path, struct cpp *cpp);
+
+#endif /* !_SERVER_H_ */
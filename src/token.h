@@ -7,13 +7,24 @@ enum {
 	T_RSHIFTEQ, T_ANDEQ, T_OREQ, T_XOREQ,
 
 	T_PLUS, T_MINUS, T_STAR, T_SLASH, T_MODULO,
-	T_BOR, T_AMP, T_BXOR, T_BLSHIFT, T_BRSHIFT
-	T_LAND, T_LOR, T_NOT,
+	T_BOR, T_AMP, T_BXOR, T_BLSHIFT, T_BRSHIFT,
+	T_LAND, T_LOR, T_NOT, T_TILDE, T_INC, T_DEC,
+
+	T_EQ, T_NE, T_LT, T_GT, T_LE, T_GE, T_ASSIGN, T_QUESTIONMARK, T_COLON,
+	T_COMMA,
 
 	T_SEMI, T_ARROW, T_DOT, T_ELLIPSES,
 
 	T_LBRACE, T_RBRACE, T_LBRACKET, T_RBRACKET, T_LPAREN, T_RPAREN,
 
+	/* Names and literals */
+	T_NAME, T_INTLIT, T_CHARLIT, T_STRLIT,
+
+	/* Preprocessing */
+	T_HASH, T_HASHHASH, T_IMPORT,
+
+	T_EOF,
+
 	/* Primitive types */
 	T_BOOL, T_VOID, T_CHAR, T_SHORT, T_INT, T_LONG, T_DOUBLE, T_FLOAT,
 	T_COMPLEX, T_IMAGINARY,
@@ -22,10 +33,29 @@ enum {
 	T_THREADLOCAL,
 
 	/* Reserved keywords */
-	T_ASM, T_AUTO, T_BREAK, T_CASE, T_CHAR, T_CONST, T_CONTINUE, T_DEFAULT,
-	T_DO, T_ELSE, T_ENUM, T_EXTERN, T_FOR, T_GOTO, T_IF, T_REGISTER,
-	T_RETURN, T_SIGNED, T_STATIC, T_STRUCT, T_SWITCH, T_SIZEOF, T_TYEPDEF,
-	T_UNION, T_UNSIGNED, T_VOLATILE, T_WHILE,
+	T_ASM, T_AUTO, T_BREAK, T_CASE, T_CONST, T_CONTINUE, T_DEFAULT,
+	T_DO, T_ELSE, T_ENUM, T_EXTERN, T_FOR, T_GOTO, T_IF, T_INLINE,
+	T_REGISTER, T_RESTRICT, T_RETURN, T_SIGNED, T_STATIC, T_STRUCT,
+	T_SWITCH, T_SIZEOF, T_TYPEDEF, T_UNION, T_UNSIGNED, T_VOLATILE,
+	T_WHILE,
+};
+
+/*
+ * A lexical token. Names are interned and stored in `value`, as are the
+ * contents of string literals.
+ */
+struct token {
+	int kind;		/* kind of token */
+	long value;		/* value of literal, or its string */
+	char *text;		/* spelling of token in its source */
+	int length;		/* length of spelling */
+	char *path;		/* path of its source */
+	int line;		/* line number in its source */
+	int offset;		/* position of text in its source */
+	int bol;		/* first token on its line */
+	int space;		/* preceded by whitespace */
+	struct hideset *hideset;/* macros that must not expand it */
+	struct token *next;	/* next token in stream */
 };
 
 #endif /* !_TOKEN_H_ */
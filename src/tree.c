@@ -0,0 +1,51 @@
+#include <stddef.h>
+
+#include "alloc.h"
+#include "tree.h"
+
+/*
+ * Create a node with up to three children. Nodes come from the parser's
+ * allocator, so they are released along with the rest of its memory.
+ */
+struct tree *mkastnode(struct allocator *alloc, int kind, struct tree *left,
+    struct tree *mid, struct tree *right) {
+	struct tree *node;
+
+	node = allocate(alloc, sizeof(struct tree));
+	node->kind = kind;
+	node->left = left;
+	node->mid = mid;
+	node->right = right;
+	node->token = NULL;
+	node->type = NULL;
+	return node;
+}
+
+/*
+ * Create a node with two children.
+ */
+struct tree *mkastbinary(struct allocator *alloc, int kind,
+    struct tree *left, struct tree *right) {
+	return mkastnode(alloc, kind, left, NULL, right);
+}
+
+/*
+ * Create a node with one child.
+ */
+struct tree *mkastunary(struct allocator *alloc, int kind,
+    struct tree *child) {
+	return mkastnode(alloc, kind, child, NULL, NULL);
+}
+
+/*
+ * Create a node declaring a name with the given type and initializer.
+ */
+struct tree *mkastdecl(struct allocator *alloc, struct token *name,
+    struct type *type, struct tree *init) {
+	struct tree *node;
+
+	node = mkastnode(alloc, AST_DECL, init, NULL, NULL);
+	node->token = name;
+	node->type = type;
+	return node;
+}
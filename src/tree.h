@@ -0,0 +1,62 @@
+#ifndef _TREE_H_
+#define _TREE_H_
+
+enum {
+	/* Lists and declarations */
+	AST_GLUE, AST_DECL, AST_STATICASSERT, AST_FUNCDEF,
+
+	/* Binary operators */
+	AST_LOR, AST_LAND, AST_OR, AST_XOR, AST_AND, AST_EQ, AST_NE, AST_LT,
+	AST_GT, AST_LE, AST_GE, AST_LSHIFT, AST_RSHIFT, AST_ADD, AST_SUB,
+	AST_MUL, AST_DIV, AST_MOD,
+
+	/* Assignments */
+	AST_ASSIGN, AST_MULASSIGN, AST_DIVASSIGN, AST_MODASSIGN,
+	AST_ADDASSIGN, AST_SUBASSIGN, AST_LSHIFTASSIGN, AST_RSHIFTASSIGN,
+	AST_ANDASSIGN, AST_ORASSIGN, AST_XORASSIGN,
+
+	/* Unary operators */
+	AST_ADDR, AST_DEREF, AST_POS, AST_NEG, AST_COMPL, AST_LNOT,
+	AST_PREINC, AST_PREDEC,
+
+	/* Expressions */
+	AST_NAME, AST_NUM, AST_STRLIT, AST_CAST, AST_COND,
+	AST_SIZEOF, AST_ALIGNOF, AST_GENERICSEL, AST_GENERICASSOC,
+	AST_COMPOUNDEXPR, AST_INDEX, AST_CALL, AST_MEMBER, AST_PTRMEMBER,
+	AST_POSTINC, AST_POSTDEC, AST_COMPOUNDLIT,
+
+	/* Initializers */
+	AST_INITLIST, AST_DESIGNATION, AST_INDEXDESIG, AST_FIELDDESIG,
+
+	/* Statements */
+	AST_BLOCK, AST_IFSTMT, AST_WHILESTMT, AST_DOSTMT, AST_FORSTMT,
+	AST_FORSTEP, AST_SWITCHSTMT, AST_CASE, AST_DEFAULTCASE, AST_LABEL,
+	AST_GOTO, AST_CONTINUE, AST_BREAK, AST_RETURN,
+};
+
+/*
+ * A node in the abstract-syntax-tree. Lists are built out of AST_GLUE
+ * nodes, with the rest of the list on the left and the next item on the
+ * right.
+ */
+struct tree {
+	int kind;		/* kind of node */
+	struct tree *left;	/* first child */
+	struct tree *mid;	/* middle child of three-way nodes */
+	struct tree *right;	/* last child */
+	struct token *token;	/* token node came from */
+	struct type *type;	/* declared type of declarations */
+};
+
+struct allocator;
+
+struct tree *mkastnode(struct allocator *alloc, int kind, struct tree *left,
+    struct tree *mid, struct tree *right);
+struct tree *mkastbinary(struct allocator *alloc, int kind,
+    struct tree *left, struct tree *right);
+struct tree *mkastunary(struct allocator *alloc, int kind,
+    struct tree *child);
+struct tree *mkastdecl(struct allocator *alloc, struct token *name,
+    struct type *type, struct tree *init);
+
+#endif /* !_TREE_H_ */
@@ -0,0 +1,254 @@
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "type.h"
+
+/*
+ * Table of every interned type. Grows by doubling once the number of types
+ * reaches the number of buckets, so chains stay short. Types are shared by
+ * every thread, so the table is only touched with the lock held; interned
+ * types themselves are never modified, and need no lock.
+ */
+static struct type **typetab;
+static int ntypebucket;
+static int ntype;
+static long ntagid;
+static pthread_mutex_t typelock = PTHREAD_MUTEX_INITIALIZER;
+
+/*
+ * Mix a value into a hash.
+ */
+static unsigned long mix(unsigned long hash, unsigned long value) {
+	return (hash ^ value) * 1099511628211UL;
+}
+
+/*
+ * Compute the hash of a type from its fields. Component types are already
+ * interned, so their addresses can be hashed directly.
+ */
+static unsigned long hashtype(struct type *type) {
+	unsigned long hash;
+	char *s;
+	int i;
+
+	hash = 14695981039346656037UL;
+	hash = mix(hash, type->kind);
+	hash = mix(hash, type->quals);
+	hash = mix(hash, type->length);
+	hash = mix(hash, (unsigned long)type->base);
+	hash = mix(hash, type->variadic | type->noproto << 1);
+	hash = mix(hash, type->id);
+	for (i = 0; i < type->nparam; i++)
+		hash = mix(hash, (unsigned long)type->params[i]);
+	if (type->tag != NULL) {
+		for (s = type->tag; *s != '\0'; s++)
+			hash = mix(hash, (unsigned char)*s);
+	}
+	return hash;
+}
+
+/*
+ * Return true if two types have the same structure. Only needs to look one
+ * level deep, since component types are interned.
+ */
+static int sametype(struct type *a, struct type *b) {
+	int i;
+
+	if (a->hash != b->hash || a->kind != b->kind || a->quals != b->quals
+	    || a->length != b->length || a->base != b->base
+	    || a->nparam != b->nparam || a->variadic != b->variadic
+	    || a->noproto != b->noproto || a->id != b->id)
+		return 0;
+	for (i = 0; i < a->nparam; i++) {
+		if (a->params[i] != b->params[i])
+			return 0;
+	}
+	if (a->tag == NULL || b->tag == NULL)
+		return a->tag == b->tag;
+	return !strcmp(a->tag, b->tag);
+}
+
+/*
+ * Double the number of buckets and re-insert every type.
+ */
+static void grow(void) {
+	struct type **table, *type, *next;
+	int i, size;
+
+	size = ntypebucket ? ntypebucket * 2 : NTYPEBUCKET;
+	table = calloc(size, sizeof(struct type *));
+	for (i = 0; i < ntypebucket; i++) {
+		for (type = typetab[i]; type != NULL; type = next) {
+			next = type->next;
+			type->next = table[type->hash & (size - 1)];
+			table[type->hash & (size - 1)] = type;
+		}
+	}
+	free(typetab);
+	typetab = table;
+	ntypebucket = size;
+}
+
+/*
+ * Return the canonical node for the given type, creating it if it has not
+ * been seen before. The key may live on the stack; it is copied if needed.
+ */
+static struct type *intern(struct type *key) {
+	struct type *type;
+	int bucket;
+
+	key->hash = hashtype(key);
+	pthread_mutex_lock(&typelock);
+	if (ntype >= ntypebucket)
+		grow();
+	bucket = key->hash & (ntypebucket - 1);
+	for (type = typetab[bucket]; type != NULL; type = type->next) {
+		if (sametype(type, key)) {
+			pthread_mutex_unlock(&typelock);
+			return type;
+		}
+	}
+	type = malloc(sizeof(struct type));
+	*type = *key;
+	if (key->nparam > 0) {
+		type->params = malloc(key->nparam * sizeof(struct type *));
+		memcpy(type->params, key->params,
+		    key->nparam * sizeof(struct type *));
+	}
+	if (key->tag != NULL)
+		type->tag = strdup(key->tag);
+	type->next = typetab[bucket];
+	typetab[bucket] = type;
+	ntype++;
+	pthread_mutex_unlock(&typelock);
+	return type;
+}
+
+/*
+ * Return a type with every field cleared.
+ */
+static struct type blank(int kind) {
+	struct type type;
+
+	memset(&type, 0, sizeof(type));
+	type.kind = kind;
+	type.length = -1;
+	return type;
+}
+
+/*
+ * Get a primitive type.
+ */
+struct type *mkbasetype(int kind) {
+	struct type type;
+
+	type = blank(kind);
+	return intern(&type);
+}
+
+/*
+ * Get a struct, union or enum type by its tag, as declared at file scope.
+ */
+struct type *mktagtype(int kind, char *tag) {
+	struct type type;
+
+	type = blank(kind);
+	type.tag = tag;
+	return intern(&type);
+}
+
+/*
+ * Get a new struct, union or enum type, distinct from every other, for a
+ * tag declared in a block or for a type with no tag at all. `tag` may be
+ * NULL.
+ */
+struct type *mkscopedtag(int kind, char *tag) {
+	struct type type;
+
+	type = blank(kind);
+	type.tag = tag;
+	pthread_mutex_lock(&typelock);
+	type.id = ++ntagid;
+	pthread_mutex_unlock(&typelock);
+	return intern(&type);
+}
+
+/*
+ * Get a pointer to the given type.
+ */
+struct type *mkptrtype(struct type *base) {
+	struct type type;
+
+	type = blank(TY_PTR);
+	type.base = base;
+	return intern(&type);
+}
+
+/*
+ * Get an array of the given type. A length of -1 means it is unknown.
+ */
+struct type *mkarraytype(struct type *base, long length) {
+	struct type type;
+
+	type = blank(TY_ARRAY);
+	type.base = base;
+	type.length = length;
+	return intern(&type);
+}
+
+/*
+ * Get a function returning the given type.
+ */
+struct type *mkfunctype(struct type *ret, struct type **params, int nparam,
+    int variadic) {
+	struct type type;
+
+	type = blank(TY_FUNC);
+	type.base = ret;
+	type.params = params;
+	type.nparam = nparam;
+	type.variadic = variadic;
+	return intern(&type);
+}
+
+/*
+ * Get a function returning the given type, declared without a prototype,
+ * as in `int f()`. It is not the same type as `int f(void)`.
+ */
+struct type *mknoprototype(struct type *ret) {
+	struct type type;
+
+	type = blank(TY_FUNC);
+	type.base = ret;
+	type.noproto = 1;
+	return intern(&type);
+}
+
+/*
+ * Get the given type with extra qualifiers added.
+ */
+struct type *mkqualtype(struct type *type, int quals) {
+	struct type key;
+
+	if ((type->quals | quals) == type->quals)
+		return type;
+	key = *type;
+	key.quals |= quals;
+	key.next = NULL;
+	return intern(&key);
+}
+
+/*
+ * Get the given type without any qualifiers.
+ */
+struct type *unqual(struct type *type) {
+	struct type key;
+
+	if (type->quals == 0)
+		return type;
+	key = *type;
+	key.quals = 0;
+	key.next = NULL;
+	return intern(&key);
+}
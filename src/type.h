@@ -0,0 +1,69 @@
+#ifndef _TYPE_H_
+#define _TYPE_H_
+
+/*
+ * Kinds of types.
+ */
+enum {
+	TY_VOID, TY_BOOL,
+
+	/* Integers, each signed kind followed by its unsigned one */
+	TY_CHAR, TY_SCHAR, TY_UCHAR, TY_SHORT, TY_USHORT, TY_INT, TY_UINT,
+	TY_LONG, TY_ULONG, TY_LLONG, TY_ULLONG,
+
+	/* Floating types */
+	TY_FLOAT, TY_DOUBLE, TY_LDOUBLE,
+
+	TY_STRUCT, TY_UNION, TY_ENUM,
+
+	/* Derived types */
+	TY_PTR, TY_ARRAY, TY_FUNC,
+};
+
+/*
+ * Type qualifiers, stored as a bit-set.
+ */
+#define TQ_CONST	0x1
+#define TQ_VOLATILE	0x2
+#define TQ_RESTRICT	0x4
+#define TQ_ATOMIC	0x8
+
+/*
+ * How many buckets the type-table starts with. Must be a power of two.
+ */
+#define NTYPEBUCKET	256
+
+/*
+ * Types are hash-consed: exactly one node exists for each distinct type, so
+ * two types are the same if and only if their pointers are equal. Interned
+ * nodes must never be modified. A tag declared at file scope names the same
+ * type wherever it appears and has an `id` of 0; an untagged type, or one
+ * declared in a block, is given an `id` of its own.
+ */
+struct type {
+	int kind;		/* kind of type */
+	int quals;		/* qualifier bit-set */
+	long length;		/* length of array, -1 if unknown */
+	struct type *base;	/* pointed-to, element or return type */
+	struct type **params;	/* parameter types of function */
+	int nparam;		/* number of parameters */
+	int variadic;		/* function takes variable arguments */
+	int noproto;		/* function declared without a prototype */
+	char *tag;		/* tag of struct, union or enum */
+	long id;		/* tells apart types with the same tag */
+	unsigned long hash;	/* cached hash of type */
+	struct type *next;	/* next type in hash-bucket */
+};
+
+struct type *mkbasetype(int kind);
+struct type *mktagtype(int kind, char *tag);
+struct type *mkscopedtag(int kind, char *tag);
+struct type *mkptrtype(struct type *base);
+struct type *mkarraytype(struct type *base, long length);
+struct type *mkfunctype(struct type *ret, struct type **params, int nparam,
+    int variadic);
+struct type *mknoprototype(struct type *ret);
+struct type *mkqualtype(struct type *type, int quals);
+struct type *unqual(struct type *type);
+
+#endif /* !_TYPE_H_ */
@@ -0,0 +1,11 @@
+#ifndef _UTF8_H_
+#define _UTF8_H_
+
+#include <stdbool.h>
+
+int utf8decode(char *src, int length, long *cp);
+int utf8valid(char *src, int length);
+bool isidstart(long cp);
+bool isidcontinue(long cp);
+
+#endif /* !_UTF8_H_ */
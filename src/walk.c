@@ -0,0 +1,327 @@
+#include <pthread.h>
+#include <setjmp.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "arena.h"
+#include "alloc.h"
+#include "tree.h"
+#include "parse.h"
+#include "walk.h"
+
+/*
+ * Nodes the walk stack holds before it moves to the heap.
+ */
+#define WALKSTACK	64
+
+/*
+ * Visit every node of a tree before its children, left to right. Children
+ * of a node are skipped if `visit` returns zero for it. The nodes still to
+ * be visited are kept on a stack of our own rather than the C stack, so
+ * long lists and deep expressions cannot run it out.
+ */
+void walk(struct tree *root, int (*visit)(struct tree *node, void *ctx),
+    void *ctx) {
+	struct tree *local[WALKSTACK], **stack, *node;
+	size_t top, size;
+
+	stack = local;
+	size = WALKSTACK;
+	top = 0;
+	if (root != NULL)
+		stack[top++] = root;
+	while (top > 0) {
+		node = stack[--top];
+		if (!visit(node, ctx))
+			continue;
+		if (top + 3 > size) {
+			size *= 2;
+			if (stack == local) {
+				stack = malloc(size * sizeof(struct tree *));
+				memcpy(stack, local, top * sizeof(struct tree *));
+			} else {
+				stack = realloc(stack,
+				    size * sizeof(struct tree *));
+			}
+		}
+		if (node->right != NULL)
+			stack[top++] = node->right;
+		if (node->mid != NULL)
+			stack[top++] = node->mid;
+		if (node->left != NULL)
+			stack[top++] = node->left;
+	}
+	if (stack != local)
+		free(stack);
+}
+
+/*
+ * What a sweep is looking for.
+ */
+struct sweep {
+	int kind;		/* kind of node, or -1 for any */
+	void (*visit)(struct tree *node, void *ctx);
+	void *ctx;		/* passed to visit */
+};
+
+static void sweepnode(void *obj, void *ctx) {
+	struct sweep *sweep;
+	struct tree *node;
+
+	sweep = ctx;
+	node = obj;
+	if (sweep->kind < 0 || node->kind == sweep->kind)
+		sweep->visit(node, sweep->ctx);
+}
+
+/*
+ * Visit every node of the given kind, or of any kind if it is -1, that the
+ * parser made for the current source and still holds, in the order they
+ * were made. Nodes of imported headers belong to the header's parser and
+ * are not visited. While streaming, the parser holds just the declaration
+ * being emitted. The parser's own arena holds nothing but nodes, so this
+ * is a single pass over memory with no pointers followed. Nodes from a
+ * supplied allocator are mixed with other memory, so the parser's record
+ * of them is gone through instead.
+ */
+void sweep(struct parser *parser, int kind,
+    void (*visit)(struct tree *node, void *ctx), void *ctx) {
+	struct sweep want;
+	int i;
+
+	want.kind = kind;
+	want.visit = visit;
+	want.ctx = ctx;
+	if (parser->alloc == &parser->own) {
+		arenascan(&parser->nodes, sizeof(struct tree), sweepnode,
+		    &want);
+		return;
+	}
+	for (i = 0; i < parser->nmade; i++)
+		sweepnode(parser->made[i], &want);
+}
+
+/*
+ * Items of a tree gathered into a list.
+ */
+struct items {
+	struct tree **items;	/* items in source order */
+	int count;		/* number of items */
+	int capacity;		/* items allocated */
+};
+
+static int additem(struct tree *node, void *ctx) {
+	struct items *list;
+
+	if (node->kind == AST_GLUE)
+		return 1;
+	list = ctx;
+	if (list->count == list->capacity) {
+		list->capacity = list->capacity ? list->capacity * 2 : 64;
+		list->items = realloc(list->items,
+		    list->capacity * sizeof(struct tree *));
+	}
+	list->items[list->count++] = node;
+	return 0;
+}
+
+/*
+ * A fan-out being run. Its items are handed out a chunk at a time to
+ * whichever thread asks next, so a thread that gets cheap items just takes
+ * more of them. Each chunk is written to a buffer of its own.
+ */
+struct job {
+	struct tree **items;	/* items in source order */
+	int count;		/* number of items */
+	int chunk;		/* items handed out at a time */
+	int taken;		/* items handed out so far */
+	int helpers;		/* pool threads that may still join */
+	int busy;		/* pool threads working on it */
+	void (*visit)(struct tree *item, struct outbuf *out, void *ctx);
+	void *ctx;		/* passed to visit */
+	struct outbuf *outs;	/* output of each chunk */
+	pthread_cond_t done;	/* signalled when busy drops to zero */
+	struct job *link;	/* next job waiting for threads */
+};
+
+/*
+ * Threads kept to help with fan-outs. They are started as they are first
+ * needed and live as long as the process, waiting for jobs in between.
+ */
+static pthread_mutex_t fanlock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t fanwork = PTHREAD_COND_INITIALIZER;
+static struct job *jobs;	/* jobs that want more threads */
+static int nhelper;		/* threads started */
+static int nidle;		/* threads waiting for a job */
+
+/*
+ * Take a job off the list of those wanting threads. Called with fanlock
+ * held.
+ */
+static void unqueue(struct job *job) {
+	struct job **p;
+
+	for (p = &jobs; *p != NULL; p = &(*p)->link) {
+		if (*p == job) {
+			*p = job->link;
+			return;
+		}
+	}
+}
+
+/*
+ * Visit the items of a job a chunk at a time until none are left.
+ */
+static void runjob(struct job *job) {
+	struct outbuf *out;
+	int first, last, i;
+
+	for (;;) {
+		pthread_mutex_lock(&fanlock);
+		first = job->taken;
+		if (first < job->count)
+			job->taken += job->chunk;
+		if (job->taken >= job->count)
+			unqueue(job);
+		pthread_mutex_unlock(&fanlock);
+		if (first >= job->count)
+			return;
+		last = first + job->chunk < job->count ? first + job->chunk
+		    : job->count;
+		out = &job->outs[first / job->chunk];
+		for (i = first; i < last; i++)
+			job->visit(job->items[i], out, job->ctx);
+	}
+}
+
+static void *helper(void *arg) {
+	struct job *job;
+
+	pthread_mutex_lock(&fanlock);
+	for (;;) {
+		while (jobs == NULL) {
+			nidle++;
+			pthread_cond_wait(&fanwork, &fanlock);
+			nidle--;
+		}
+		job = jobs;
+		job->busy++;
+		if (--job->helpers == 0)
+			unqueue(job);
+		pthread_mutex_unlock(&fanlock);
+		runjob(job);
+		pthread_mutex_lock(&fanlock);
+		if (--job->busy == 0)
+			pthread_cond_signal(&job->done);
+	}
+	return NULL;
+}
+
+/*
+ * Visit each item of a list in parallel on up to `nthread` threads, and
+ * append what the visitors wrote to `out` in source order, so the output is
+ * the same no matter how many threads there are. The calling thread works
+ * through the list along with up to `nthread` - 1 threads from a pool that
+ * is kept between calls, so nothing is started once the pool is big
+ * enough. Items are handed out in chunks of neighbouring ones, each
+ * written to a buffer of its own, and a thread takes another chunk as soon
+ * as it is done with one, so uneven items do not leave threads idle.
+ * Visitors share the tree, so they must not change it. Returns the number
+ * of items visited.
+ */
+int fanout(struct tree *root, int nthread,
+    void (*visit)(struct tree *item, struct outbuf *out, void *ctx),
+    void *ctx, struct outbuf *out) {
+	struct items list;
+	struct job job;
+	pthread_t thread;
+	int i, nchunk;
+
+	memset(&list, 0, sizeof(list));
+	walk(root, additem, &list);
+	if (nthread > MAXTHREAD)
+		nthread = MAXTHREAD;
+	if (nthread > list.count)
+		nthread = list.count;
+	if (nthread < 1)
+		nthread = 1;
+
+	/*
+	 * Several chunks for each thread, so that there are some to go
+	 * round once the first are done.
+	 */
+	job.items = list.items;
+	job.count = list.count;
+	job.chunk = list.count / (nthread * FANCHUNKS);
+	if (job.chunk < 1)
+		job.chunk = 1;
+	nchunk = (list.count + job.chunk - 1) / job.chunk;
+	job.taken = 0;
+	job.helpers = nthread - 1;
+	job.busy = 0;
+	job.visit = visit;
+	job.ctx = ctx;
+	job.outs = calloc(nchunk > 0 ? nchunk : 1, sizeof(struct outbuf));
+	pthread_cond_init(&job.done, NULL);
+	if (job.helpers > 0) {
+		pthread_mutex_lock(&fanlock);
+		job.link = jobs;
+		jobs = &job;
+		/*
+		 * Start more threads if there are not enough idle ones. If
+		 * one cannot be started, the threads there are do the work.
+		 */
+		for (i = nidle; i < job.helpers && nhelper < MAXTHREAD - 1;
+		    i++) {
+			if (pthread_create(&thread, NULL, helper, NULL) != 0)
+				break;
+			pthread_detach(thread);
+			nhelper++;
+		}
+		pthread_cond_broadcast(&fanwork);
+		pthread_mutex_unlock(&fanlock);
+	}
+	runjob(&job);
+	/*
+	 * Every item has been handed out, but helpers may still be busy
+	 * with theirs.
+	 */
+	pthread_mutex_lock(&fanlock);
+	unqueue(&job);
+	while (job.busy > 0)
+		pthread_cond_wait(&job.done, &fanlock);
+	pthread_mutex_unlock(&fanlock);
+	pthread_cond_destroy(&job.done);
+	for (i = 0; i < nchunk; i++) {
+		outappend(out, job.outs[i].data, job.outs[i].length);
+		outfree(&job.outs[i]);
+	}
+	free(job.outs);
+	free(list.items);
+	return list.count;
+}
+
+/*
+ * Append bytes to an output buffer, growing it if need be.
+ */
+void outappend(struct outbuf *out, const void *data, size_t length) {
+	if (length == 0)
+		return;
+	if (out->length + length > out->capacity) {
+		if (out->capacity == 0)
+			out->capacity = 256;
+		while (out->length + length > out->capacity)
+			out->capacity *= 2;
+		out->data = realloc(out->data, out->capacity);
+	}
+	memcpy(&out->data[out->length], data, length);
+	out->length += length;
+}
+
+/*
+ * Release the memory of an output buffer and empty it.
+ */
+void outfree(struct outbuf *out) {
+	free(out->data);
+	memset(out, 0, sizeof(struct outbuf));
+}
@@ -0,0 +1,37 @@
+#ifndef _WALK_H_
+#define _WALK_H_
+
+#include <stddef.h>
+
+/*
+ * Most threads `fanout` runs on, counting the calling thread, and how many
+ * chunks it splits a list into for each thread.
+ */
+#define MAXTHREAD	64
+#define FANCHUNKS	8
+
+/*
+ * Output of a visitor. Each chunk of a fan-out is written to its own
+ * buffer, and the buffers are joined in source order once every chunk is
+ * done.
+ */
+struct outbuf {
+	char *data;		/* bytes written */
+	size_t length;		/* number of bytes written */
+	size_t capacity;	/* bytes allocated for data */
+};
+
+struct tree;
+struct parser;
+
+void walk(struct tree *root, int (*visit)(struct tree *node, void *ctx),
+    void *ctx);
+void sweep(struct parser *parser, int kind,
+    void (*visit)(struct tree *node, void *ctx), void *ctx);
+int fanout(struct tree *root, int nthread,
+    void (*visit)(struct tree *item, struct outbuf *out, void *ctx),
+    void *ctx, struct outbuf *out);
+void outappend(struct outbuf *out, const void *data, size_t length);
+void outfree(struct outbuf *out);
+
+#endif /* !_WALK_H_ */
@@ -0,0 +1,138 @@
+#include <pthread.h>
+#include <setjmp.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "token.h"
+#include "arena.h"
+#include "alloc.h"
+#include "error.h"
+#include "lex.h"
+#include "cpp.h"
+#include "parse.h"
+#include "compile.h"
+
+/*
+ * How many blocks each check takes from the pool. Every eighth is too big
+ * for a size-class.
+ */
+#define NBLOCK	4096
+
+/*
+ * Blocks taken from the pool by one thread, to be freed by another.
+ */
+struct blocks {
+	void *ptrs[NBLOCK];	/* blocks taken */
+	size_t sizes[NBLOCK];	/* size of each block */
+};
+
+static size_t blocksize(int i) {
+	return i % 8 == 7 ? 10000 + i : 8 + i % 500;
+}
+
+/*
+ * Take blocks from the calling thread's pool, writing to all of each.
+ */
+static void *take(void *arg) {
+	struct blocks *blocks;
+	int i;
+
+	blocks = arg;
+	for (i = 0; i < NBLOCK; i++) {
+		blocks->sizes[i] = blocksize(i);
+		blocks->ptrs[i] = allocate(&poolalloc, blocks->sizes[i]);
+		memset(blocks->ptrs[i], i, blocks->sizes[i]);
+	}
+	return NULL;
+}
+
+/*
+ * Free blocks, checking that nothing wrote over them.
+ */
+static void *give(void *arg) {
+	struct blocks *blocks;
+	unsigned char *ptr;
+	size_t j;
+	int i;
+
+	blocks = arg;
+	for (i = 0; i < NBLOCK; i++) {
+		ptr = blocks->ptrs[i];
+		for (j = 0; j < blocks->sizes[i]; j++) {
+			if (ptr[j] != (unsigned char)i) {
+				fprintf(stderr, "block %d overwritten\n", i);
+				exit(1);
+			}
+		}
+		deallocate(&poolalloc, ptr, blocks->sizes[i]);
+	}
+	return NULL;
+}
+
+static void run(void *(*fn)(void *), struct blocks *blocks) {
+	pthread_t thread;
+
+	pthread_create(&thread, NULL, fn, blocks);
+	pthread_join(thread, NULL);
+}
+
+/*
+ * Compile a source with tokens and nodes from the pool, then reset it as
+ * the server does after each request. Returns the number of errors.
+ */
+static int compiletu(struct cpp *cpp, struct parser *parser, char *source) {
+	struct diagbuf diags;
+	int count;
+
+	memset(&diags, 0, sizeof(diags));
+	compile(cpp, parser, "<alloc>", source, strlen(source), &diags);
+	count = diags.count;
+	clearerrors(&diags);
+	cppforget(cpp);
+	parseforget(parser);
+	resetalloc(&poolalloc);
+	return count;
+}
+
+/*
+ * Check that blocks can be freed on threads other than the one that took
+ * them, both while it is running and after it has exited, and that the
+ * pool can be reset between translation units.
+ */
+int main(void) {
+	static struct blocks blocks;
+	static struct cpp cpp;
+	struct parser parser;
+	char *source;
+	int i;
+
+	/*
+	 * Taken here and freed on another thread, then taken again here,
+	 * where they must not be handed out twice.
+	 */
+	take(&blocks);
+	run(give, &blocks);
+	take(&blocks);
+	give(&blocks);
+	/*
+	 * Taken on a thread that exits before they are freed.
+	 */
+	run(take, &blocks);
+	give(&blocks);
+
+	source = "typedef int t;\nint f(t a) { return (t)(a) + 1; }\n"
+	    "int g(void) { return f(2) * sizeof(t); }\n";
+	cpp.main.alloc = &poolalloc;
+	memset(&parser, 0, sizeof(parser));
+	parser.alloc = &poolalloc;
+	for (i = 0; i < 64; i++) {
+		if (compiletu(&cpp, &parser, source) != 0) {
+			fprintf(stderr, "compile %d gave errors\n", i);
+			return 1;
+		}
+	}
+	printf("pool blocks freed across threads, pool reset %d times\n", i);
+	return 0;
+}
@@ -0,0 +1,255 @@
+#include <setjmp.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "token.h"
+#include "arena.h"
+#include "alloc.h"
+#include "intern.h"
+#include "error.h"
+#include "lex.h"
+#include "cpp.h"
+#include "parse.h"
+#include "header.h"
+#include "compile.h"
+
+/*
+ * Conditions that must hold in `#if`, where integers are intmax_t or
+ * uintmax_t and either operand being unsigned makes both so.
+ */
+static char *conds[] = {
+	"-1 > 0u",
+	"-1 < 0",
+	"0xFFFFFFFFFFFFFFFF == -1",
+	"18446744073709551615 > 0",
+	"(0 ? 1u : -1) > 0",
+	"-1 >> 1 == -1",
+	"(0u - 1) >> 63 == 1",
+	"-9223372036854775807 - 1 < 0",
+	"-1 / 2u > 0",
+	"-7 / 2 == -3 && -7 % 2 == -1",
+	"!defined(UNDEFINED) && UNDEFINED == 0",
+};
+
+#define NCOND	(sizeof(conds) / sizeof(conds[0]))
+
+/*
+ * Headers that end oddly, with how many errors including one gives and
+ * the guard macro that should be found for it, if any. A null directive
+ * must not hide the `#endif` after it, and a `#` at the very end must not
+ * be read past.
+ */
+struct guardcase {
+	char *name;		/* file name of header */
+	char *text;		/* contents of header */
+	int errors;		/* errors including it should give */
+	char *guard;		/* guard macro, NULL if none */
+};
+
+static struct guardcase guardcases[] = {
+	{ "eof.h", "#ifndef G1\n#define G1\nint x;\n#\n", 1, NULL },
+	{ "null.h", "#ifndef G2\n#define G2\n#\n#endif\n", 0, "G2" },
+	{ "plain.h", "#ifndef G3\n#define G3\nint y;\n#endif\n", 0, "G3" },
+};
+
+#define NGUARDCASE	(sizeof(guardcases) / sizeof(guardcases[0]))
+
+/*
+ * How many headers the streaming check includes, and how many declarations
+ * each has. Every declaration is three tokens, and each header ends with
+ * an end-of-file token.
+ */
+#define NSTREAMHDR	100
+#define NSTREAMDECL	20
+#define HDRTOKENS	(NSTREAMDECL * 3 + 1)
+
+/*
+ * Blocks taken from the counting allocator and not yet handed back, and the
+ * most there were when a declaration was emitted.
+ */
+static long live, peak;
+
+static void *countget(void *ctx, size_t size) {
+	live++;
+	return malloc(size);
+}
+
+static void *countresize(void *ctx, void *ptr, size_t old, size_t size) {
+	if (ptr == NULL)
+		live++;
+	return realloc(ptr, size);
+}
+
+static void countput(void *ctx, void *ptr, size_t size) {
+	if (ptr != NULL)
+		live--;
+	free(ptr);
+}
+
+static void notepeak(struct tree *decl, void *sink) {
+	if (live > peak)
+		peak = live;
+}
+
+/*
+ * Compile a source, returning the number of errors it gave.
+ */
+static int errors(struct cpp *cpp, struct parser *parser, char *source) {
+	struct diagbuf diags;
+	int count;
+
+	memset(&diags, 0, sizeof(diags));
+	compile(cpp, parser, "<cpp>", source, strlen(source), &diags);
+	count = diags.count;
+	clearerrors(&diags);
+	return count;
+}
+
+/*
+ * Check that each `#if` condition holds. Returns 0 if all do, or -1 if not.
+ */
+static int checkconds(struct cpp *cpp, struct parser *parser) {
+	char source[256];
+	int i, status;
+
+	status = 0;
+	for (i = 0; i < (int)NCOND; i++) {
+		snprintf(source, sizeof(source),
+		    "#if %s\nint ok;\n#else\n#error wrong\n#endif\n",
+		    conds[i]);
+		if (errors(cpp, parser, source) != 0) {
+			fprintf(stderr, "#if %s: does not hold\n", conds[i]);
+			status = -1;
+		}
+	}
+	return status;
+}
+
+/*
+ * Include each header from a source and check the errors it gives and the
+ * guard found for it. Returns 0 if they are as wanted, or -1 if not.
+ */
+static int checkguards(struct cpp *cpp, struct parser *parser, char *dir) {
+	struct guardcase *c;
+	char path[MAXPATH], source[MAXPATH + 64];
+	unsigned long want;
+	FILE *file;
+	int i, count, status;
+
+	status = 0;
+	for (i = 0; i < (int)NGUARDCASE; i++) {
+		c = &guardcases[i];
+		snprintf(path, sizeof(path), "%s/%s", dir, c->name);
+		if ((file = fopen(path, "w")) == NULL) {
+			perror(path);
+			return -1;
+		}
+		fputs(c->text, file);
+		fclose(file);
+		snprintf(source, sizeof(source), "#include \"%s\"\nint z;\n",
+		    path);
+		count = errors(cpp, parser, source);
+		want = c->guard != NULL ? (unsigned long)internstr(c->guard,
+		    strlen(c->guard)) : 0;
+		if (count != c->errors) {
+			fprintf(stderr, "%s: %d errors, want %d\n", c->name,
+			    count, c->errors);
+			status = -1;
+		} else if (count == 0 && cppdep(cpp, DEP_GUARD,
+		    internstr(path, strlen(path))) != want) {
+			fprintf(stderr, "%s: guard %s not found\n", c->name,
+			    c->guard != NULL ? c->guard : "(none)");
+			status = -1;
+		}
+		unlink(path);
+	}
+	return status;
+}
+
+/*
+ * Stream a source that includes many headers, with tokens from a counting
+ * allocator, and check that the tokens of each header are freed once it is
+ * finished rather than kept to the end. Returns 0 if so, or -1 if not.
+ */
+static int checkstream(char *dir) {
+	static struct cpp cpp;
+	struct allocator alloc;
+	struct parser parser;
+	struct diagbuf diags;
+	char path[MAXPATH], *source;
+	FILE *file;
+	int i, j, length, status;
+
+	source = malloc(NSTREAMHDR * (MAXPATH + 16));
+	length = 0;
+	for (i = 0; i < NSTREAMHDR; i++) {
+		snprintf(path, sizeof(path), "%s/s%d.h", dir, i);
+		if ((file = fopen(path, "w")) == NULL) {
+			perror(path);
+			free(source);
+			return -1;
+		}
+		for (j = 0; j < NSTREAMDECL; j++)
+			fprintf(file, "int s%d_%d;\n", i, j);
+		fclose(file);
+		length += sprintf(&source[length], "#include \"%s\"\n", path);
+	}
+	alloc.alloc = countget;
+	alloc.resize = countresize;
+	alloc.free = countput;
+	alloc.reset = NULL;
+	alloc.ctx = NULL;
+	cpp.main.alloc = &alloc;
+	memset(&parser, 0, sizeof(parser));
+	memset(&diags, 0, sizeof(diags));
+	status = 0;
+	if (compilestream(&cpp, &parser, "<stream>", source, length, &diags,
+	    notepeak, NULL) < 0 || diags.count > 0) {
+		fprintf(stderr, "streaming gave %d errors\n", diags.count);
+		status = -1;
+	} else if (peak >= 3 * HDRTOKENS) {
+		fprintf(stderr, "%ld tokens held while streaming, want fewer "
+		    "than %d\n", peak, 3 * HDRTOKENS);
+		status = -1;
+	}
+	clearerrors(&diags);
+	for (i = 0; i < NSTREAMHDR; i++) {
+		snprintf(path, sizeof(path), "%s/s%d.h", dir, i);
+		unlink(path);
+	}
+	free(source);
+	return status;
+}
+
+/*
+ * Check how `#if` evaluates, how guards are found in headers that end
+ * oddly, and that streaming frees the tokens of headers as it goes.
+ */
+int main(void) {
+	static struct cpp cpp;
+	struct parser parser;
+	char dir[] = "/tmp/cppXXXXXX";
+	int status;
+
+	memset(&parser, 0, sizeof(parser));
+	if (mkdtemp(dir) == NULL) {
+		perror(dir);
+		return 1;
+	}
+	status = 0;
+	if (checkconds(&cpp, &parser) < 0)
+		status = 1;
+	if (checkguards(&cpp, &parser, dir) < 0)
+		status = 1;
+	if (checkstream(dir) < 0)
+		status = 1;
+	rmdir(dir);
+	if (status == 0)
+		printf("%d #if conditions hold, %d headers guarded as they "
+		    "should be, at most %ld tokens held streaming %d headers\n",
+		    (int)NCOND, (int)NGUARDCASE, peak, NSTREAMHDR);
+	return status;
+}
@@ -0,0 +1,148 @@
+#include <setjmp.h>
+#include <stdarg.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "token.h"
+#include "arena.h"
+#include "alloc.h"
+#include "error.h"
+#include "lex.h"
+#include "cpp.h"
+#include "parse.h"
+#include "compile.h"
+#include "index.h"
+
+/*
+ * A source with a symbol of every kind, and declarations with syntax errors
+ * whose symbols were found before the error. Those must not be indexed.
+ * Tags are indexed where their bodies are, not where they are used.
+ */
+static char source[] =
+	"typedef int t;\n"
+	"extern t keep;\n"
+	"t keep = 1;\n"
+	"int lost = other + ;\n"
+	"int early, late garbage;\n"
+	"int f(int a) { return a + keep; }\n"
+	"struct pt { int px, py; } origin;\n"
+	"struct pt corner;\n"
+	"enum color { RED, GREEN = 2 };\n"
+	"union u { struct pt p; long raw : 3; };\n"
+	"int shade = GREEN;\n"
+	"struct lostag { int lostmem; } bad = ;\n";
+
+/*
+ * What the index should hold for a name, in order.
+ */
+struct want {
+	char *name;
+	int count;		/* number of entries */
+	int lines[2];		/* line of each entry */
+	int kinds[2];		/* kind of each entry */
+};
+
+static struct want wants[] = {
+	{ "t", 1, { 1 }, { IX_TYPEDEF } },
+	{ "keep", 3, { 2, 3 }, { IX_DECL, IX_DEF } },
+	{ "f", 1, { 6 }, { IX_DEF } },
+	{ "pt", 1, { 7 }, { IX_TAG } },
+	{ "px", 1, { 7 }, { IX_MEMBER } },
+	{ "py", 1, { 7 }, { IX_MEMBER } },
+	{ "origin", 1, { 7 }, { IX_DEF } },
+	{ "color", 1, { 9 }, { IX_TAG } },
+	{ "RED", 1, { 9 }, { IX_ENUMCONST } },
+	{ "GREEN", 2, { 9, 11 }, { IX_ENUMCONST, IX_REF } },
+	{ "u", 1, { 10 }, { IX_TAG } },
+	{ "p", 1, { 10 }, { IX_MEMBER } },
+	{ "raw", 1, { 10 }, { IX_MEMBER } },
+	{ "corner", 1, { 8 }, { IX_DEF } },
+	{ "lost", 0 },
+	{ "other", 0 },
+	{ "early", 0 },
+	{ "late", 0 },
+	{ "lostag", 0 },
+	{ "lostmem", 0 },
+	{ "bad", 0 },
+	{ "missing", 0 },
+};
+
+#define NWANT	(sizeof(wants) / sizeof(wants[0]))
+
+/*
+ * Check the entries of a name in a mapped index. Only the first two are
+ * checked for line and kind. Returns 0 if they are as wanted, or -1 if not.
+ */
+static int check(struct indexmap *map, struct want *want) {
+	struct indexent *ent;
+	int first, count, i;
+
+	count = lookupindex(map, want->name, &first);
+	if (count != want->count) {
+		fprintf(stderr, "%s: %d entries, want %d\n", want->name, count,
+		    want->count);
+		return -1;
+	}
+	for (i = 0; i < count && i < 2; i++) {
+		ent = &map->entries[first + i];
+		if (strcmp(indexstr(map, ent->path), "<index>") != 0
+		    || (int)ent->line != want->lines[i]
+		    || (int)ent->kind != want->kinds[i]) {
+			fprintf(stderr, "%s: entry %d is %s:%u kind %u\n",
+			    want->name, i, indexstr(map, ent->path),
+			    ent->line, ent->kind);
+			return -1;
+		}
+	}
+	return 0;
+}
+
+/*
+ * Index a source, write the index out, map it back in, and check that
+ * looking names up finds what was declared.
+ */
+int main(void) {
+	static struct cpp cpp;
+	struct parser parser;
+	struct diagbuf diags;
+	struct index index;
+	struct indexmap map;
+	char path[] = "/tmp/indexXXXXXX";
+	int i, fd, status;
+
+	memset(&parser, 0, sizeof(parser));
+	memset(&diags, 0, sizeof(diags));
+	memset(&index, 0, sizeof(index));
+	parser.index = &index;
+	compile(&cpp, &parser, "<index>", source, strlen(source), &diags);
+	if (diags.count != 3) {
+		fprintf(stderr, "%d errors, want 3\n", diags.count);
+		flusherrors(&diags, stderr);
+		return 1;
+	}
+	clearerrors(&diags);
+	if ((fd = mkstemp(path)) < 0) {
+		perror(path);
+		return 1;
+	}
+	close(fd);
+	if (writeindex(&index, path) < 0 || openindex(&map, path) < 0) {
+		perror(path);
+		unlink(path);
+		return 1;
+	}
+	status = 0;
+	for (i = 0; i < (int)NWANT; i++) {
+		if (check(&map, &wants[i]) < 0)
+			status = 1;
+	}
+	closeindex(&map);
+	unlink(path);
+	indexfree(&index);
+	if (status == 0)
+		printf("index round-trips %d names\n", (int)NWANT);
+	return status;
+}
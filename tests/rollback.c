@@ -0,0 +1,137 @@
+#include <setjmp.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "token.h"
+#include "arena.h"
+#include "alloc.h"
+#include "error.h"
+#include "lex.h"
+#include "cpp.h"
+#include "parse.h"
+#include "compile.h"
+#include "tree.h"
+#include "walk.h"
+
+/*
+ * A source the parser has to guess its way through: type-names with array
+ * lengths that turn out to start compound literals rather than casts, and
+ * declarations recovered from after syntax errors. Each guess it backs out
+ * of makes nodes that are released and then made again.
+ */
+static char source[] =
+	"typedef int t;\n"
+	"int n;\n"
+	"int a = (int[2 + 1]){ 1, 2, 3 }[0] + sizeof(char[n * 2]);\n"
+	"int b = (t)(t[n + 1]){ 0 }[0] + (t)(n) * (n)(1);\n"
+	"int c = ;\n"
+	"int d = (t[4 * 2]){ (t[1 + 1]){ 0 }[0] }[0];\n"
+	"int e[3 +] = 4;\n"
+	"int f = sizeof(t[n + n]) + (t)sizeof(t);\n";
+
+/*
+ * An allocator that counts what goes through it.
+ */
+struct counts {
+	long allocs;		/* blocks allocated */
+	long frees;		/* blocks freed */
+};
+
+static struct counts counts;
+
+static void *countget(void *ctx, size_t size) {
+	((struct counts *)ctx)->allocs++;
+	return malloc(size);
+}
+
+static void *countresize(void *ctx, void *ptr, size_t old, size_t size) {
+	if (ptr == NULL)
+		((struct counts *)ctx)->allocs++;
+	return realloc(ptr, size);
+}
+
+static void countput(void *ctx, void *ptr, size_t size) {
+	((struct counts *)ctx)->frees++;
+	free(ptr);
+}
+
+/*
+ * Kinds of the nodes of a tree, in the order walked.
+ */
+struct kinds {
+	int kinds[4096];	/* kind of each node */
+	int count;		/* number of nodes */
+};
+
+static int addkind(struct tree *node, void *ctx) {
+	struct kinds *kinds;
+
+	kinds = ctx;
+	if (kinds->count < (int)(sizeof(kinds->kinds) / sizeof(int)))
+		kinds->kinds[kinds->count] = node->kind;
+	kinds->count++;
+	return 1;
+}
+
+/*
+ * Parse the source with nodes from `alloc`, or the parser's own arena if it
+ * is NULL, and gather the kinds of the tree's nodes. Returns how many nodes
+ * had been handed back by the time parsing finished.
+ */
+static long parsewith(struct allocator *alloc, struct kinds *kinds) {
+	static struct cpp cpp;
+	struct parser parser;
+	struct diagbuf diags;
+	long frees;
+
+	memset(&parser, 0, sizeof(parser));
+	memset(&diags, 0, sizeof(diags));
+	memset(kinds, 0, sizeof(*kinds));
+	parser.alloc = alloc;
+	compile(&cpp, &parser, "<rollback>", source, strlen(source), &diags);
+	clearerrors(&diags);
+	walk(parser.root, addkind, kinds);
+	frees = counts.frees;
+	parsefree(&parser);
+	return frees;
+}
+
+/*
+ * Check that backing out of guesses with nodes from a supplied allocator
+ * hands none of them back while parsing, and builds the same tree as the
+ * parser's own arena does.
+ */
+int main(void) {
+	static struct kinds own, supplied;
+	struct allocator alloc;
+	long frees;
+
+	alloc.alloc = countget;
+	alloc.resize = countresize;
+	alloc.free = countput;
+	alloc.reset = NULL;
+	alloc.ctx = &counts;
+	parsewith(NULL, &own);
+	frees = parsewith(&alloc, &supplied);
+	if (own.count != supplied.count || memcmp(own.kinds, supplied.kinds,
+	    sizeof(own.kinds)) != 0) {
+		fprintf(stderr, "tree has %d nodes from a supplied allocator, "
+		    "%d from the arena\n", supplied.count, own.count);
+		return 1;
+	}
+	if (frees != 0) {
+		fprintf(stderr, "%ld nodes handed back while parsing\n",
+		    frees);
+		return 1;
+	}
+	if (counts.frees != counts.allocs) {
+		fprintf(stderr, "%ld of %ld blocks handed back\n", counts.frees,
+		    counts.allocs);
+		return 1;
+	}
+	printf("%d nodes parsed alike, none handed back while parsing\n",
+	    own.count);
+	return 0;
+}
@@ -0,0 +1,332 @@
+#include <math.h>
+#include <setjmp.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "token.h"
+#include "arena.h"
+#include "alloc.h"
+#include "error.h"
+#include "lex.h"
+#include "cpp.h"
+#include "parse.h"
+#include "compile.h"
+#include "walk.h"
+
+/*
+ * How many times each input is doubled, and how many times each is timed.
+ * The fastest run counts, since anything slower was only disturbed.
+ */
+#define NDOUBLE		5
+#define NRUN		3
+
+/*
+ * Largest scaling exponent allowed. Time taken should grow linearly with
+ * the size of the input; anything near 2 is quadratic.
+ */
+#define MAXEXPONENT	1.4
+
+/*
+ * An input that grows with `n`. Each case is timed at `start`, then at
+ * double that, and so on.
+ */
+struct stresscase {
+	char *name;
+	void (*generate)(struct outbuf *out, int n);
+	int start;
+};
+
+/*
+ * Append formatted text to a buffer.
+ */
+static void append(struct outbuf *out, char *fmt, ...) {
+	char line[256];
+	va_list ap;
+	int length;
+
+	va_start(ap, fmt);
+	length = vsnprintf(line, sizeof(line), fmt, ap);
+	va_end(ap);
+	outappend(out, line, length);
+}
+
+/*
+ * Many declarations with parameters and array suffixes.
+ */
+static void declarations(struct outbuf *out, int n) {
+	int i;
+
+	for (i = 0; i < n; i++)
+		append(out, "int v%d(int a, char *b[4], void (*c)(int));\n", i);
+}
+
+/*
+ * One long expression.
+ */
+static void expression(struct outbuf *out, int n) {
+	int i;
+
+	append(out, "int x = 1");
+	for (i = 0; i < n; i++)
+		append(out, " %c %d", "+-*/"[i % 4], i + 1);
+	append(out, ";\n");
+}
+
+/*
+ * Declarators nested `n` levels deep in parentheses, each level with a
+ * suffix that applies before the level inside it. How many there are is
+ * fixed, so the input grows with the depth alone.
+ */
+static void declarators(struct outbuf *out, int n) {
+	int i, j;
+
+	for (i = 0; i < 256; i++) {
+		append(out, "int ");
+		for (j = 0; j < n; j++)
+			append(out, "(*");
+		append(out, "d%d", i);
+		for (j = 0; j < n; j++)
+			append(out, ")[%d]", j + 1);
+		append(out, ";\n");
+	}
+}
+
+/*
+ * Many object-like macros, each used once.
+ */
+static void macros(struct outbuf *out, int n) {
+	int i;
+
+	for (i = 0; i < n; i++)
+		append(out, "#define M%d (%d + 1)\nint m%d = M%d;\n", i, i, i,
+		    i);
+}
+
+/*
+ * Many conditional groups, half of them skipped.
+ */
+static void conditionals(struct outbuf *out, int n) {
+	int i;
+
+	for (i = 0; i < n; i++)
+		append(out, "#if %d %% 2 && (%d > 0 || 1 / 0)\nint c%d;\n"
+		    "#else\nlong c%d;\n#endif\n", i, i, i, i);
+}
+
+/*
+ * One function with many statements.
+ */
+static void statements(struct outbuf *out, int n) {
+	int i;
+
+	append(out, "int f(int a) {\n");
+	for (i = 0; i < n; i++)
+		append(out, "\tif (a > %d) a = (int)(a * 2); else a++;\n", i);
+	append(out, "\treturn a;\n}\n");
+}
+
+/*
+ * A chain of macros, each expanding to the one before, used once from the
+ * top. Every expansion adds a name to the hide-set of the tokens it makes,
+ * so the sets grow to `n` names.
+ */
+static void macrochain(struct outbuf *out, int n) {
+	int i;
+
+	append(out, "#define A0 0\n");
+	for (i = 1; i < n; i++)
+		append(out, "#define A%d A%d\n", i, i - 1);
+	append(out, "int chain = A%d;\n", n - 1);
+}
+
+/*
+ * One long string literal, and many character literals.
+ */
+static void literals(struct outbuf *out, int n) {
+	int i;
+
+	append(out, "char *s = \"");
+	for (i = 0; i < n; i++)
+		append(out, "%d: some text in a string, ", i);
+	append(out, "\";\nint c[] = {");
+	for (i = 0; i < n; i++)
+		append(out, " '%c', 'ab',", 'a' + i % 26);
+	append(out, " 0 };\n");
+}
+
+/*
+ * Expressions nested `n` levels deep, in parentheses and in operands of
+ * operators of every precedence. How many there are is fixed, so the input
+ * grows with the depth alone.
+ */
+static void nesting(struct outbuf *out, int n) {
+	int i, j;
+
+	for (i = 0; i < 256; i++) {
+		append(out, "int e%d = ", i);
+		for (j = 0; j < n; j++)
+			append(out, "%s(", j % 2 ? "-" : "1 ? ");
+		append(out, "%d", i);
+		for (j = n - 1; j >= 0; j--)
+			append(out, ") %s %d", j % 2 ? "*" : ": 1 <<", j + 1);
+		append(out, ";\n");
+	}
+}
+
+static struct stresscase cases[] = {
+	{ "declarations", declarations, 2000 },
+	{ "expression", expression, 2000 },
+	{ "declarators", declarators, 4 },
+	{ "macros", macros, 2000 },
+	{ "macrochain", macrochain, 2000 },
+	{ "conditionals", conditionals, 2000 },
+	{ "statements", statements, 2000 },
+	{ "literals", literals, 2000 },
+	{ "nesting", nesting, 4 },
+};
+
+#define NCASE	(sizeof(cases) / sizeof(cases[0]))
+
+/*
+ * How long each phase of the front-end took over one source.
+ */
+struct phases {
+	double total;		/* the whole of compile */
+	double lex;		/* lexing the source alone */
+	double parse;		/* parsing tokens already preprocessed */
+};
+
+/*
+ * Get the time in seconds.
+ */
+static double now(void) {
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/*
+ * Time the front-end over a source: the whole of it, and lexing and parsing
+ * on their own, so that a phase that scales badly is not hidden by the
+ * others. Each is the fastest of NRUN runs. Returns 0, or -1 if the source
+ * does not compile.
+ */
+static int timesource(struct cpp *cpp, struct parser *parser,
+    struct outbuf *out, struct phases *best) {
+	static struct lexer lexer;
+	struct phases run;
+	double start;
+	int i;
+
+	for (i = 0; i < NRUN; i++) {
+		start = now();
+		if (compile(cpp, parser, "<stress>", out->data, out->length,
+		    NULL) < 0) {
+			fprintf(stderr, "%s\n", lasterror());
+			return -1;
+		}
+		run.total = now() - start;
+
+		lexreset(&lexer, out->data, out->length);
+		start = now();
+		lex(&lexer);
+		run.lex = now() - start;
+
+		cppreset(cpp, "<stress>", out->data, out->length);
+		parsereset(parser, preprocess(cpp));
+		start = now();
+		parse(parser);
+		run.parse = now() - start;
+
+		if (i == 0 || run.total < best->total)
+			best->total = run.total;
+		if (i == 0 || run.lex < best->lex)
+			best->lex = run.lex;
+		if (i == 0 || run.parse < best->parse)
+			best->parse = run.parse;
+	}
+	lexfree(&lexer);
+	return 0;
+}
+
+/*
+ * Fit `time = c * size^k` to the timings by least squares on their
+ * logarithms, and return `k`.
+ */
+static double exponent(double *sizes, double *times, int count) {
+	double sx, sy, sxx, sxy, x, y;
+	int i;
+
+	sx = sy = sxx = sxy = 0;
+	for (i = 0; i < count; i++) {
+		x = log(sizes[i]);
+		y = log(times[i]);
+		sx += x;
+		sy += y;
+		sxx += x * x;
+		sxy += x * y;
+	}
+	return (count * sxy - sx * sy) / (count * sxx - sx * sx);
+}
+
+/*
+ * Get how a phase's time scales, with runs too quick for the clock
+ * counted as taking the clock's resolution: they say nothing about how it
+ * scales.
+ */
+static double scaling(double *sizes, double *times) {
+	int i;
+
+	for (i = 0; i < NDOUBLE; i++) {
+		if (times[i] < 1e-6)
+			times[i] = 1e-6;
+	}
+	return exponent(sizes, times, NDOUBLE);
+}
+
+/*
+ * Time each case at doubling sizes and fail if it, or lexing or parsing it
+ * on their own, grows super-linearly.
+ */
+int main(void) {
+	static struct cpp cpp;
+	struct parser parser;
+	struct outbuf out;
+	struct phases phases;
+	double sizes[NDOUBLE], totals[NDOUBLE], lexes[NDOUBLE];
+	double parses[NDOUBLE], k, klex, kparse;
+	int i, j, n, status, fail;
+
+	memset(&parser, 0, sizeof(parser));
+	memset(&out, 0, sizeof(out));
+	status = 0;
+	for (i = 0; i < (int)NCASE; i++) {
+		for (j = 0, n = cases[i].start; j < NDOUBLE; j++, n *= 2) {
+			out.length = 0;
+			cases[i].generate(&out, n);
+			sizes[j] = n;
+			if (timesource(&cpp, &parser, &out, &phases) < 0)
+				return 1;
+			totals[j] = phases.total;
+			lexes[j] = phases.lex;
+			parses[j] = phases.parse;
+		}
+		k = scaling(sizes, totals);
+		klex = scaling(sizes, lexes);
+		kparse = scaling(sizes, parses);
+		fail = k > MAXEXPONENT || klex > MAXEXPONENT
+		    || kparse > MAXEXPONENT;
+		printf("%-16s n=%d..%d %.3fs..%.3fs exponent %.2f "
+		    "(lex %.2f, parse %.2f)%s\n", cases[i].name,
+		    cases[i].start, n / 2, totals[0], totals[NDOUBLE - 1], k,
+		    klex, kparse, fail ? " FAIL" : "");
+		if (fail)
+			status = 1;
+	}
+	outfree(&out);
+	return status;
+}
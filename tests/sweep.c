@@ -0,0 +1,309 @@
+#include <setjmp.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "token.h"
+#include "arena.h"
+#include "alloc.h"
+#include "error.h"
+#include "lex.h"
+#include "cpp.h"
+#include "parse.h"
+#include "compile.h"
+#include "header.h"
+#include "tree.h"
+#include "walk.h"
+
+/*
+ * Sources that make nodes the parser does not keep: array lengths that are
+ * not literals, struct and enum bodies, guesses it backs out of, and
+ * declarations it recovers from errors in.
+ */
+static char *sources[] = {
+	"int n;\nint a[n + 1];\nint b[sizeof(int) * 2][3];\n",
+	"void f(int n, int m[n * 2], char (*p)[n + n]);\n",
+	"struct s { int x : 3 + 1; int y[2 * 2]; _Static_assert(1, \"\"); };\n"
+	"enum e { A = 1 << 2, B = A + 1 };\nstruct s v;\n",
+	"typedef int t;\nint g(int a) {\n\tint c[a + 1];\n"
+	"\ta = (t)(a) + (a)(1) + sizeof(t) + sizeof(a + 1);\n"
+	"\treturn (int){ 1 } + c[0];\n}\n",
+	"int x = ;\nint y = 1 + 2;\nint z[3 +] = 4;\nint w = y * 2;\n",
+};
+
+#define NSOURCE	(sizeof(sources) / sizeof(sources[0]))
+
+/*
+ * A header imported from the header-store, whose nodes belong to it and
+ * not to the parser that imports it, and a source that includes it.
+ */
+static char header[] =
+	"#ifndef SWEEP_H\n#define SWEEP_H\n"
+	"typedef int hint;\nstruct hs { int a[2 + 2]; };\nhint hv = 1 + 2;\n"
+	"#endif\n";
+
+static char includer[] =
+	"#include \"%s\"\nhint m = hv * 2;\nstruct hs ms[1 + 1];\n";
+
+/*
+ * Nodes seen by one way of visiting a tree.
+ */
+struct seen {
+	struct tree **nodes;	/* nodes in the order visited */
+	int count;		/* number of nodes */
+	int capacity;		/* nodes allocated */
+	struct cpp *cpp;	/* trees of its imports are not walked */
+};
+
+static void see(struct tree *node, void *ctx) {
+	struct seen *seen;
+
+	seen = ctx;
+	if (seen->count == seen->capacity) {
+		seen->capacity = seen->capacity ? seen->capacity * 2 : 64;
+		seen->nodes = realloc(seen->nodes,
+		    seen->capacity * sizeof(struct tree *));
+	}
+	seen->nodes[seen->count++] = node;
+}
+
+static int seewalk(struct tree *node, void *ctx) {
+	struct seen *seen;
+	int i;
+
+	seen = ctx;
+	for (i = 0; seen->cpp != NULL && i < seen->cpp->nimport; i++) {
+		if (node == seen->cpp->imports[i]->parser.root)
+			return 0;
+	}
+	see(node, ctx);
+	return 1;
+}
+
+static int bypointer(const void *a, const void *b) {
+	struct tree *x, *y;
+
+	x = *(struct tree **)a;
+	y = *(struct tree **)b;
+	return x < y ? -1 : x > y;
+}
+
+/*
+ * Check that sweeping the parser's nodes visits just the nodes that
+ * walking a tree does, leaving out those of the headers the preprocessor
+ * imported. Returns 0 if so, or -1 if not.
+ */
+static int check(struct parser *parser, struct cpp *cpp, struct tree *root,
+    char *what) {
+	struct seen swept, walked;
+	int status;
+
+	memset(&swept, 0, sizeof(swept));
+	memset(&walked, 0, sizeof(walked));
+	walked.cpp = cpp;
+	sweep(parser, -1, see, &swept);
+	walk(root, seewalk, &walked);
+	qsort(swept.nodes, swept.count, sizeof(struct tree *), bypointer);
+	qsort(walked.nodes, walked.count, sizeof(struct tree *), bypointer);
+	status = 0;
+	if (swept.count != walked.count || memcmp(swept.nodes, walked.nodes,
+	    swept.count * sizeof(struct tree *)) != 0) {
+		fprintf(stderr, "%s: sweep visited %d nodes, walk %d\n",
+		    what, swept.count, walked.count);
+		status = -1;
+	}
+	free(swept.nodes);
+	free(walked.nodes);
+	return status;
+}
+
+/*
+ * What each streamed declaration is checked against.
+ */
+struct streamcheck {
+	struct parser *parser;	/* parser streaming it */
+	struct cpp *cpp;	/* preprocessor feeding it */
+	char *what;		/* name of source and way it was parsed */
+	int status;		/* -1 once a check fails */
+	int count;		/* declarations checked */
+};
+
+static void checkdecl(struct tree *decl, void *sink) {
+	struct streamcheck *sc;
+
+	sc = sink;
+	if (check(sc->parser, sc->cpp, decl, sc->what) < 0)
+		sc->status = -1;
+	sc->count++;
+}
+
+/*
+ * Parse a source every way there is, keeping going past errors: into a
+ * tree and streamed, with nodes from the parser's own arena and from a
+ * supplied allocator. Sweep and walk must agree each time, and a streamed
+ * source must hand over at least one declaration. Returns 0 if they do,
+ * or -1 if not.
+ */
+static int checkall(struct cpp *cpp, char *source, int n) {
+	struct streamcheck sc;
+	struct parser parser;
+	struct diagbuf diags;
+	char what[64];
+	int supplied, status;
+
+	status = 0;
+	for (supplied = 0; supplied < 2; supplied++) {
+		memset(&parser, 0, sizeof(parser));
+		memset(&diags, 0, sizeof(diags));
+		parser.alloc = supplied ? &sysalloc : NULL;
+		snprintf(what, sizeof(what), "source %d, %s", n,
+		    supplied ? "supplied" : "arena");
+		compile(cpp, &parser, "<sweep>", source, strlen(source),
+		    &diags);
+		clearerrors(&diags);
+		if (check(&parser, cpp, parser.root, what) < 0)
+			status = -1;
+
+		memset(&sc, 0, sizeof(sc));
+		sc.parser = &parser;
+		sc.cpp = cpp;
+		sc.what = what;
+		strcat(what, ", streamed");
+		compilestream(cpp, &parser, "<sweep>", source, strlen(source),
+		    &diags, checkdecl, &sc);
+		clearerrors(&diags);
+		if (sc.status < 0)
+			status = -1;
+		if (sc.count == 0) {
+			fprintf(stderr, "%s: nothing streamed\n", what);
+			status = -1;
+		}
+		parsefree(&parser);
+	}
+	return status;
+}
+
+/*
+ * How many declarations the fan-out check spreads over threads. Every
+ * tenth has a long initializer, so threads get uneven work.
+ */
+#define NFANDECL	2000
+
+static int countnode(struct tree *node, void *ctx) {
+	(*(int *)ctx)++;
+	return 1;
+}
+
+/*
+ * Write out a declaration's name and how many nodes it has.
+ */
+static void writedecl(struct tree *item, struct outbuf *out, void *ctx) {
+	char line[64];
+	int count, length;
+
+	count = 0;
+	walk(item, countnode, &count);
+	length = snprintf(line, sizeof(line), "%.*s %d\n",
+	    item->token != NULL ? item->token->length : 1,
+	    item->token != NULL ? item->token->text : "?", count);
+	outappend(out, line, length);
+}
+
+/*
+ * Fan a tree out over different numbers of threads, more than once each so
+ * that threads kept from one call are used by the next, and check that the
+ * output is the same every time. Returns 0 if so, or -1 if not.
+ */
+static int checkfanout(struct cpp *cpp) {
+	static int nthreads[] = { 1, 2, 3, 8, MAXTHREAD, 4 };
+	struct outbuf first, out;
+	struct parser parser;
+	char *source;
+	int i, length, count, status;
+
+	source = malloc(NFANDECL * 64);
+	length = 0;
+	for (i = 0; i < NFANDECL; i++) {
+		length += sprintf(&source[length], "int f%d = %s;\n", i,
+		    i % 10 == 0 ? "1 + 2 * 3 - 4 / 5 + (6 << 7) - 8 % 9 + 10"
+		    : "1");
+	}
+	memset(&parser, 0, sizeof(parser));
+	memset(&first, 0, sizeof(first));
+	status = 0;
+	if (compile(cpp, &parser, "<fanout>", source, length, NULL) < 0) {
+		fprintf(stderr, "%s\n", lasterror());
+		status = -1;
+	}
+	for (i = 0; status == 0 && i < 12; i++) {
+		memset(&out, 0, sizeof(out));
+		count = fanout(parser.root, nthreads[i % 6], writedecl, NULL,
+		    &out);
+		if (i == 0)
+			first = out;
+		if (count != NFANDECL || out.length != first.length
+		    || memcmp(out.data, first.data, out.length) != 0) {
+			fprintf(stderr, "fan-out over %d threads gave %d "
+			    "items, and differs\n", nthreads[i % 6], count);
+			status = -1;
+		}
+		if (i > 0)
+			outfree(&out);
+	}
+	if (status == 0 && strncmp(first.data, "f0 ", 3) != 0) {
+		fprintf(stderr, "fan-out is not in source order\n");
+		status = -1;
+	}
+	outfree(&first);
+	parsefree(&parser);
+	free(source);
+	return status;
+}
+
+/*
+ * Parse each source, and one that imports a header from the header-store,
+ * and check that sweep and walk agree on what is in the tree. Then check
+ * that fanning a tree out gives the same output on any number of threads.
+ */
+int main(void) {
+	static struct cpp cpp;
+	char dir[] = "/tmp/sweepXXXXXX";
+	char path[MAXPATH], source[MAXPATH + 64];
+	FILE *file;
+	int i, status;
+
+	status = 0;
+	for (i = 0; i < (int)NSOURCE; i++) {
+		if (checkall(&cpp, sources[i], i) < 0)
+			status = 1;
+	}
+	if (mkdtemp(dir) == NULL) {
+		perror(dir);
+		return 1;
+	}
+	snprintf(path, sizeof(path), "%s/sweep.h", dir);
+	if ((file = fopen(path, "w")) == NULL) {
+		perror(path);
+		rmdir(dir);
+		return 1;
+	}
+	fputs(header, file);
+	fclose(file);
+	snprintf(source, sizeof(source), includer, path);
+	cpp.shareheaders = 1;
+	if (checkall(&cpp, source, i) < 0)
+		status = 1;
+	unlink(path);
+	rmdir(dir);
+	cpp.shareheaders = 0;
+	if (checkfanout(&cpp) < 0)
+		status = 1;
+	if (status == 0)
+		printf("sweep and walk agree on %d sources, in trees and "
+		    "streamed, from the arena and a supplied allocator; "
+		    "fan-out agrees on any number of threads\n",
+		    (int)NSOURCE + 1);
+	return status;
+}
@@ -0,0 +1,133 @@
+#include <setjmp.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "token.h"
+#include "arena.h"
+#include "alloc.h"
+#include "error.h"
+#include "lex.h"
+#include "cpp.h"
+#include "parse.h"
+#include "compile.h"
+#include "tree.h"
+#include "walk.h"
+
+/*
+ * Declarations whose types must come out the same or different. Tags are
+ * told apart by block, untagged types by where they appear, and array
+ * lengths by their value.
+ */
+static char source[] =
+	"struct { int a; } anon1;\n"
+	"struct { double b; } anon2;\n"
+	"struct s { int a; } file1;\n"
+	"struct s file2;\n"
+	"void f(void) {\n"
+	"\tstruct s { int z; } block1;\n"
+	"\tstruct s block2;\n"
+	"\t{\n"
+	"\t\tstruct s inner1;\n"
+	"\t\tstruct s;\n"
+	"\t\tstruct s inner2;\n"
+	"\t}\n"
+	"\tstruct s block3;\n"
+	"}\n"
+	"struct s file3;\n"
+	"int len1[2 * 3];\n"
+	"int len2[6];\n"
+	"int len3[];\n"
+	"int len4[(1 << 2) + 2 ? 6 : 0];\n"
+	"int proto1();\n"
+	"int proto2(void);\n"
+	"int proto3(a, b);\n";
+
+/*
+ * A pair of declared names, and whether their types should be the same.
+ */
+struct want {
+	char *a;
+	char *b;
+	int same;
+};
+
+static struct want wants[] = {
+	{ "anon1", "anon2", 0 },
+	{ "file1", "file2", 1 },
+	{ "file1", "file3", 1 },
+	{ "file1", "block1", 0 },
+	{ "block1", "block2", 1 },
+	{ "block1", "inner1", 1 },
+	{ "block1", "inner2", 0 },
+	{ "block1", "block3", 1 },
+	{ "len1", "len2", 1 },
+	{ "len1", "len3", 0 },
+	{ "len1", "len4", 1 },
+	{ "proto1", "proto2", 0 },
+	{ "proto1", "proto3", 1 },
+};
+
+#define NWANT	(sizeof(wants) / sizeof(wants[0]))
+
+/*
+ * A name to find the type of.
+ */
+struct find {
+	char *name;
+	struct type *type;	/* type found, NULL if none yet */
+};
+
+static int finddecl(struct tree *node, void *ctx) {
+	struct find *find;
+
+	find = ctx;
+	if (node->kind == AST_DECL && node->token != NULL
+	    && node->token->length == (int)strlen(find->name)
+	    && !memcmp(node->token->text, find->name,
+	    node->token->length))
+		find->type = node->type;
+	return 1;
+}
+
+/*
+ * Get the type a name was declared with, or NULL if it was not declared.
+ */
+static struct type *declaredtype(struct tree *root, char *name) {
+	struct find find;
+
+	find.name = name;
+	find.type = NULL;
+	walk(root, finddecl, &find);
+	return find.type;
+}
+
+int main(void) {
+	static struct cpp cpp;
+	struct parser parser;
+	struct type *a, *b;
+	int i, status;
+
+	memset(&parser, 0, sizeof(parser));
+	if (compile(&cpp, &parser, "<types>", source, strlen(source),
+	    NULL) < 0) {
+		fprintf(stderr, "%s\n", lasterror());
+		return 1;
+	}
+	status = 0;
+	for (i = 0; i < (int)NWANT; i++) {
+		a = declaredtype(parser.root, wants[i].a);
+		b = declaredtype(parser.root, wants[i].b);
+		if (a == NULL || b == NULL || (a == b) != wants[i].same) {
+			fprintf(stderr, "%s and %s should%s be the same type\n",
+			    wants[i].a, wants[i].b,
+			    wants[i].same ? "" : " not");
+			status = 1;
+		}
+	}
+	if (status == 0)
+		printf("%d pairs of types compare as they should\n",
+		    (int)NWANT);
+	return status;
+}